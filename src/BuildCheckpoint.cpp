@@ -0,0 +1,272 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file BuildCheckpoint.cpp
+ * @brief This defines the `BuildCheckpoint` class
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "cpl_error.h"
+#include "cpl_vsi.h"
+
+#include "../deps/concat.hpp"
+#include "CTBException.hpp"
+#include "BuildCheckpoint.hpp"
+
+using namespace std;
+using namespace ctb;
+
+ctb::BuildCheckpoint::BuildCheckpoint():
+  enabled(false),
+  initialised(false),
+  stopping(false),
+  startZoom(0),
+  endZoom(0),
+  tileCount(0),
+  finishedTiles(0),
+  elapsedSeconds(0)
+{}
+
+void
+ctb::BuildCheckpoint::reset() {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  enabled = initialised = stopping = false;
+  tileCount = finishedTiles = 0;
+  elapsedSeconds = 0;
+  bitmap.clear();
+  finished.clear();
+  levels.clear();
+}
+
+/**
+ * @details The dataset and format are recorded in the checkpoint file, so
+ * that the checkpoint of another build isn't continued by mistake.
+ */
+void
+ctb::BuildCheckpoint::enable(const std::string &checkpointFile, const std::string &inputFilename, const std::string &outputFormat) {
+  filename = checkpointFile;
+  this->inputFilename = inputFilename;
+  this->outputFormat = outputFormat;
+  enabled = true;
+  startTime = std::chrono::steady_clock::now();
+}
+
+void
+ctb::BuildCheckpoint::load() {
+  FILE *fp = fopen(filename.c_str(), "rb");
+  if (fp == NULL) {
+    throw CTBException("Could not open the checkpoint file");
+  }
+
+  char line[4096];
+  int version = 0;
+  unsigned int start, end;
+  size_t bytes = 0;
+  bool valid = fscanf(fp, "CTBCHECKPOINT %d\n", &version) == 1 && version == 1
+    && fgets(line, sizeof(line), fp) != NULL && strncmp(line, "input ", 6) == 0
+    && inputFilename == std::string(line + 6, strlen(line + 6) - 1)
+    && fgets(line, sizeof(line), fp) != NULL && strncmp(line, "format ", 7) == 0
+    && outputFormat == std::string(line + 7, strlen(line + 7) - 1)
+    && fscanf(fp, "zooms %u %u\n", &start, &end) == 2
+    && fscanf(fp, "tiles %u %u %lf\n", &tileCount, &finishedTiles, &elapsedSeconds) == 3;
+
+  if (valid) {
+    startZoom = start;
+    endZoom = end;
+    finished.assign(start + 1, 0);
+    levels.resize(start + 1);
+
+    // The number of finished tiles and their extent for each zoom level,
+    // followed by the header of the bitmap.  The lines are read whole so that
+    // no byte of the bitmap is skipped as whitespace.
+    unsigned int zoom, count;
+    TerrainMetadata::LevelInfo level;
+    while ((valid = fgets(line, sizeof(line), fp) != NULL)
+           && sscanf(line, "level %u %u %d %d %d %d", &zoom, &count,
+                     &level.startX, &level.startY, &level.finalX, &level.finalY) == 6) {
+      valid = zoom <= start;
+      if (!valid) break;
+      finished[zoom] = count;
+      levels[zoom] = level;
+    }
+
+    valid = valid
+      && sscanf(line, "bitmap %zu", &bytes) == 1
+      && bytes == (tileCount + 7) / 8;
+
+    if (valid) {
+      bitmap.resize(bytes);
+      valid = fread(bitmap.data(), 1, bytes, fp) == bytes;
+    }
+  }
+  fclose(fp);
+
+  if (!valid) {
+    throw CTBException("The checkpoint file is invalid or belongs to a different build");
+  }
+  initialised = true;
+}
+
+void
+ctb::BuildCheckpoint::init(const GridIterator &iter, i_zoom start, i_zoom end) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  if (initialised) {
+    if (start != startZoom || end != endZoom || iter.getSize() != tileCount) {
+      throw CTBException("The zoom levels of the checkpoint do not match the build");
+    }
+  } else {
+    startZoom = start;
+    endZoom = end;
+    tileCount = iter.getSize();
+    bitmap.assign((tileCount + 7) / 8, 0);
+    finished.assign(startZoom + 1, 0);
+    initialised = true;
+  }
+}
+
+bool
+ctb::BuildCheckpoint::isDone(int index) {
+  if (!enabled) return false;
+
+  std::lock_guard<std::mutex> lock(mutex);
+  return (bitmap[index >> 3] >> (index & 7)) & 1;
+}
+
+void
+ctb::BuildCheckpoint::add(int index, const TileCoordinate *coordinate) {
+  std::lock_guard<std::mutex> lock(mutex);
+
+  bitmap[index >> 3] |= (1 << (index & 7));
+  ++finished[coordinate->zoom];
+  ++finishedTiles;
+
+  if (levels.size() <= coordinate->zoom) {
+    levels.resize(coordinate->zoom + 1);
+  }
+  levels[coordinate->zoom].add(coordinate);
+}
+
+int
+ctb::BuildCheckpoint::position() const {
+  for (size_t i = 0; i < bitmap.size(); ++i) {
+    if (bitmap[i] != 0xFF) {
+      int index = i * 8;
+      while ((bitmap[i] >> (index & 7)) & 1) ++index;
+      return index;
+    }
+  }
+  return tileCount;
+}
+
+TerrainMetadata
+ctb::BuildCheckpoint::metadata(const Grid &grid) const {
+  TerrainMetadata result;
+  for (size_t zoom = 0; zoom < levels.size(); ++zoom) {
+    const TerrainMetadata::LevelInfo &level = levels[zoom];
+    if (level.finalX >= level.startX) {
+      const TileCoordinate ll(zoom, level.startX, level.startY), ur(zoom, level.finalX, level.finalY);
+      result.add(grid, &ll);
+      result.add(grid, &ur);
+    }
+  }
+  return result;
+}
+
+void
+ctb::BuildCheckpoint::save() {
+  const std::string temp_filename = concat(filename, ".tmp");
+  std::vector<unsigned char> bitmapCopy;
+  std::vector<i_tile> finishedCopy;
+  std::vector<TerrainMetadata::LevelInfo> levelsCopy;
+  unsigned int tiles, total;
+  double seconds;
+
+  // Take a consistent snapshot of the state, then write it unlocked
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!initialised) return;
+
+    bitmapCopy = bitmap;
+    finishedCopy = finished;
+    levelsCopy = levels;
+    tiles = finishedTiles;
+    total = tileCount;
+    seconds = elapsedSeconds + std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  }
+  levelsCopy.resize(finishedCopy.size());
+
+  FILE *fp = fopen(temp_filename.c_str(), "wb");
+  if (fp == NULL) {
+    throw CTBException("Could not open the checkpoint file");
+  }
+
+  fprintf(fp, "CTBCHECKPOINT 1\n");
+  fprintf(fp, "input %s\n", inputFilename.c_str());
+  fprintf(fp, "format %s\n", outputFormat.c_str());
+  fprintf(fp, "zooms %u %u\n", (unsigned int) startZoom, (unsigned int) endZoom);
+  fprintf(fp, "tiles %u %u %.3f\n", total, tiles, seconds);
+  for (size_t zoom = 0; zoom < finishedCopy.size(); ++zoom) {
+    const TerrainMetadata::LevelInfo &level = levelsCopy[zoom];
+    fprintf(fp, "level %u %u %d %d %d %d\n", (unsigned int) zoom, finishedCopy[zoom],
+            level.startX, level.startY, level.finalX, level.finalY);
+  }
+  fprintf(fp, "bitmap %zu\n", bitmapCopy.size());
+  size_t written = fwrite(bitmapCopy.data(), 1, bitmapCopy.size(), fp);
+
+  if (fclose(fp) != 0 || written != bitmapCopy.size()) {
+    throw CTBException("Could not write the checkpoint file");
+  }
+  if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
+    throw CTBException("Could not rename temporary checkpoint file");
+  }
+}
+
+/**
+ * @details A checkpoint that can't be saved is reported as a GDAL error and
+ * the build carries on, saving it again at the next interval.
+ */
+void
+ctb::BuildCheckpoint::run(int interval) {
+  std::unique_lock<std::mutex> lock(stopMutex);
+
+  while (!stopCondition.wait_for(lock, std::chrono::seconds(interval), [this]{ return stopping; })) {
+    try {
+      save();
+    } catch (CTBException &e) {
+      CPLError(CE_Failure, CPLE_AppDefined, "%s", e.what());
+    }
+  }
+}
+
+void
+ctb::BuildCheckpoint::stop() {
+  {
+    std::lock_guard<std::mutex> lock(stopMutex);
+    stopping = true;
+  }
+  stopCondition.notify_all();
+  enabled = false;
+}
+
+void
+ctb::BuildCheckpoint::remove() {
+  VSIUnlink(filename.c_str());
+}
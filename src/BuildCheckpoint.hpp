@@ -0,0 +1,135 @@
+#ifndef BUILDCHECKPOINT_HPP
+#define BUILDCHECKPOINT_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file BuildCheckpoint.hpp
+ * @brief This declares the `BuildCheckpoint` class
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "types.hpp"
+#include "Grid.hpp"
+#include "GridIterator.hpp"
+#include "TerrainMetadata.hpp"
+
+namespace ctb {
+  class BuildCheckpoint;
+}
+
+/**
+ * @brief Periodically saves the state of a build so that it can be continued
+ *
+ * A checkpoint records which tiles (identified by their global iterator index)
+ * have been finished by all threads, the number of tiles finished per zoom
+ * level and the metadata and statistics gathered so far.  It is written
+ * atomically to the output directory at a fixed interval, allowing an
+ * interrupted build to be continued without probing the output for every
+ * tile.
+ */
+class CTB_DLL ctb::BuildCheckpoint {
+public:
+  BuildCheckpoint();
+
+  /// Forget the state of any previous build
+  void
+  reset();
+
+  /// Enable checkpointing of the build of a dataset to a file
+  void
+  enable(const std::string &checkpointFile, const std::string &inputFilename, const std::string &outputFormat);
+
+  /// Is the build being checkpointed?
+  inline bool
+  isEnabled() const {
+    return enabled;
+  }
+
+  /// Read the state of a previous build from the checkpoint file
+  void
+  load();
+
+  /// Set the tiles to be tracked from an iterator (only the first call counts)
+  void
+  init(const GridIterator &iter, i_zoom start, i_zoom end);
+
+  /// Has the tile at a global iterator index already been finished?
+  bool
+  isDone(int index);
+
+  /// Record the tile at a global iterator index as being finished
+  void
+  add(int index, const TileCoordinate *coordinate);
+
+  /// The global iterator index of the first tile not yet finished
+  int
+  position() const;
+
+  /// The number of tiles already finished in a zoom level
+  inline i_tile
+  finishedInZoom(i_zoom zoom) const {
+    return (zoom < finished.size()) ? finished[zoom] : 0;
+  }
+
+  /// Get the metadata of the finished tiles
+  TerrainMetadata
+  metadata(const Grid &grid) const;
+
+  /// Write the checkpoint file, replacing any previous one atomically
+  void
+  save();
+
+  /// Save the checkpoint every `interval` seconds until stopped
+  void
+  run(int interval);
+
+  /// Stop the periodic saving and stop tracking tiles
+  void
+  stop();
+
+  /// Remove the checkpoint file once the build is complete
+  void
+  remove();
+
+protected:
+  std::mutex mutex;
+  std::mutex stopMutex;
+  std::condition_variable stopCondition;
+  bool enabled;                     ///< Is the build being checkpointed?
+  bool initialised;                 ///< Are the tiles being tracked?
+  bool stopping;                    ///< Has the periodic saving been stopped?
+  std::string filename;             ///< The checkpoint file
+  std::string inputFilename;        ///< The source dataset of the build
+  std::string outputFormat;         ///< The output format of the build
+  i_zoom startZoom, endZoom;        ///< The zoom levels of the build
+  unsigned int tileCount;           ///< The total number of tiles in the build
+  unsigned int finishedTiles;       ///< The number of tiles finished
+  double elapsedSeconds;            ///< The time spent by previous runs
+  std::chrono::steady_clock::time_point startTime; ///< When this run started
+  std::vector<unsigned char> bitmap; ///< One bit per tile, set when finished
+  std::vector<i_tile> finished;     ///< The number of tiles finished per zoom level
+  std::vector<TerrainMetadata::LevelInfo> levels; ///< The extent of the finished tiles per zoom level
+};
+
+#endif /* BUILDCHECKPOINT_HPP */
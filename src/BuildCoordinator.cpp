@@ -0,0 +1,507 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file BuildCoordinator.cpp
+ * @brief This defines the `BuildCoordinator` and `BuildWorker` classes
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <ostream>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+#include "cpl_error.h"
+
+#include "../deps/concat.hpp"
+#include "CTBException.hpp"
+#include "BuildCoordinator.hpp"
+
+using namespace std;
+using namespace ctb;
+
+const int ctb::BuildCoordinator::LEASE_SECONDS;
+const int ctb::BuildCoordinator::WAIT_SECONDS;
+const i_tile ctb::BuildCoordinator::BLOCK_TILES;
+
+#ifndef _WIN32
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+/// Send a line of the coordinator protocol
+static bool
+sendLine(int fd, const string &line) {
+  const string data = line + "\n";
+  size_t sent = 0;
+
+  while (sent < data.size()) {
+    const ssize_t count = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+    if (count <= 0) return false;
+    sent += count;
+  }
+  return true;
+}
+
+/// Receive a line of the coordinator protocol
+static bool
+readLine(int fd, string &line) {
+  char c;
+  line.clear();
+
+  while (line.size() < 65536) {
+    if (recv(fd, &c, 1, 0) != 1) return false;
+    if (c == '\n') return true;
+    line += c;
+  }
+  return false;
+}
+
+/// Stop a connection waiting forever on its peer
+static void
+setSocketTimeout(int fd, int seconds) {
+  struct timeval timeout;
+  timeout.tv_sec = seconds;
+  timeout.tv_usec = 0;
+
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+/// Send a request to the coordinator at `host:port`, returning its reply
+static string
+coordinatorRequest(const string &address, const string &request) {
+  const size_t colon = address.rfind(':');
+  if (colon == string::npos) {
+    throw CTBException("The coordinator address must be given as host:port");
+  }
+  const string host = address.substr(0, colon), port = address.substr(colon + 1);
+
+  struct addrinfo hints, *addresses = NULL;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+    throw CTBException("Could not resolve the coordinator address");
+  }
+
+  int fd = -1;
+  for (struct addrinfo *info = addresses; info != NULL && fd < 0; info = info->ai_next) {
+    fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd >= 0 && connect(fd, info->ai_addr, info->ai_addrlen) != 0) {
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addresses);
+  if (fd < 0) {
+    throw CTBException("Could not connect to the coordinator");
+  }
+
+  string reply;
+  setSocketTimeout(fd, 30);
+  const bool replied = sendLine(fd, request) && readLine(fd, reply);
+  close(fd);
+
+  if (!replied) {
+    throw CTBException("The coordinator did not reply");
+  }
+  return reply;
+}
+#endif
+
+ctb::BuildCoordinator::BuildCoordinator(const GDALTiler &tiler, const std::vector<i_zoom> &zooms):
+  tiler(tiler),
+  zooms(zooms),
+  zoomIndex(0),
+  blockX(0),
+  blockY(0),
+  nextId(0),
+  totalBlocks(0),
+  doneBlocks(0),
+  reissued(0),
+  tilesBuilt(0),
+  workerSeconds(0)
+{
+  for (i_zoom zoom : zooms) {
+    const TileBounds tiles = tiler.tileBoundsForZoom(zoom);
+    totalBlocks += (uint64_t) ((tiles.getWidth() + BLOCK_TILES) / BLOCK_TILES)
+      * ((tiles.getHeight() + BLOCK_TILES) / BLOCK_TILES);
+  }
+}
+
+std::string
+ctb::BuildCoordinator::handle(const std::string &request) {
+  istringstream stream(request);
+  string verb, worker;
+  unsigned int id;
+
+  stream >> verb >> worker;
+  expireLeases();
+
+  if (verb == "LEASE") {
+    return lease(worker);
+  } else if (verb == "HEARTBEAT" && stream >> id) {
+    auto found = outstanding.find(id);
+    if (found == outstanding.end() || !found->second.leased || found->second.worker != worker) {
+      return "LOST";
+    }
+    found->second.expiry = chrono::steady_clock::now() + chrono::seconds(LEASE_SECONDS);
+    return "OK";
+  } else if (verb == "COMPLETE" && stream >> id) {
+    complete(id, worker, stream);
+    return "OK";
+  } else if (verb == "FAILED" && stream >> id) {
+    release(id, worker);
+    return "OK";
+  }
+  return "ERROR unknown request";
+}
+
+void
+ctb::BuildCoordinator::expireLeases() {
+  const chrono::steady_clock::time_point now = chrono::steady_clock::now();
+
+  for (auto &entry : outstanding) {
+    Block &block = entry.second;
+    if (block.leased && block.expiry < now) {
+      CPLError(CE_Warning, CPLE_AppDefined, "The lease of block %u by %s expired, handing it out again",
+               entry.first, block.worker.c_str());
+      block.leased = false;
+      reissue.push_back(entry.first);
+      ++reissued;
+    }
+  }
+}
+
+/**
+ * @details Each request is made on its own connection.  Once all blocks are
+ * built the coordinator carries on serving for a while, so that the workers
+ * waiting for a block are told that the build is done.
+ */
+void
+ctb::BuildCoordinator::serve(unsigned short port, GDALProgressFunc progress) {
+#ifdef _WIN32
+  throw CTBException("The build coordinator is not supported on Windows");
+#else
+  const int listener = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in address;
+  int reuse = 1;
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_ANY);
+  address.sin_port = htons(port);
+  if (listener >= 0) {
+    setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  }
+  if (listener < 0 || ::bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 64) != 0) {
+    if (listener >= 0) close(listener);
+    throw CTBException("Could not listen on the coordinator port");
+  }
+
+  chrono::steady_clock::time_point finishedAt;
+  bool done = false;
+  while (!done || chrono::steady_clock::now() - finishedAt < chrono::seconds(2 * WAIT_SECONDS)) {
+    struct pollfd pending = { listener, POLLIN, 0 };
+
+    if (poll(&pending, 1, 1000) > 0) {
+      const int connection = accept(listener, NULL, NULL);
+      if (connection >= 0) {
+        string request;
+        setSocketTimeout(connection, 5);
+        if (readLine(connection, request)) {
+          sendLine(connection, handle(request));
+        }
+        close(connection);
+        if (progress) {
+          progress(this->progress(), NULL, NULL);
+        }
+      }
+    }
+
+    expireLeases();
+    if (!done && finished()) {
+      done = true;
+      finishedAt = chrono::steady_clock::now();
+    }
+  }
+  close(listener);
+#endif
+}
+
+void
+ctb::BuildCoordinator::report(std::ostream &stream) const {
+  stream << "Built " << tilesBuilt << " tiles in " << doneBlocks << " blocks using " << workerSeconds
+         << " worker seconds; " << reissued << " blocks were handed out again" << endl;
+  for (const auto &worker : workerTiles) {
+    stream << "  " << worker.first << ": " << worker.second << " tiles" << endl;
+  }
+}
+
+/**
+ * @details The blocks of expired or failed leases are handed out before any
+ * new block.
+ */
+std::string
+ctb::BuildCoordinator::lease(const std::string &worker) {
+  unsigned int id;
+  bool found = false;
+
+  while (!reissue.empty() && !found) {
+    id = reissue.front();
+    reissue.pop_front();
+
+    auto block = outstanding.find(id);
+    found = block != outstanding.end() && !block->second.leased;
+  }
+
+  if (!found) {
+    Block block;
+    if (!nextBlock(block)) {
+      return outstanding.empty() ? string("DONE") : concat("WAIT ", WAIT_SECONDS);
+    }
+    id = nextId++;
+    outstanding[id] = block;
+  }
+
+  Block &block = outstanding[id];
+  block.leased = true;
+  block.worker = worker;
+  block.expiry = chrono::steady_clock::now() + chrono::seconds(LEASE_SECONDS);
+
+  return concat("BLOCK ", id, " ", block.zoom, " ", block.tiles.getMinX(), " ", block.tiles.getMinY(), " ",
+                block.tiles.getMaxX(), " ", block.tiles.getMaxY(), " ", LEASE_SECONDS);
+}
+
+void
+ctb::BuildCoordinator::complete(unsigned int id, const std::string &worker, std::istringstream &stream) {
+  auto found = outstanding.find(id);
+  if (found == outstanding.end()) {
+    return;                     // already built by another worker
+  }
+  outstanding.erase(found);
+  ++doneBlocks;
+
+  i_tile tiles = 0;
+  double seconds = 0;
+  stream >> tiles >> seconds;
+  tilesBuilt += tiles;
+  workerSeconds += seconds;
+  workerTiles[worker] += tiles;
+
+  unsigned int zoom;
+  int startX, startY, finalX, finalY;
+  while (stream >> zoom >> startX >> startY >> finalX >> finalY) {
+    const TileCoordinate ll(zoom, startX, startY), ur(zoom, finalX, finalY);
+    metadata.add(tiler.grid(), &ll);
+    metadata.add(tiler.grid(), &ur);
+  }
+}
+
+void
+ctb::BuildCoordinator::release(unsigned int id, const std::string &worker) {
+  auto found = outstanding.find(id);
+  if (found == outstanding.end() || !found->second.leased || found->second.worker != worker) {
+    return;                     // the lease was already lost
+  }
+  CPLError(CE_Warning, CPLE_AppDefined, "Block %u failed to build on %s, handing it out again", id, worker.c_str());
+  found->second.leased = false;
+  reissue.push_back(id);
+  ++reissued;
+}
+
+bool
+ctb::BuildCoordinator::nextBlock(Block &block) {
+  while (zoomIndex < zooms.size()) {
+    const i_zoom zoom = zooms[zoomIndex];
+    const TileBounds tiles = tiler.tileBoundsForZoom(zoom);
+    const i_tile minX = tiles.getMinX() + blockX * BLOCK_TILES,
+      minY = tiles.getMinY() + blockY * BLOCK_TILES;
+
+    if (minY > tiles.getMaxY()) {
+      ++zoomIndex;              // the zoom level is exhausted
+      blockX = blockY = 0;
+      continue;
+    }
+
+    block.zoom = zoom;
+    block.tiles = TileBounds(minX, minY, std::min(minX + BLOCK_TILES - 1, tiles.getMaxX()),
+                             std::min(minY + BLOCK_TILES - 1, tiles.getMaxY()));
+    block.leased = false;
+
+    if (minX + BLOCK_TILES > tiles.getMaxX()) {
+      blockX = 0;
+      ++blockY;
+    } else {
+      ++blockX;
+    }
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @details The worker is named by its host name and process ID, which is
+ * unique among the workers of a build.
+ */
+ctb::BuildWorker::BuildWorker(const std::string &address):
+  mAddress(address),
+  mStopping(false),
+  mLost(false)
+{
+#ifndef _WIN32
+  char hostname[256] = "";
+  gethostname(hostname, sizeof(hostname) - 1);
+  mName = concat(hostname, ":", getpid());
+#endif
+}
+
+ctb::BuildWorker::~BuildWorker() {
+  if (mHeartbeat.joinable()) {
+    endHeartbeat();
+  }
+}
+
+/**
+ * @details The coordinator is retried a few times, so that a worker started
+ * before its coordinator, or one whose coordinator is briefly busy, carries
+ * on.
+ */
+bool
+ctb::BuildWorker::lease(Block &block) {
+  while (true) {
+    istringstream reply(request(mAddress, concat("LEASE ", mName), 5));
+    string verb;
+    reply >> verb;
+
+    if (verb == "DONE") {
+      return false;
+    } else if (verb == "WAIT") {
+      int seconds = BuildCoordinator::WAIT_SECONDS;
+      reply >> seconds;
+      this_thread::sleep_for(chrono::seconds(seconds));
+      continue;
+    } else if (verb != "BLOCK") {
+      throw CTBException("The coordinator sent an unexpected reply");
+    }
+
+    unsigned int zoom;
+    i_tile minX, minY, maxX, maxY;
+    block.leaseSeconds = BuildCoordinator::LEASE_SECONDS;
+    reply >> block.id >> zoom >> minX >> minY >> maxX >> maxY >> block.leaseSeconds;
+    block.zoom = zoom;
+    block.tiles = TileBounds(minX, minY, maxX, maxY);
+    return true;
+  }
+}
+
+/**
+ * @details The lease is renewed three times in each lease period.  A
+ * heartbeat that can't reach the coordinator is reported as a warning and
+ * retried at the next beat, before the lease expires.
+ */
+void
+ctb::BuildWorker::beginHeartbeat(const Block &block, std::function<void()> lost) {
+  mStopping = mLost = false;
+
+  mHeartbeat = thread([this, block, lost]() {
+    const string heartbeat = concat("HEARTBEAT ", mName, " ", block.id);
+    std::unique_lock<std::mutex> lock(mMutex);
+
+    while (!mLost && !mStopped.wait_for(lock, chrono::seconds(std::max(block.leaseSeconds / 3, 1)), [this]() { return mStopping; })) {
+      lock.unlock();
+      bool held = true;
+      try {
+        held = request(mAddress, heartbeat) != "LOST";
+      } catch (CTBException &e) {
+        CPLError(CE_Warning, CPLE_AppDefined, "%s", e.what());
+      }
+      lock.lock();
+      mLost = !held;
+    }
+
+    if (mLost) {
+      lost();
+    }
+  });
+}
+
+bool
+ctb::BuildWorker::endHeartbeat() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStopping = true;
+  }
+  mStopped.notify_all();
+  mHeartbeat.join();
+
+  return !mLost;
+}
+
+/**
+ * @details The extent of the tiles built in each zoom level is sent with the
+ * report, from which the coordinator merges the metadata of the build.
+ */
+void
+ctb::BuildWorker::complete(const Block &block, uint64_t tiles, double seconds, const TerrainMetadata &metadata) {
+  string complete = concat("COMPLETE ", mName, " ", block.id, " ", tiles, " ", seconds);
+  const vector<TerrainMetadata::LevelInfo> &levels = metadata.levels;
+  for (size_t level = 0; level < levels.size(); ++level) {
+    if (levels[level].finalX >= levels[level].startX) {
+      complete += concat(" ", level, " ", levels[level].startX, " ", levels[level].startY,
+                         " ", levels[level].finalX, " ", levels[level].finalY);
+    }
+  }
+  request(mAddress, complete, 5);
+}
+
+/**
+ * @details A block that can't be handed back is handed out again once its
+ * lease expires instead.
+ */
+void
+ctb::BuildWorker::fail(const Block &block) {
+  try {
+    request(mAddress, concat("FAILED ", mName, " ", block.id), 5);
+  } catch (CTBException &e) {
+    CPLError(CE_Warning, CPLE_AppDefined, "%s", e.what());
+  }
+}
+
+std::string
+ctb::BuildWorker::request(const std::string &address, const std::string &request, int attempts) {
+#ifdef _WIN32
+  throw CTBException("The build coordinator is not supported on Windows");
+#else
+  for (int attempt = 1; ; ++attempt) {
+    try {
+      return coordinatorRequest(address, request);
+    } catch (CTBException &) {
+      if (attempt >= attempts) throw;
+      this_thread::sleep_for(chrono::seconds(1 << std::min(attempt, 5)));
+    }
+  }
+#endif
+}
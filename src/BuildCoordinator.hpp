@@ -0,0 +1,218 @@
+#ifndef BUILDCOORDINATOR_HPP
+#define BUILDCOORDINATOR_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file BuildCoordinator.hpp
+ * @brief This declares the `BuildCoordinator` and `BuildWorker` classes
+ */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cpl_progress.h"
+
+#include "config.hpp"
+#include "types.hpp"
+#include "GDALTiler.hpp"
+#include "TerrainMetadata.hpp"
+
+namespace ctb {
+  class BuildCoordinator;
+  class BuildWorker;
+}
+
+/**
+ * @brief Hands out the tiles of a build to workers in blocks
+ *
+ * The coordinator splits each zoom level into blocks of `BLOCK_TILES` x
+ * `BLOCK_TILES` tiles, handing them out in the order of the zoom levels given
+ * to it so that the most expensive levels are started first.  A worker asks
+ * for a block with a line of text over TCP and is given a lease on it, which
+ * it renews with heartbeats whilst building the block.  Leases that expire,
+ * because their worker died or lost touch, are handed out again.  Workers
+ * report the metadata and statistics of each finished block, which are
+ * merged into those of the whole build, and hand back the blocks they failed
+ * to build so that these are handed out again at once.  The requests are:
+ *
+ *     LEASE <worker>                       -> BLOCK <id> <zoom> <minx> <miny> <maxx> <maxy> <lease seconds>
+ *                                             | WAIT <seconds> | DONE
+ *     HEARTBEAT <worker> <id>              -> OK | LOST
+ *     COMPLETE <worker> <id> <tiles> <seconds> [<zoom> <minx> <miny> <maxx> <maxy>]...
+ *                                          -> OK
+ *     FAILED <worker> <id>                 -> OK
+ *
+ * Blocks are generated as they are needed, so builds of many tiles don't
+ * need a block for every tile in memory.  The protocol isn't available on
+ * Windows.
+ */
+class CTB_DLL ctb::BuildCoordinator {
+public:
+
+  /// The seconds a block is leased to a worker before being handed out again
+  static const int LEASE_SECONDS = 60;
+
+  /// The seconds a worker waits before asking again for a block
+  static const int WAIT_SECONDS = 5;
+
+  /// The tiles along each side of a block
+  static const i_tile BLOCK_TILES = 16;
+
+  /// Hand out the tiles of a tiler in the order of the zoom levels given
+  BuildCoordinator(const GDALTiler &tiler, const std::vector<i_zoom> &zooms);
+
+  /// Reply to a request from a worker
+  std::string
+  handle(const std::string &request);
+
+  /// Hand out again the blocks whose lease has expired
+  void
+  expireLeases();
+
+  /// Serve the workers on a port until all blocks have been built
+  void
+  serve(unsigned short port, GDALProgressFunc progress = NULL);
+
+  /// Have all blocks been built?
+  inline bool
+  finished() const {
+    return zoomIndex >= zooms.size() && outstanding.empty();
+  }
+
+  /// Get the fraction of blocks built
+  inline double
+  progress() const {
+    return totalBlocks ? doneBlocks / (double) totalBlocks : 1.0;
+  }
+
+  /// Print the statistics of the build
+  void
+  report(std::ostream &stream) const;
+
+  TerrainMetadata metadata;     ///< The merged metadata of the built blocks
+
+protected:
+  /// A block which has been handed out but not yet built
+  struct Block {
+    i_zoom zoom;
+    TileBounds tiles;
+    bool leased;                ///< Is the block leased, or waiting to be handed out again?
+    std::string worker;         ///< The worker holding the lease
+    std::chrono::steady_clock::time_point expiry;
+  };
+
+  /// Lease a block to a worker
+  std::string
+  lease(const std::string &worker);
+
+  /// Record a block as built, merging its metadata and statistics once
+  void
+  complete(unsigned int id, const std::string &worker, std::istringstream &stream);
+
+  /// Hand out again a block its worker failed to build
+  void
+  release(unsigned int id, const std::string &worker);
+
+  /// Generate the next block, in the order of the zoom levels
+  bool
+  nextBlock(Block &block);
+
+  const GDALTiler &tiler;
+  std::vector<i_zoom> zooms;    ///< The zoom levels in the order they are handed out
+  size_t zoomIndex;             ///< The zoom level of the next block
+  i_tile blockX, blockY;        ///< The position of the next block in its zoom level
+  unsigned int nextId;
+  std::map<unsigned int, Block> outstanding; ///< The blocks handed out but not built
+  std::deque<unsigned int> reissue; ///< The blocks whose lease expired
+  uint64_t totalBlocks, doneBlocks, reissued;
+  uint64_t tilesBuilt;
+  double workerSeconds;
+  std::map<std::string, uint64_t> workerTiles; ///< The tiles built by each worker
+};
+
+/**
+ * @brief Builds the blocks of tiles handed out by a `BuildCoordinator`
+ *
+ * A worker is named after its host and process.  It leases a block, renews
+ * the lease with heartbeats in the background whilst the block is being
+ * built, and then reports the block as complete or hands it back as failed.
+ * A block whose lease was lost is built by the worker it was handed out to
+ * again, so it must not be reported as complete.
+ */
+class CTB_DLL ctb::BuildWorker {
+public:
+
+  /// A block leased from the coordinator
+  struct Block {
+    unsigned int id;
+    i_zoom zoom;
+    TileBounds tiles;
+    int leaseSeconds;
+  };
+
+  /// Work for the coordinator at `host:port`
+  BuildWorker(const std::string &address);
+
+  /// Stop any heartbeat
+  ~BuildWorker();
+
+  /// Lease the next block, waiting whilst there is none, returning `false` once the build is done
+  bool
+  lease(Block &block);
+
+  /// Renew the lease of a block until `endHeartbeat()`, calling `lost` if it is lost
+  void
+  beginHeartbeat(const Block &block, std::function<void()> lost);
+
+  /// Stop renewing the lease of the block, returning whether it was held throughout
+  bool
+  endHeartbeat();
+
+  /// Report a block as built, with the number of tiles, the time taken and their metadata
+  void
+  complete(const Block &block, uint64_t tiles, double seconds, const TerrainMetadata &metadata);
+
+  /// Hand back a block that could not be built
+  void
+  fail(const Block &block);
+
+  /// Send a request to the coordinator at `host:port`, retrying whilst it cannot be reached
+  static std::string
+  request(const std::string &address, const std::string &request, int attempts = 1);
+
+protected:
+  std::string mAddress;         ///< The coordinator address
+  std::string mName;            ///< The name of the worker
+  std::thread mHeartbeat;       ///< The thread renewing the lease
+  std::mutex mMutex;
+  std::condition_variable mStopped;
+  bool mStopping;               ///< Has the heartbeat been ended?
+  bool mLost;                   ///< Was the lease of the block lost?
+};
+
+#endif /* BUILDCOORDINATOR_HPP */
@@ -0,0 +1,238 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file COGPyramid.cpp
+ * @brief This defines the `COGPyramid` class
+ */
+
+#include <climits>
+#include <vector>
+
+#include "cpl_vsi.h"
+
+#include "../deps/concat.hpp"
+#include "CTBException.hpp"
+#include "COGPyramid.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/**
+ * @details The GeoTIFF is tiled at the grid's tile size and sparse, and the
+ * creation options given are used for both the image and its overviews.  The
+ * overviews are created empty, one for each zoom level coarser than the
+ * finest, and are filled by the tiles of their zoom level.
+ */
+ctb::COGPyramid::COGPyramid(const std::string &filename, const GDALTiler &tiler, i_zoom minZoom, i_zoom maxZoom,
+                            const CPLStringList &creationOptions):
+  mDataset(NULL),
+  mFilename(filename),
+  mTempFilename(concat(filename, ".tmp")),
+  mCreationOptions(creationOptions),
+  mMinZoom(minZoom),
+  mMaxZoom(maxZoom),
+  mTileSize(tiler.grid().tileSize()),
+  mBounds(tiler.tileBoundsForZoom(minZoom))
+{
+  GDALDataset *poSource = tiler.dataset();
+  mBandCount = poSource->GetRasterCount();
+  mType = poSource->GetRasterBand(1)->GetRasterDataType();
+
+  // The image covers the tiles of the coarsest zoom level at the finest resolution
+  const TileBounds bounds = tileBounds(maxZoom);
+  const double width = ((double) bounds.getMaxX() - bounds.getMinX() + 1) * mTileSize,
+    height = ((double) bounds.getMaxY() - bounds.getMinY() + 1) * mTileSize;
+  if (width > INT_MAX || height > INT_MAX) {
+    throw CTBException("The pyramid is too large for a single GeoTIFF: use a finer --end-zoom");
+  }
+
+  GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
+  if (poDriver == NULL) {
+    throw CTBException("Could not retrieve GTiff GDAL driver");
+  }
+
+  const string blockSize = concat(mTileSize);
+  CPLStringList options(mCreationOptions);
+  options.SetNameValue("TILED", "YES");
+  options.SetNameValue("BLOCKXSIZE", blockSize.c_str());
+  options.SetNameValue("BLOCKYSIZE", blockSize.c_str());
+  options.SetNameValue("SPARSE_OK", "TRUE");
+  if (options.FetchNameValue("BIGTIFF") == NULL) {
+    options.SetNameValue("BIGTIFF", "IF_SAFER");
+  }
+
+  mDataset = poDriver->Create(mTempFilename.c_str(), (int) width, (int) height, mBandCount, mType, options.List());
+  if (mDataset == NULL) {
+    throw CTBException("Could not create the pyramid GeoTIFF");
+  }
+
+  // Georeference the image from its upper left tile
+  const CRSBounds upperLeft = tiler.grid().tileBounds(TileCoordinate(maxZoom, bounds.getMinX(), bounds.getMaxY()));
+  const double resolution = tiler.grid().resolution(maxZoom);
+  double adfGeoTransform[6] = { upperLeft.getMinX(), resolution, 0, upperLeft.getMaxY(), 0, -resolution };
+  mDataset->SetGeoTransform(adfGeoTransform);
+
+  char *gridWKT = NULL;
+  if (tiler.grid().getSRS().exportToWkt(&gridWKT) == OGRERR_NONE) {
+    mDataset->SetProjection(gridWKT);
+  }
+  CPLFree(gridWKT);
+
+  for (int i = 1; i <= mBandCount; i++) {
+    GDALRasterBand *poSourceBand = poSource->GetRasterBand(i),
+      *poBand = mDataset->GetRasterBand(i);
+    int bGotNoData = FALSE;
+    const double noDataValue = poSourceBand->GetNoDataValue(&bGotNoData);
+
+    if (bGotNoData) poBand->SetNoDataValue(noDataValue);
+    poBand->SetColorInterpretation(poSourceBand->GetColorInterpretation());
+  }
+
+  // Create an empty overview for each coarser zoom level
+  vector<int> factors;
+  for (i_zoom zoom = maxZoom; zoom > minZoom; zoom--) {
+    factors.push_back(1 << (maxZoom - zoom + 1));
+  }
+  if (!factors.empty() &&
+      mDataset->BuildOverviews("NONE", (int) factors.size(), factors.data(), 0, NULL, GDALDummyProgress, NULL) != CE_None) {
+    GDALClose(mDataset);
+    mDataset = NULL;
+    VSIUnlink(mTempFilename.c_str());
+    throw CTBException("Could not create the overviews of the pyramid GeoTIFF");
+  }
+}
+
+ctb::COGPyramid::~COGPyramid() {
+  if (mDataset != NULL) {
+    GDALClose(mDataset);
+    VSIUnlink(mTempFilename.c_str());
+  }
+}
+
+/**
+ * @details This is the finest zoom level at which the dataset spans no more
+ * than 2 x 2 tiles.  Coarser overviews would be no larger than a block, and
+ * the image would have to be padded with more empty blocks to align with
+ * their tiles.
+ */
+i_zoom
+ctb::COGPyramid::coarsestZoom(const GDALTiler &tiler, i_zoom minZoom, i_zoom maxZoom) {
+  for (i_zoom zoom = maxZoom; zoom > minZoom; zoom--) {
+    const TileBounds bounds = tiler.tileBoundsForZoom(zoom);
+    if (bounds.getMaxX() - bounds.getMinX() < 2 && bounds.getMaxY() - bounds.getMinY() < 2) {
+      return zoom;
+    }
+  }
+  return minZoom;
+}
+
+/// Get the tiles of a zoom level covered by the pyramid
+TileBounds
+ctb::COGPyramid::tileBounds(i_zoom zoom) const {
+  const i_zoom shift = zoom - mMinZoom;
+  return TileBounds(mBounds.getMinX() << shift, mBounds.getMinY() << shift,
+                    ((mBounds.getMaxX() + 1) << shift) - 1, ((mBounds.getMaxY() + 1) << shift) - 1);
+}
+
+bool
+ctb::COGPyramid::contains(const TileCoordinate &coord) const {
+  if (coord.zoom < mMinZoom || coord.zoom > mMaxZoom) {
+    return false;
+  }
+
+  const TileBounds bounds = tileBounds(coord.zoom);
+  return coord.x >= bounds.getMinX() && coord.x <= bounds.getMaxX()
+    && coord.y >= bounds.getMinY() && coord.y <= bounds.getMaxY();
+}
+
+/**
+ * @details The pixels are read from the tile before the lock is taken, so
+ * that only the write to the block cache (and the compression of any blocks
+ * it flushes) is serialised.  Tile rows count from the south whereas image
+ * rows count from the north.
+ */
+void
+ctb::COGPyramid::writeTile(const TileCoordinate &coord, GDALDataset *tile) {
+  if (!contains(coord)) {
+    throw CTBException("The tile is outside of the pyramid");
+  }
+
+  const size_t bandSize = (size_t) mTileSize * mTileSize * GDALGetDataTypeSizeBytes(mType);
+  vector<unsigned char> pixels(bandSize * mBandCount);
+  if (tile->RasterIO(GF_Read, 0, 0, mTileSize, mTileSize, (void *) pixels.data(), mTileSize, mTileSize, mType,
+                     mBandCount, NULL, 0, 0, 0) != CE_None) {
+    throw CTBException("Could not read the pixels of the tile");
+  }
+
+  const TileBounds bounds = tileBounds(coord.zoom);
+  const int xOffset = (int) (coord.x - bounds.getMinX()) * mTileSize,
+    yOffset = (int) (bounds.getMaxY() - coord.y) * mTileSize,
+    overview = mMaxZoom - coord.zoom;
+
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mDataset == NULL) {
+    throw CTBException("The pyramid has already been finished");
+  }
+
+  for (int i = 0; i < mBandCount; i++) {
+    GDALRasterBand *poBand = mDataset->GetRasterBand(i + 1);
+    if (overview > 0) poBand = poBand->GetOverview(overview - 1);
+
+    if (poBand == NULL ||
+        poBand->RasterIO(GF_Write, xOffset, yOffset, mTileSize, mTileSize, (void *) &pixels[bandSize * i],
+                         mTileSize, mTileSize, mType, 0, 0) != CE_None) {
+      throw CTBException("Could not write the tile to the pyramid");
+    }
+  }
+}
+
+/**
+ * @details The blocks are written in the order in which the tiles were
+ * built, so the pyramid is copied with its overviews to a GeoTIFF laid out
+ * for reading with range requests.  The copy reads the pyramid sequentially
+ * and none of the tiles are warped again.
+ */
+void
+ctb::COGPyramid::finish() {
+  std::lock_guard<std::mutex> lock(mMutex);
+  if (mDataset == NULL) {
+    return;
+  }
+
+  GDALDriver *poDriver = mDataset->GetDriver();
+  CPLStringList options(mCreationOptions);
+  const string blockSize = concat(mTileSize);
+  options.SetNameValue("TILED", "YES");
+  options.SetNameValue("BLOCKXSIZE", blockSize.c_str());
+  options.SetNameValue("BLOCKYSIZE", blockSize.c_str());
+  options.SetNameValue("SPARSE_OK", "TRUE");
+  options.SetNameValue("COPY_SRC_OVERVIEWS", "YES");
+  if (options.FetchNameValue("BIGTIFF") == NULL) {
+    options.SetNameValue("BIGTIFF", "IF_SAFER");
+  }
+
+  mDataset->FlushCache();
+  GDALDataset *poDstDS = poDriver->CreateCopy(mFilename.c_str(), mDataset, FALSE, options.List(), NULL, NULL);
+  GDALClose(mDataset);
+  mDataset = NULL;
+  VSIUnlink(mTempFilename.c_str());
+
+  if (poDstDS == NULL) {
+    throw CTBException("Could not write the cloud optimised GeoTIFF");
+  }
+  GDALClose(poDstDS);
+}
@@ -0,0 +1,110 @@
+#ifndef COGPYRAMID_HPP
+#define COGPYRAMID_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file COGPyramid.hpp
+ * @brief This declares the `COGPyramid` class
+ */
+
+#include <mutex>
+#include <string>
+
+#include "gdal_priv.h"
+#include "cpl_string.h"
+
+#include "config.hpp"
+#include "types.hpp"
+#include "TileCoordinate.hpp"
+#include "GDALTiler.hpp"
+
+namespace ctb {
+  class COGPyramid;
+}
+
+/**
+ * @brief A tiled pyramid of raster tiles written to a single GeoTIFF
+ *
+ * The finest zoom level of the pyramid is the full resolution image and each
+ * coarser zoom level is one of its internal overviews.  The extent of the
+ * image is that of the tiles of the coarsest zoom level and the internal
+ * tiles of the GeoTIFF are the size of the grid's tiles, so that every tile of
+ * every zoom level fills exactly one block of the image or of an overview.
+ *
+ * The blocks are written by the tiling threads in any order, one thread at a
+ * time, and blocks which are never written (such as those outside of the
+ * dataset) take no space in the file.  Once all of the tiles are written the
+ * GeoTIFF is rewritten with the layout of a cloud optimised GeoTIFF, its
+ * overviews and headers ahead of the full resolution blocks.
+ */
+class CTB_DLL ctb::COGPyramid {
+public:
+
+  /// Create the pyramid of a tiler's dataset between two zoom levels
+  COGPyramid(const std::string &filename, const GDALTiler &tiler, i_zoom minZoom, i_zoom maxZoom,
+             const CPLStringList &creationOptions);
+
+  /// Close the pyramid, removing it if it was not finished
+  ~COGPyramid();
+
+  /// Get the coarsest zoom level worth an overview for a tiler's dataset
+  static i_zoom
+  coarsestZoom(const GDALTiler &tiler, i_zoom minZoom, i_zoom maxZoom);
+
+  /// Does the pyramid hold a tile?
+  bool
+  contains(const TileCoordinate &coord) const;
+
+  /// Write the pixels of a tile dataset to its block, thread-safe
+  void
+  writeTile(const TileCoordinate &coord, GDALDataset *tile);
+
+  /// Lay out the pyramid as a cloud optimised GeoTIFF
+  void
+  finish();
+
+  /// Get the zoom level of the full resolution image
+  inline i_zoom
+  maxZoom() const {
+    return mMaxZoom;
+  }
+
+  /// Get the coarsest zoom level of the pyramid
+  inline i_zoom
+  minZoom() const {
+    return mMinZoom;
+  }
+
+protected:
+  /// Get the tiles of a zoom level covered by the pyramid
+  TileBounds
+  tileBounds(i_zoom zoom) const;
+
+  std::mutex mMutex;
+  GDALDataset *mDataset;        ///< The pyramid being written
+  std::string mFilename;        ///< The cloud optimised GeoTIFF
+  std::string mTempFilename;    ///< The GeoTIFF being written
+  CPLStringList mCreationOptions;
+  i_zoom mMinZoom, mMaxZoom;
+  i_tile mTileSize;
+  TileBounds mBounds;           ///< The tiles of the coarsest zoom level
+  int mBandCount;
+  GDALDataType mType;
+};
+
+#endif /* COGPYRAMID_HPP */
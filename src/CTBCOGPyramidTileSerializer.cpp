@@ -0,0 +1,49 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file CTBCOGPyramidTileSerializer.cpp
+ * @brief This defines the `CTBCOGPyramidTileSerializer` class
+ */
+
+#include "CTBException.hpp"
+#include "CTBCOGPyramidTileSerializer.hpp"
+
+using namespace ctb;
+
+/**
+ * @details
+ * Only the tiles of the zoom levels and extent of the pyramid are serialized
+ */
+bool
+ctb::CTBCOGPyramidTileSerializer::mustSerializeCoordinate(const ctb::TileCoordinate *coordinate) {
+  return mpyramid.contains(*coordinate);
+}
+
+/**
+ * @details
+ * Write the pixels of a GDALTile to its block of the pyramid
+ */
+bool
+ctb::CTBCOGPyramidTileSerializer::serializeTile(const ctb::GDALTile *tile, GDALDriver *, const char *, CPLStringList &) {
+  mpyramid.writeTile(*tile, tile->dataset);
+  return true;
+}
+
+bool
+ctb::CTBCOGPyramidTileSerializer::serializeTile(const ctb::TileCoordinate *, const std::vector<unsigned char> &, GDALDriver *, const char *) {
+  throw CTBException("Encoded tiles cannot be written to a COG pyramid");
+}
@@ -0,0 +1,64 @@
+#ifndef CTBCOGPYRAMIDTILESERIALIZER_HPP
+#define CTBCOGPYRAMIDTILESERIALIZER_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file CTBCOGPyramidTileSerializer.hpp
+ * @brief This declares and defines the `CTBCOGPyramidTileSerializer` class
+ */
+
+#include "COGPyramid.hpp"
+#include "GDALSerializer.hpp"
+
+namespace ctb {
+  class CTBCOGPyramidTileSerializer;
+}
+
+/**
+ * @brief Implements a serializer of `GDALTile`s written to the blocks of a `COGPyramid`
+ *
+ * The pyramid is shared by the tiling threads.  The tiles are written as
+ * pixels, so the driver and creation options given with each tile are those
+ * of the pyramid rather than of the tile.
+ */
+class CTB_DLL ctb::CTBCOGPyramidTileSerializer :
+  public ctb::GDALSerializer {
+public:
+  CTBCOGPyramidTileSerializer(COGPyramid &pyramid):
+    mpyramid(pyramid) {}
+
+  /// Start a new serialization task
+  virtual void startSerialization() override {};
+
+  /// Returns if the specified Tile Coordinate should be serialized
+  virtual bool mustSerializeCoordinate(const ctb::TileCoordinate *coordinate) override;
+
+  /// Serialize a GDALTile to the pyramid
+  virtual bool serializeTile(const ctb::GDALTile *tile, GDALDriver *driver, const char *extension, CPLStringList &creationOptions) override;
+  /// Encoded tiles can't be written to the pyramid
+  virtual bool serializeTile(const ctb::TileCoordinate *coordinate, const std::vector<unsigned char> &bytes, GDALDriver *driver, const char *extension) override;
+
+  /// Serialization finished, releases any resources loaded
+  virtual void endSerialization() override {};
+
+protected:
+  /// The pyramid written to
+  COGPyramid &mpyramid;
+};
+
+#endif /* CTBCOGPYRAMIDTILESERIALIZER_HPP */
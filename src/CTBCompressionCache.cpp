@@ -0,0 +1,140 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file CTBCompressionCache.cpp
+ * @brief This defines the `CTBCompressionCache` class
+ */
+
+#include <string.h>             // memcpy, memcmp
+
+#include "CTBCompressionCache.hpp"
+#include "CTBZOutputStream.hpp"
+
+using namespace ctb;
+
+/// A fast hash of a sequence of bytes, reading them a word at a time
+static uint64_t
+hashBytes(const uint8_t *data, size_t size) {
+  const uint64_t prime = 0x100000001b3ULL; // the FNV-1a prime
+  uint64_t hash = 0xcbf29ce484222325ULL ^ size;
+  size_t i = 0;
+
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    memcpy(&word, data + i, sizeof(uint64_t));
+    hash = (hash ^ word) * prime;
+    hash ^= hash >> 29;         // spread the high bits of the word
+  }
+  for (; i < size; i++) {
+    hash = (hash ^ data[i]) * prime;
+  }
+
+  return hash;
+}
+
+ctb::CTBCompressionCache::CTBCompressionCache(size_t capacity):
+  mCapacity(capacity),
+  mHits(0),
+  mMisses(0)
+{}
+
+/**
+ * @details
+ * The bytes are compressed outside of the lock, so threads compressing
+ * different tiles do not wait on each other.  A blob is only cached when the
+ * capacity of a shard can hold it.
+ */
+CTBCompressionCache::Blob
+ctb::CTBCompressionCache::compress(const uint8_t *data, size_t size) {
+  const uint64_t hash = hashBytes(data, size);
+  Shard &shard = mShards[hash % SHARD_COUNT];
+
+  {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(hash);
+
+    if (found != shard.index.end()) {
+      const Entry &entry = *found->second;
+
+      if (entry.data.size() == size && memcmp(entry.data.data(), data, size) == 0) {
+        shard.entries.splice(shard.entries.begin(), shard.entries, found->second);
+        ++mHits;
+        return entry.blob;
+      }
+    }
+  }
+
+  // Each thread reuses its own compressor
+  static thread_local CTBZOutputStream gzipStream;
+  gzipStream.reset();
+  gzipStream.write(data, (uint32_t) size);
+  gzipStream.finish();
+
+  Blob blob = std::make_shared<const std::vector<uint8_t>>(gzipStream.data(), gzipStream.data() + gzipStream.size());
+  ++mMisses;
+
+  const size_t shardCapacity = mCapacity / SHARD_COUNT,
+    entrySize = size + blob->size();
+
+  if (entrySize <= shardCapacity) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto found = shard.index.find(hash);
+
+    // Replace any colliding or concurrently added entry
+    if (found != shard.index.end()) {
+      shard.size -= found->second->data.size() + found->second->blob->size();
+      shard.entries.erase(found->second);
+      shard.index.erase(found);
+    }
+
+    Entry entry = { hash, std::vector<uint8_t>(data, data + size), blob };
+    shard.entries.push_front(std::move(entry));
+    shard.index[hash] = shard.entries.begin();
+    shard.size += entrySize;
+
+    trim(shard, shardCapacity);
+  }
+
+  return blob;
+}
+
+void
+ctb::CTBCompressionCache::setCapacity(size_t capacity) {
+  mCapacity = capacity;
+
+  for (Shard &shard : mShards) {
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    trim(shard, capacity / SHARD_COUNT);
+  }
+}
+
+void
+ctb::CTBCompressionCache::resetStatistics() {
+  mHits = 0;
+  mMisses = 0;
+}
+
+void
+ctb::CTBCompressionCache::trim(Shard &shard, size_t size) {
+  while (shard.size > size && !shard.entries.empty()) {
+    const Entry &entry = shard.entries.back();
+
+    shard.size -= entry.data.size() + entry.blob->size();
+    shard.index.erase(entry.hash);
+    shard.entries.pop_back();
+  }
+}
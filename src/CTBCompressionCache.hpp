@@ -0,0 +1,118 @@
+#ifndef CTBCOMPRESSIONCACHE_HPP
+#define CTBCOMPRESSIONCACHE_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file CTBCompressionCache.hpp
+ * @brief This declares the `CTBCompressionCache` class
+ */
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "config.hpp"
+#include "types.hpp"
+
+namespace ctb {
+  class CTBCompressionCache;
+}
+
+/**
+ * @brief A bounded cache of gzipped tiles keyed by their uncompressed content
+ *
+ * Many tiles are identical before compression, such as tiles of constant
+ * height or of nodata.  The cache maps a hash of the uncompressed bytes of a
+ * tile to its gzipped bytes so repeated tiles skip the compressor.  Entries
+ * keep the uncompressed bytes to rule out hash collisions and the least
+ * recently used entries are discarded once the cache exceeds its capacity.
+ *
+ * The cache is split into shards with their own lock so that it can be
+ * shared by tiling threads.
+ */
+class CTB_DLL ctb::CTBCompressionCache {
+public:
+
+  /// A gzipped blob
+  typedef std::shared_ptr<const std::vector<uint8_t>> Blob;
+
+  /// Create a cache holding up to `capacity` bytes
+  CTBCompressionCache(size_t capacity = 0);
+
+  /// Get the gzipped form of some bytes, compressing them if they are not cached
+  Blob
+  compress(const uint8_t *data, size_t size);
+
+  /// Set the capacity in bytes, discarding entries to fit it
+  void
+  setCapacity(size_t capacity);
+
+  /// Get the capacity in bytes
+  inline size_t
+  capacity() const {
+    return mCapacity;
+  }
+
+  /// Get the number of blobs found in the cache
+  inline uint64_t
+  hits() const {
+    return mHits;
+  }
+
+  /// Get the number of blobs compressed
+  inline uint64_t
+  misses() const {
+    return mMisses;
+  }
+
+  /// Reset the hit and miss counts
+  void
+  resetStatistics();
+
+protected:
+
+  /// An uncompressed tile and its gzipped bytes
+  struct Entry {
+    uint64_t hash;
+    std::vector<uint8_t> data;
+    Blob blob;
+  };
+
+  /// A part of the cache with its own lock
+  struct Shard {
+    std::mutex mutex;
+    std::list<Entry> entries;   ///< The most recently used entry first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> index;
+    size_t size = 0;            ///< The bytes held by the entries
+  };
+
+  /// Discard the least recently used entries of a shard exceeding a size
+  static void
+  trim(Shard &shard, size_t size);
+
+  static const unsigned int SHARD_COUNT = 16;
+
+  Shard mShards[SHARD_COUNT];
+  std::atomic<size_t> mCapacity;
+  std::atomic<uint64_t> mHits, mMisses;
+};
+
+#endif /* CTBCOMPRESSIONCACHE_HPP */
@@ -41,3 +41,14 @@ ctb::CTBStdOutputStream::write(const void *ptr, uint32_t size) {
   mstream.write((const char *)ptr, size);
   return size;
 }
+
+/**
+ * @details 
+ * Appends a sequence of memory pointed by ptr to the buffer.
+ */
+uint32_t
+ctb::CTBMemoryOutputStream::write(const void *ptr, uint32_t size) {
+  const uint8_t *bytes = (const uint8_t *)ptr;
+  buffer.insert(buffer.end(), bytes, bytes + size);
+  return size;
+}
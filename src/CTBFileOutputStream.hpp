@@ -19,16 +19,18 @@
 
 /**
  * @file CTBFileOutputStream.hpp
- * @brief This declares and defines the `CTBFileOutputStream` and `CTBStdOutputStream` classes
+ * @brief This declares and defines the `CTBFileOutputStream`, `CTBStdOutputStream` and `CTBMemoryOutputStream` classes
  */
 
 #include <stdio.h>
 #include <ostream>
+#include <vector>
 #include "CTBOutputStream.hpp"
 
 namespace ctb {
   class CTBFileOutputStream;
   class CTBStdOutputStream;
+  class CTBMemoryOutputStream;
 }
 
 /// Implements CTBOutputStream for `FILE*` objects
@@ -57,4 +59,19 @@ protected:
   std::ostream &mstream;
 };
 
+/// Implements CTBOutputStream for a buffer in memory
+class CTB_DLL ctb::CTBMemoryOutputStream : public ctb::CTBOutputStream {
+public:
+
+  /// Writes a sequence of memory pointed by ptr into the buffer
+  virtual uint32_t write(const void *ptr, uint32_t size);
+
+  const uint8_t *data() const { return buffer.data(); };
+  size_t size() const { return buffer.size(); };
+
+protected:
+  /// The bytes written
+  std::vector<uint8_t> buffer;
+};
+
 #endif /* CTBFILEOUTPUTSTREAM_HPP */
@@ -22,12 +22,14 @@
 #include <stdio.h>
 #include <string.h>
 #include <mutex>
+#include <vector>
 
 #include "../deps/concat.hpp"
 #include "cpl_vsi.h"
 #include "CTBException.hpp"
 #include "CTBFileTileSerializer.hpp"
 
+#include "CTBCompressionCache.hpp"
 #include "CTBFileOutputStream.hpp"
 #include "CTBZOutputStream.hpp"
 
@@ -90,6 +92,26 @@ fileExists(const std::string& filename) {
   return VSIStatExL(filename.c_str(), &statbuf, VSI_STAT_EXISTS_FLAG) == 0;
 }
 
+/// Write bytes to a file with a single write
+static void
+writeFile(const std::string &filename, const void *data, size_t size) {
+  VSILFILE *fp = VSIFOpenL(filename.c_str(), "wb");
+  if (fp == NULL) {
+    throw CTBException("Failed to open file");
+  }
+
+  const bool written = VSIFWriteL(data, 1, size, fp) == size;
+  if (VSIFCloseL(fp) != 0 || !written) {
+    throw CTBException("Failed to write file");
+  }
+}
+
+/// Write the bytes of a tile to a file, gzipped through a compression cache
+static void
+writeCachedFile(const std::string &filename, const CTBMemoryOutputStream &ostream, CTBCompressionCache &cache) {
+  CTBCompressionCache::Blob blob = cache.compress(ostream.data(), ostream.size());
+  writeFile(filename, blob->data(), blob->size());
+}
 
 /**
  * @details 
@@ -105,11 +127,19 @@ bool ctb::CTBFileTileSerializer::mustSerializeCoordinate(const ctb::TileCoordina
 
 /**
  * @details 
- * Serialize a GDALTile to the Directory store
+ * Serialize a GDALTile to the Directory store.  The tile is encoded in memory
+ * and written with a single write (see `GDALTile::encode`), unless its format
+ * writes several files, which are created by the driver on disk.
  */
 bool 
 ctb::CTBFileTileSerializer::serializeTile(const ctb::GDALTile *tile, GDALDriver *driver, const char *extension, CPLStringList &creationOptions) {
   const TileCoordinate *coordinate = tile;
+
+  vector<unsigned char> bytes;
+  if (tile->encode(driver, extension, creationOptions, bytes)) {
+    return serializeTile(coordinate, bytes, driver, extension);
+  }
+
   const string filename = getTileFilename(coordinate, moutputDir, extension);
   const string temp_filename = concat(filename, ".tmp");
 
@@ -123,7 +153,25 @@ ctb::CTBFileTileSerializer::serializeTile(const ctb::GDALTile *tile, GDALDriver
   GDALClose(poDstDS);
 
   if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
-    throw new CTBException("Could not rename temporary file");
+    throw CTBException("Could not rename temporary file");
+  }
+  return true;
+}
+
+/**
+ * @details 
+ * Serialize the bytes of a GDAL tile, which may be shared with other tiles of
+ * the same content, to the Directory store
+ */
+bool
+ctb::CTBFileTileSerializer::serializeTile(const ctb::TileCoordinate *coordinate, const std::vector<unsigned char> &bytes, GDALDriver *, const char *extension) {
+  const string filename = getTileFilename(coordinate, moutputDir, extension);
+  const string temp_filename = concat(filename, ".tmp");
+
+  writeFile(temp_filename, bytes.data(), bytes.size());
+
+  if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
+    throw CTBException("Could not rename temporary file");
   }
   return true;
 }
@@ -138,12 +186,18 @@ ctb::CTBFileTileSerializer::serializeTile(const ctb::TerrainTile *tile) {
   const string filename = getTileFilename(tile, moutputDir, "terrain");
   const string temp_filename = concat(filename, ".tmp");
 
-  CTBZFileOutputStream ostream(temp_filename.c_str());
-  tile->writeFile(ostream);
-  ostream.close();
+  if (mcompressionCache) {
+    CTBMemoryOutputStream ostream;
+    tile->writeFile(ostream);
+    writeCachedFile(temp_filename, ostream, *mcompressionCache);
+  } else {
+    CTBZFileOutputStream ostream(temp_filename.c_str());
+    tile->writeFile(ostream);
+    ostream.close();
+  }
 
   if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
-    throw new CTBException("Could not rename temporary file");
+    throw CTBException("Could not rename temporary file");
   }
   return true;
 }
@@ -158,12 +212,18 @@ ctb::CTBFileTileSerializer::serializeTile(const ctb::MeshTile *tile, bool writeV
   const string filename = getTileFilename(coordinate, moutputDir, "terrain");
   const string temp_filename = concat(filename, ".tmp");
 
-  CTBZFileOutputStream ostream(temp_filename.c_str());
-  tile->writeFile(ostream, writeVertexNormals);
-  ostream.close();
+  if (mcompressionCache) {
+    CTBMemoryOutputStream ostream;
+    tile->writeFile(ostream, writeVertexNormals);
+    writeCachedFile(temp_filename, ostream, *mcompressionCache);
+  } else {
+    CTBZFileOutputStream ostream(temp_filename.c_str());
+    tile->writeFile(ostream, writeVertexNormals);
+    ostream.close();
+  }
 
   if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
-    throw new CTBException("Could not rename temporary file");
+    throw CTBException("Could not rename temporary file");
   }
   return true;
 }
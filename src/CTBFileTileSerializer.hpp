@@ -31,6 +31,7 @@
 
 namespace ctb {
   class CTBFileTileSerializer;
+  class CTBCompressionCache;    // forward declaration
 }
 
 /// Implements a serializer of `Tile`s based in a directory of files
@@ -41,7 +42,15 @@ class CTB_DLL ctb::CTBFileTileSerializer :
 public:
   CTBFileTileSerializer(const std::string &outputDir, bool resume):
     moutputDir(outputDir), 
-    mresume(resume) {}
+    mresume(resume),
+    mcompressionCache(NULL) {}
+
+  virtual ~CTBFileTileSerializer() {}
+
+  /// Reuse the compressed bytes of identical tiles from a cache
+  void setCompressionCache(CTBCompressionCache *cache) {
+    mcompressionCache = cache;
+  }
 
   /// Start a new serialization task
   virtual void startSerialization() {};
@@ -51,6 +60,8 @@ public:
 
   /// Serialize a GDALTile to the store
   virtual bool serializeTile(const ctb::GDALTile *tile, GDALDriver *driver, const char *extension, CPLStringList &creationOptions);
+  /// Serialize the bytes of an encoded GDAL tile to the store
+  virtual bool serializeTile(const ctb::TileCoordinate *coordinate, const std::vector<unsigned char> &bytes, GDALDriver *driver, const char *extension);
   /// Serialize a TerrainTile to the store
   virtual bool serializeTile(const ctb::TerrainTile *tile);
   /// Serialize a MeshTile to the store
@@ -69,6 +80,8 @@ protected:
   std::string moutputDir;
   /// Do not overwrite existing files
   bool mresume;
+  /// The cache of compressed tiles, if any
+  CTBCompressionCache *mcompressionCache;
 };
 
 #endif /* CTBFILETILESERIALIZER_HPP */
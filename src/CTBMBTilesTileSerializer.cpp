@@ -5,6 +5,8 @@
 #include <assert.h>
 
 #include "CTBException.hpp"
+#include "CTBCompressionCache.hpp"
+#include "CTBFileOutputStream.hpp"
 #include "CTBMBTilesTileSerializer.hpp"
 #include "CTBZOutputStream.hpp"
 
@@ -29,6 +31,15 @@ bool
 ctb::CTBMBTilesTileSerializer::serializeTile(const ctb::MeshTile *tile, bool writeVertexNormals) {
   assert(mbtiler);
 
+  if (compressionCache) {
+    CTBMemoryOutputStream ostream;
+    tile->writeFile(ostream, writeVertexNormals);
+    CTBCompressionCache::Blob blob = compressionCache->compress(ostream.data(), ostream.size());
+
+    mbtiler->insertBlob(blob->data(), blob->size(), tile->zoom, tile->x, tile->y);
+    return true;
+  }
+
   // geneare the tile gzipped content
   gzipStream.reset();
   tile->writeFile(gzipStream, writeVertexNormals);
@@ -14,6 +14,7 @@
 
 namespace ctb {
   class CTBMBTilesTileSerializer;
+  class CTBCompressionCache;    // forward declaration
 }
 
 /// Implements a serializer of `Tile`s based in a directory of files
@@ -22,7 +23,13 @@ class CTB_DLL ctb::CTBMBTilesTileSerializer:
 public:
   CTBMBTilesTileSerializer(MBTiler *mbtiler, bool resume):
     mbtiler(mbtiler),
-    resume(resume) {}
+    resume(resume),
+    compressionCache(NULL) {}
+
+  /// Reuse the compressed bytes of identical tiles from a cache
+  void setCompressionCache(CTBCompressionCache *cache) {
+    compressionCache = cache;
+  }
 
   /// Start a new serialization task
   virtual void startSerialization() {};
@@ -43,4 +50,6 @@ protected:
   bool resume;
   // gzip compressor
   CTBZOutputStream gzipStream;
+  /// The cache of compressed tiles, if any
+  CTBCompressionCache *compressionCache;
 };
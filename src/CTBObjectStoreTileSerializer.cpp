@@ -0,0 +1,139 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file CTBObjectStoreTileSerializer.cpp
+ * @brief This defines the `CTBObjectStoreTileSerializer` class
+ */
+
+#include "../deps/concat.hpp"
+#include "cpl_conv.h"
+#include "cpl_vsi.h"
+#include "CTBException.hpp"
+#include "CTBObjectStoreTileSerializer.hpp"
+
+#include "CTBCompressionCache.hpp"
+#include "CTBFileOutputStream.hpp"
+#include "CTBObjectStoreUploader.hpp"
+#include "CTBZOutputStream.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// The media type of heightmap terrain tiles
+static const char *HEIGHTMAP_TYPE = "application/octet-stream";
+
+/// The media type of quantized mesh terrain tiles
+static const char *MESH_TYPE = "application/vnd.quantized-mesh";
+
+/// Create an object path for a tile coordinate
+std::string
+ctb::CTBObjectStoreTileSerializer::getTilePath(const TileCoordinate *coord, const std::string &prefix, const char *extension) {
+  string path = concat(prefix, coord->zoom, "/", coord->x, "/", coord->y);
+  if (extension != NULL) {
+    path += ".";
+    path += extension;
+  }
+  return path;
+}
+
+/// Gzip the bytes of a tile, through a compression cache if there is one
+static CTBObjectStoreUploader::Blob
+gzipTile(const CTBMemoryOutputStream &ostream, CTBCompressionCache *cache) {
+  if (cache) {
+    return cache->compress(ostream.data(), ostream.size());
+  }
+
+  CTBZOutputStream gzipStream;
+  gzipStream.write(ostream.data(), (uint32_t) ostream.size());
+  gzipStream.finish();
+  return std::make_shared<const std::vector<uint8_t>>(gzipStream.data(), gzipStream.data() + gzipStream.size());
+}
+
+/**
+ * @details
+ * Returns if the specified Tile Coordinate should be serialized
+ */
+bool
+ctb::CTBObjectStoreTileSerializer::mustSerializeCoordinate(const ctb::TileCoordinate *coordinate) {
+  if (!mresume)
+    return true;
+
+  const string path = getTilePath(coordinate, moutputDir, "terrain");
+  VSIStatBufL statbuf;
+  return VSIStatExL(path.c_str(), &statbuf, VSI_STAT_EXISTS_FLAG) != 0;
+}
+
+/**
+ * @details
+ * The tile is encoded in memory (see `GDALTile::encode`) and its bytes are
+ * uploaded, using the media type declared by the driver.
+ */
+bool
+ctb::CTBObjectStoreTileSerializer::serializeTile(const ctb::GDALTile *tile, GDALDriver *driver, const char *extension, CPLStringList &creationOptions) {
+  const TileCoordinate *coordinate = tile;
+  const string path = getTilePath(coordinate, moutputDir, extension);
+
+  auto bytes = std::make_shared<std::vector<uint8_t>>();
+  if (!tile->encode(driver, extension, creationOptions, *bytes)) {
+    throw CTBException("Formats writing several files per tile cannot be uploaded");
+  }
+
+  const char *contentType = driver->GetMetadataItem(GDAL_DMD_MIMETYPE);
+  muploader.upload(path, bytes, contentType ? contentType : HEIGHTMAP_TYPE);
+  return true;
+}
+
+/**
+ * @details
+ * The bytes are copied, as they may be shared with other tiles of the same
+ * content whilst the upload is queued.
+ */
+bool
+ctb::CTBObjectStoreTileSerializer::serializeTile(const ctb::TileCoordinate *coordinate, const std::vector<unsigned char> &bytes, GDALDriver *driver, const char *extension) {
+  const string path = getTilePath(coordinate, moutputDir, extension);
+  const char *contentType = driver->GetMetadataItem(GDAL_DMD_MIMETYPE);
+  muploader.upload(path, std::make_shared<const std::vector<uint8_t>>(bytes), contentType ? contentType : HEIGHTMAP_TYPE);
+  return true;
+}
+
+/**
+ * @details
+ * Serialize a TerrainTile to the object store
+ */
+bool
+ctb::CTBObjectStoreTileSerializer::serializeTile(const ctb::TerrainTile *tile) {
+  const string path = getTilePath(tile, moutputDir, "terrain");
+
+  CTBMemoryOutputStream ostream;
+  tile->writeFile(ostream);
+  muploader.upload(path, gzipTile(ostream, mcompressionCache), HEIGHTMAP_TYPE, "gzip");
+  return true;
+}
+
+/**
+ * @details
+ * Serialize a MeshTile to the object store
+ */
+bool
+ctb::CTBObjectStoreTileSerializer::serializeTile(const ctb::MeshTile *tile, bool writeVertexNormals) {
+  const string path = getTilePath(tile, moutputDir, "terrain");
+
+  CTBMemoryOutputStream ostream;
+  tile->writeFile(ostream, writeVertexNormals);
+  muploader.upload(path, gzipTile(ostream, mcompressionCache), MESH_TYPE, "gzip");
+  return true;
+}
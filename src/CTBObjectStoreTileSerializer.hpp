@@ -0,0 +1,70 @@
+#ifndef CTBOBJECTSTORETILESERIALIZER_HPP
+#define CTBOBJECTSTORETILESERIALIZER_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file CTBObjectStoreTileSerializer.hpp
+ * @brief This declares and defines the `CTBObjectStoreTileSerializer` class
+ */
+
+#include <string>
+
+#include "CTBFileTileSerializer.hpp"
+
+namespace ctb {
+  class CTBObjectStoreTileSerializer;
+  class CTBObjectStoreUploader; // forward declaration
+}
+
+/**
+ * @brief Implements a serializer of `Tile`s uploaded to an object store
+ *
+ * The tiles are named as by `CTBFileTileSerializer` below an object store
+ * prefix such as `/vsis3/bucket/tiles/`.  They are encoded in memory and
+ * handed to a `CTBObjectStoreUploader` shared by the tiling threads, so no
+ * local copy of the tileset is written.
+ */
+class CTB_DLL ctb::CTBObjectStoreTileSerializer :
+  public ctb::CTBFileTileSerializer {
+public:
+  CTBObjectStoreTileSerializer(const std::string &outputDir, bool resume, CTBObjectStoreUploader &uploader):
+    CTBFileTileSerializer(outputDir, resume),
+    muploader(uploader) {}
+
+  /// Returns if the specified Tile Coordinate should be serialized
+  virtual bool mustSerializeCoordinate(const ctb::TileCoordinate *coordinate) override;
+
+  /// Serialize a GDALTile to the store
+  virtual bool serializeTile(const ctb::GDALTile *tile, GDALDriver *driver, const char *extension, CPLStringList &creationOptions) override;
+  /// Serialize the bytes of an encoded GDAL tile to the store
+  virtual bool serializeTile(const ctb::TileCoordinate *coordinate, const std::vector<unsigned char> &bytes, GDALDriver *driver, const char *extension) override;
+  /// Serialize a TerrainTile to the store
+  virtual bool serializeTile(const ctb::TerrainTile *tile) override;
+  /// Serialize a MeshTile to the store
+  virtual bool serializeTile(const ctb::MeshTile *tile, bool writeVertexNormals = false) override;
+
+  /// Create an object path for a tile coordinate
+  static std::string
+  getTilePath(const TileCoordinate *coord, const std::string &prefix, const char *extension);
+
+protected:
+  /// The uploader of the objects
+  CTBObjectStoreUploader &muploader;
+};
+
+#endif /* CTBOBJECTSTORETILESERIALIZER_HPP */
@@ -0,0 +1,272 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file CTBObjectStoreUploader.cpp
+ * @brief This defines the `CTBObjectStoreUploader` class
+ */
+
+#include <string.h>             // for strlen
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+#include "gdal.h"                // for GDAL_VERSION_NUM
+#include "cpl_conv.h"
+#include "cpl_error.h"
+#include "cpl_string.h"
+#include "cpl_vsi.h"
+
+#include "../deps/concat.hpp"
+#include "CTBException.hpp"
+#include "CTBObjectStoreUploader.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// The delay before the first retry of a request, in milliseconds
+static const unsigned int BACKOFF_MS = 250;
+
+/// The longest delay between retries, in milliseconds
+static const unsigned int BACKOFF_LIMIT_MS = 16000;
+
+/// Open an object for writing with its HTTP headers
+static VSILFILE *
+openObject(const string &path, const char *contentType, const char *contentEncoding) {
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,3,0)
+  CPLStringList options;
+  if (contentType) options.SetNameValue("Content-Type", contentType);
+  if (contentEncoding) options.SetNameValue("Content-Encoding", contentEncoding);
+
+  return VSIFOpenEx2L(path.c_str(), "wb", FALSE, options.List());
+#else
+  // Older versions of GDAL send the default headers of the endpoint
+  (void) contentType;
+  (void) contentEncoding;
+  return VSIFOpenL(path.c_str(), "wb");
+#endif
+}
+
+ctb::CTBObjectStoreUploader::CTBObjectStoreUploader(unsigned int connections, unsigned int maxRetries):
+  mQueueLimit(std::max(connections, 1u) * 4),
+  mActive(0),
+  mStopping(false),
+  mMaxRetries(maxRetries),
+  mUploaded(0),
+  mBytes(0),
+  mRetries(0)
+{
+  for (unsigned int i = 0; i < std::max(connections, 1u); i++) {
+    mThreads.push_back(thread(&CTBObjectStoreUploader::run, this));
+  }
+}
+
+ctb::CTBObjectStoreUploader::~CTBObjectStoreUploader() {
+  stop();
+}
+
+/**
+ * @details The `/vsis3/`, `/vsigs/`, `/vsiaz/` and `/vsioss/` file systems of
+ * GDAL write objects with a single request, or a multipart upload for large
+ * objects.
+ */
+bool
+ctb::CTBObjectStoreUploader::isObjectStorePath(const std::string &path) {
+  static const char *prefixes[] = {"/vsis3/", "/vsigs/", "/vsiaz/", "/vsioss/"};
+
+  for (const char *prefix : prefixes) {
+    if (path.compare(0, strlen(prefix), prefix) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void
+ctb::CTBObjectStoreUploader::upload(const std::string &path, Blob blob, const char *contentType, const char *contentEncoding) {
+  unique_lock<mutex> lock(mMutex);
+
+  mChanged.wait(lock, [this]() {
+    return mQueue.size() < mQueueLimit || !mError.empty();
+  });
+  if (!mError.empty()) {
+    throw CTBException(mError.c_str());
+  } else if (mStopping) {
+    throw CTBException("The uploads have already finished");
+  }
+
+  Upload upload = {path, blob, contentType, contentEncoding};
+  mQueue.push_back(upload);
+  mChanged.notify_all();
+}
+
+/**
+ * @details The file is streamed to the object store by GDAL, which sends it in
+ * parts of `VSIS3_CHUNK_SIZE` megabytes (50 by default) when it is larger than
+ * one part.  A failure restarts the whole upload.
+ */
+void
+ctb::CTBObjectStoreUploader::uploadFile(const std::string &filename, const std::string &path, const char *contentType) {
+  vector<uint8_t> buffer(1024 * 1024);
+
+  for (unsigned int attempt = 0; ; attempt++) {
+    VSILFILE *in = VSIFOpenL(filename.c_str(), "rb");
+    if (in == NULL) {
+      throw CTBException("Could not open the file to upload");
+    }
+
+    CPLErrorReset();
+    VSILFILE *out = openObject(path, contentType, NULL);
+    bool written = out != NULL;
+    uint64_t size = 0;
+
+    while (written) {
+      const size_t read = VSIFReadL(buffer.data(), 1, buffer.size(), in);
+      if (read == 0) break;
+      written = VSIFWriteL(buffer.data(), 1, read, out) == read;
+      size += read;
+    }
+    if (out != NULL && VSIFCloseL(out) != 0) {
+      written = false;
+    }
+    VSIFCloseL(in);
+
+    if (written) {
+      mUploaded++;
+      mBytes += size;
+      return;
+    }
+    if (attempt >= mMaxRetries) {
+      throw CTBException(concat("Could not upload ", path, ": ", CPLGetLastErrorMsg()).c_str());
+    }
+    mRetries++;
+    backoff(attempt);
+  }
+}
+
+/**
+ * @details Objects can be read back once this returns, such as by checking
+ * that a tile exists, whilst the uploading threads carry on for later
+ * uploads.
+ */
+void
+ctb::CTBObjectStoreUploader::flush() {
+  unique_lock<mutex> lock(mMutex);
+
+  mChanged.wait(lock, [this]() {
+    return (mQueue.empty() && mActive == 0) || !mError.empty();
+  });
+  if (!mError.empty()) {
+    throw CTBException(mError.c_str());
+  }
+}
+
+void
+ctb::CTBObjectStoreUploader::finish() {
+  stop();
+
+  lock_guard<mutex> lock(mMutex);
+  if (!mError.empty()) {
+    throw CTBException(mError.c_str());
+  }
+}
+
+void
+ctb::CTBObjectStoreUploader::run() {
+  unique_lock<mutex> lock(mMutex);
+
+  while (true) {
+    mChanged.wait(lock, [this]() {
+      return !mQueue.empty() || mStopping;
+    });
+    if (mQueue.empty()) {
+      return;                   // stopping
+    }
+
+    Upload upload = mQueue.front();
+    mQueue.pop_front();
+    mActive++;
+    mChanged.notify_all();      // there is room in the queue
+
+    // Discard the rest of the queue once an upload has failed
+    const bool failed = !mError.empty();
+    lock.unlock();
+    const bool written = failed || put(upload);
+    lock.lock();
+    mActive--;
+
+    if (!written && mError.empty()) {
+      mError = concat("Could not upload ", upload.path, ": ", CPLGetLastErrorMsg());
+    }
+    mChanged.notify_all();
+  }
+}
+
+bool
+ctb::CTBObjectStoreUploader::put(const Upload &upload) {
+  const vector<uint8_t> &data = *upload.blob;
+
+  for (unsigned int attempt = 0; ; attempt++) {
+    CPLErrorReset();
+    VSILFILE *fp = openObject(upload.path, upload.contentType, upload.contentEncoding);
+    bool written = fp != NULL && VSIFWriteL(data.data(), 1, data.size(), fp) == data.size();
+
+    // The object is sent when the file is closed
+    if (fp != NULL && VSIFCloseL(fp) != 0) {
+      written = false;
+    }
+
+    if (written) {
+      mUploaded++;
+      mBytes += data.size();
+      return true;
+    }
+    if (attempt >= mMaxRetries) {
+      return false;
+    }
+    mRetries++;
+    backoff(attempt);
+  }
+}
+
+/**
+ * @details The delay doubles with each attempt up to a limit and is jittered
+ * so that threads failing together do not retry together.
+ */
+void
+ctb::CTBObjectStoreUploader::backoff(unsigned int attempt) {
+  static thread_local mt19937 random((unsigned int) hash<thread::id>()(this_thread::get_id()));
+  const unsigned int limit = std::min(BACKOFF_MS << std::min(attempt, 16u), BACKOFF_LIMIT_MS);
+  uniform_int_distribution<unsigned int> jitter(limit / 2, limit);
+
+  this_thread::sleep_for(chrono::milliseconds(jitter(random)));
+}
+
+void
+ctb::CTBObjectStoreUploader::stop() {
+  {
+    lock_guard<mutex> lock(mMutex);
+    mStopping = true;
+  }
+  mChanged.notify_all();
+
+  for (thread &uploader : mThreads) {
+    if (uploader.joinable()) {
+      uploader.join();
+    }
+  }
+  mThreads.clear();
+}
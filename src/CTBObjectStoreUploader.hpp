@@ -0,0 +1,144 @@
+#ifndef CTBOBJECTSTOREUPLOADER_HPP
+#define CTBOBJECTSTOREUPLOADER_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file CTBObjectStoreUploader.hpp
+ * @brief This declares the `CTBObjectStoreUploader` class
+ */
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+#include "types.hpp"
+
+namespace ctb {
+  class CTBObjectStoreUploader;
+}
+
+/**
+ * @brief Uploads blobs to an object store through a bounded pool of threads
+ *
+ * Objects are named by GDAL virtual file system paths such as
+ * `/vsis3/bucket/tiles/0/0/0.terrain`, so any S3 compatible endpoint
+ * configured for GDAL (`AWS_S3_ENDPOINT`, `AWS_HTTPS`, `AWS_VIRTUAL_HOSTING`
+ * and the credentials) can be used, including a local MinIO server.
+ *
+ * Tiling threads queue their encoded tiles with `upload()` and carry on,
+ * blocking only once the queue is full.  The uploading threads live for the
+ * whole build so that their HTTP connections are kept alive between
+ * requests.  A failed request is retried with an exponential backoff before
+ * the upload, and the build, is failed.
+ */
+class CTB_DLL ctb::CTBObjectStoreUploader {
+public:
+
+  /// The bytes of an object
+  typedef std::shared_ptr<const std::vector<uint8_t>> Blob;
+
+  /// Start `connections` uploading threads, retrying a request up to `maxRetries` times
+  CTBObjectStoreUploader(unsigned int connections = 8, unsigned int maxRetries = 5);
+
+  /// Wait for the queued uploads, ignoring any failure
+  ~CTBObjectStoreUploader();
+
+  /// Queue an object for upload, waiting whilst the queue is full
+  void
+  upload(const std::string &path, Blob blob, const char *contentType, const char *contentEncoding = NULL);
+
+  /// Upload a local file, as a multipart upload if it is larger than a part
+  void
+  uploadFile(const std::string &filename, const std::string &path, const char *contentType);
+
+  /// Wait until the queued uploads are written, throwing if any of them failed
+  void
+  flush();
+
+  /// Wait for the queued uploads, throwing if any of them failed
+  void
+  finish();
+
+  /// Get the number of objects uploaded
+  inline uint64_t
+  uploaded() const {
+    return mUploaded;
+  }
+
+  /// Get the number of bytes uploaded
+  inline uint64_t
+  bytes() const {
+    return mBytes;
+  }
+
+  /// Get the number of requests that were retried
+  inline uint64_t
+  retries() const {
+    return mRetries;
+  }
+
+  /// Is a path in an object store rather than a file system?
+  static bool
+  isObjectStorePath(const std::string &path);
+
+protected:
+
+  /// An object waiting to be uploaded
+  struct Upload {
+    std::string path;
+    Blob blob;
+    const char *contentType;
+    const char *contentEncoding;
+  };
+
+  /// Take uploads from the queue until it is closed
+  void
+  run();
+
+  /// Write an object, retrying failed requests
+  bool
+  put(const Upload &upload);
+
+  /// Wait before retrying a request
+  void
+  backoff(unsigned int attempt);
+
+  /// Stop the threads once the queue is empty
+  void
+  stop();
+
+  std::mutex mMutex;
+  std::condition_variable mChanged; ///< Signals queued and taken uploads
+  std::deque<Upload> mQueue;
+  size_t mQueueLimit;           ///< The most uploads queued at once
+  size_t mActive;               ///< The uploads taken from the queue but not yet written
+  bool mStopping;
+  std::string mError;           ///< The first upload to fail, if any
+
+  std::vector<std::thread> mThreads;
+  unsigned int mMaxRetries;
+  std::atomic<uint64_t> mUploaded, mBytes, mRetries;
+};
+
+#endif /* CTBOBJECTSTOREUPLOADER_HPP */
@@ -44,6 +44,7 @@ ctb::CTBZOutputStream::~CTBZOutputStream() {
 uint32_t
 ctb::CTBZOutputStream::write(const void *ptr, uint32_t size) {
   deflateRound(ptr, size, Z_NO_FLUSH);
+  return size;
 }
 
 /**
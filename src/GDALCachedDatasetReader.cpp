@@ -0,0 +1,245 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file GDALCachedDatasetReader.cpp
+ * @brief This defines the `GDALCachedDatasetReader` class
+ */
+
+#include <cstring>
+#include <sstream>
+#include <vector>
+
+#include "zlib.h"
+#include "cpl_conv.h"
+#include "cpl_vsi.h"
+#include "cpl_string.h"
+
+#include "CTBException.hpp"
+#include "CTBFileTileSerializer.hpp"
+#include "GDALCachedDatasetReader.hpp"
+
+using namespace std;
+using namespace ctb;
+
+#ifdef _WIN32
+static const char *osDirSep = "\\";
+#else
+static const char *osDirSep = "/";
+#endif
+
+/// The first bytes of a cached height grid, changed whenever its layout does
+static const char CACHE_MAGIC[4] = {'C', 'T', 'B', '1'};
+
+/// The size of the header of a cached height grid: the magic and the grid size
+static const size_t CACHE_HEADER_SIZE = sizeof(CACHE_MAGIC) + 2 * sizeof(uint32_t);
+
+/// Create a directory unless it already exists
+static void
+createDirectory(const string &dirname) {
+  VSIStatBufL stat;
+
+  if (VSIStatExL(dirname.c_str(), &stat, VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG) == 0) {
+    if (!VSI_ISDIR(stat.st_mode)) {
+      throw CTBException("The height cache path is not a directory");
+    }
+    return;
+  }
+
+  // Another thread may create the directory first
+  if (VSIMkdir(dirname.c_str(), 0755) != 0
+      && (VSIStatExL(dirname.c_str(), &stat, VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG) != 0 || !VSI_ISDIR(stat.st_mode))) {
+    throw CTBException("Could not create the height cache directory");
+  }
+}
+
+ctb::GDALCachedDatasetReader::GDALCachedDatasetReader(GDALDatasetReader &source, const GDALTiler &tiler, const std::string &directory, const std::string &key):
+  mSource(source),
+  mDataset(tiler.dataset())
+{
+  if (directory.empty()) {
+    return;                     // caching is disabled
+  }
+
+  createDirectory(directory);
+  mDirectory = directory + osDirSep + fingerprint(tiler, key);
+  createDirectory(mDirectory);
+  mDirectory += osDirSep;
+}
+
+/**
+ * @details The fingerprint is the 64 bit FNV-1a hash of a description of the
+ * tiler, so it is the same on every run and platform.  The files of the
+ * dataset include the sources of a VRT, so that editing a source invalidates
+ * the cache.  `key` identifies anything else changing the heights which the
+ * tiler can't describe, such as the file of its geoid grid with its size and
+ * modification time.
+ */
+std::string
+ctb::GDALCachedDatasetReader::fingerprint(const GDALTiler &tiler, const std::string &key) {
+  ostringstream description;
+  description.precision(17);
+  description << string(CACHE_MAGIC, sizeof(CACHE_MAGIC)) << "\n";
+
+  char **files = tiler.dataset()->GetFileList();
+  for (int i = 0; files && files[i]; i++) {
+    VSIStatBufL stat;
+    description << files[i];
+    if (VSIStatL(files[i], &stat) == 0) {
+      description << " " << stat.st_size << " " << stat.st_mtime;
+    }
+    description << "\n";
+  }
+  CSLDestroy(files);
+
+  char *gridWKT = NULL;
+  tiler.grid().getSRS().exportToWkt(&gridWKT);
+  description << (gridWKT ? gridWKT : "") << " " << tiler.grid().tileSize() << "\n";
+  CPLFree(gridWKT);
+
+  // Tilers read different bounds for the same tile, such as the overlapping
+  // bounds of terrain tiles, so those of a probe tile are included
+  double resolution;
+  const CRSBounds probe = tiler.rasterTileBounds(TileCoordinate(0, 0, 0), resolution);
+  description << probe.getMinX() << " " << probe.getMinY() << " " << probe.getMaxX()
+              << " " << probe.getMaxY() << " " << resolution << "\n";
+
+  const TilerOptions &options = tiler.options;
+  description << options.resampleAlg << " " << options.errorThreshold
+              << " " << options.fillNoDataDistance << " " << key << "\n";
+
+  const string text = description.str();
+  uint64_t hash = 14695981039346656037ULL;
+  for (unsigned char c : text) {
+    hash ^= c;
+    hash *= 1099511628211ULL;
+  }
+
+  return CPLSPrintf("%016llx", (unsigned long long) hash);
+}
+
+/**
+ * @details Only the heights of the tiler's own dataset are cached; those of
+ * any other dataset, such as a strip of it, are read straight from `source`.
+ * A cache that can't be written leaves the heights as they were read.
+ */
+float *
+ctb::GDALCachedDatasetReader::readRasterHeights(GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) {
+  if (mDirectory.empty() || dataset != mDataset) {
+    return mSource.readRasterHeights(dataset, coord, tileSizeX, tileSizeY);
+  }
+
+  const string filename = CTBFileTileSerializer::getTileFilename(&coord, mDirectory, "heights");
+  float *heights = readCachedHeights(filename, tileSizeX, tileSizeY);
+
+  if (heights == NULL) {
+    heights = mSource.readRasterHeights(dataset, coord, tileSizeX, tileSizeY);
+    writeCachedHeights(filename, tileSizeX, tileSizeY, heights);
+  }
+
+  return heights;
+}
+
+/**
+ * @details A grid of another size, or one that is truncated or corrupt, is
+ * treated as missing and replaced.
+ */
+float *
+ctb::GDALCachedDatasetReader::readCachedHeights(const std::string &filename, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) const {
+  GByte *data = NULL;
+  vsi_l_offset size = 0;
+  if (!VSIIngestFile(NULL, filename.c_str(), &data, &size, -1)) {
+    return NULL;
+  }
+
+  uint32_t sizeX = 0, sizeY = 0;
+  if (size >= CACHE_HEADER_SIZE && memcmp(data, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0) {
+    memcpy(&sizeX, data + sizeof(CACHE_MAGIC), sizeof(uint32_t));
+    memcpy(&sizeY, data + sizeof(CACHE_MAGIC) + sizeof(uint32_t), sizeof(uint32_t));
+  }
+  if (sizeX != (uint32_t) tileSizeX || sizeY != (uint32_t) tileSizeY) {
+    VSIFree(data);
+    return NULL;
+  }
+
+  const size_t cellCount = (size_t) tileSizeX * tileSizeY;
+  vector<unsigned char> planes(cellCount * sizeof(float));
+  uLongf planesSize = planes.size();
+
+  if (uncompress(planes.data(), &planesSize, data + CACHE_HEADER_SIZE, size - CACHE_HEADER_SIZE) != Z_OK
+      || planesSize != planes.size()) {
+    VSIFree(data);
+    return NULL;
+  }
+  VSIFree(data);
+
+  // Gather the byte planes back into floats
+  float *heights = (float *) CPLMalloc(planes.size());
+  unsigned char *bytes = (unsigned char *) heights;
+  for (size_t plane = 0; plane < sizeof(float); plane++) {
+    const unsigned char *source = &planes[plane * cellCount];
+    for (size_t i = 0; i < cellCount; i++) {
+      bytes[i * sizeof(float) + plane] = source[i];
+    }
+  }
+
+  return heights;
+}
+
+/**
+ * @details The bytes of the heights are split into planes before being
+ * compressed, as the sign, exponent and high mantissa bytes of neighbouring
+ * heights mostly repeat and compress far better together.  The heights are
+ * kept losslessly as the meshes and pruning depend on their exact values.
+ */
+void
+ctb::GDALCachedDatasetReader::writeCachedHeights(const std::string &filename, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY, const float *heights) const {
+  const size_t cellCount = (size_t) tileSizeX * tileSizeY;
+  vector<unsigned char> planes(cellCount * sizeof(float));
+  const unsigned char *bytes = (const unsigned char *) heights;
+
+  for (size_t plane = 0; plane < sizeof(float); plane++) {
+    unsigned char *target = &planes[plane * cellCount];
+    for (size_t i = 0; i < cellCount; i++) {
+      target[i] = bytes[i * sizeof(float) + plane];
+    }
+  }
+
+  uLongf compressedSize = compressBound(planes.size());
+  vector<unsigned char> data(CACHE_HEADER_SIZE + compressedSize);
+  if (compress2(data.data() + CACHE_HEADER_SIZE, &compressedSize, planes.data(), planes.size(), Z_BEST_SPEED) != Z_OK) {
+    return;
+  }
+
+  const uint32_t sizeX = tileSizeX, sizeY = tileSizeY;
+  memcpy(data.data(), CACHE_MAGIC, sizeof(CACHE_MAGIC));
+  memcpy(data.data() + sizeof(CACHE_MAGIC), &sizeX, sizeof(uint32_t));
+  memcpy(data.data() + sizeof(CACHE_MAGIC) + sizeof(uint32_t), &sizeY, sizeof(uint32_t));
+  data.resize(CACHE_HEADER_SIZE + compressedSize);
+
+  // Write to a temporary file so that an interrupted build leaves no partial grid
+  const string temp_filename = filename + ".tmp";
+  VSILFILE *fp = VSIFOpenL(temp_filename.c_str(), "wb");
+  if (fp == NULL) {
+    return;
+  }
+  const bool written = VSIFWriteL(data.data(), 1, data.size(), fp) == data.size();
+  VSIFCloseL(fp);
+
+  if (!written || VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
+    VSIUnlink(temp_filename.c_str());
+  }
+}
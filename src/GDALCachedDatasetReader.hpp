@@ -0,0 +1,79 @@
+#ifndef GDALCACHEDDATASETREADER_HPP
+#define GDALCACHEDDATASETREADER_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file GDALCachedDatasetReader.hpp
+ * @brief This declares the `GDALCachedDatasetReader` class
+ */
+
+#include <string>
+
+#include "GDALDatasetReader.hpp"
+
+namespace ctb {
+  class GDALCachedDatasetReader;
+}
+
+/**
+ * @brief Implements a GDALDatasetReader that keeps the heights it reads on disk
+ *
+ * The heights of each tile read through another reader are written to a
+ * directory of compressed `Float32` grids, and read back from there by later
+ * builds rather than being read and warped from the sources again.  This
+ * makes a rebuild that only changes how the heights are encoded (such as the
+ * mesh quality factor, the vertex normals or the output format) much faster.
+ *
+ * The grids of a tiler are kept in a subdirectory named by a fingerprint of
+ * the files of its dataset (their names, sizes and modification times), its
+ * grid, the bounds it reads for a tile and the tiler options that change the
+ * heights, so that a change to any of these starts a new cache rather than
+ * reusing stale heights.
+ */
+class CTB_DLL ctb::GDALCachedDatasetReader : public ctb::GDALDatasetReader {
+public:
+
+  /// Read the heights of a tiler through `source`, caching them in `directory`
+  GDALCachedDatasetReader(GDALDatasetReader &source, const GDALTiler &tiler, const std::string &directory, const std::string &key = "");
+
+  /// Read a region of raster heights into an array for the specified Dataset and Coordinate
+  virtual float *
+  readRasterHeights(GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) override;
+
+  /// Get the fingerprint of the sources, grid and options of a tiler
+  static std::string
+  fingerprint(const GDALTiler &tiler, const std::string &key);
+
+protected:
+  /// Read the heights of a tile from the cache, returning `NULL` if they aren't there
+  float *
+  readCachedHeights(const std::string &filename, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) const;
+
+  /// Write the heights of a tile to the cache
+  void
+  writeCachedHeights(const std::string &filename, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY, const float *heights) const;
+
+  /// The reader of heights missing from the cache
+  GDALDatasetReader &mSource;
+  /// The dataset whose heights are cached
+  GDALDataset *mDataset;
+  /// The cache directory of the tiler, which is empty when caching is disabled
+  std::string mDirectory;
+};
+
+#endif /* GDALCACHEDDATASETREADER_HPP */
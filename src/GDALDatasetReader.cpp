@@ -19,11 +19,16 @@
  * @brief This defines the `GDALDatasetReader` class
  */
 
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
 #include "gdal_priv.h"
 #include "gdalwarper.h"
 
 #include "CTBException.hpp"
 #include "GDALDatasetReader.hpp"
+#include "GeoidGrid.hpp"
 #include "TerrainTiler.hpp"
 
 using namespace ctb;
@@ -51,9 +56,220 @@ ctb::GDALDatasetReader::readRasterHeights(const GDALTiler &tiler, GDALDataset *d
     throw CTBException("Could not read heights from raster");
   }
   delete rasterTile;
+
+  adjustHeights(tiler, dataset, coord, tileSizeX, tileSizeY, rasterHeights);
   return rasterHeights;
 }
 
+/**
+ * @details 
+ * Read the rows `firstRow` to `firstRow + rowCount` of the raster heights of a
+ * tile into the same rows of `rasterHeights`.  Only the source pixels under the
+ * strip are warped, so the strips of a tile can be read in parallel using
+ * separate datasets.
+ */
+void
+ctb::GDALDatasetReader::readRasterHeights(const GDALTiler &tiler, GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY, ctb::i_tile firstRow, ctb::i_tile rowCount, float *rasterHeights) {
+  if (firstRow + rowCount > tileSizeY) {
+    throw CTBException("The strip extends beyond the tile");
+  }
+
+  // The geo transform of the tile raster, moved down to the first row
+  double resolution;
+  const CRSBounds tileBounds = tiler.rasterTileBounds(coord, resolution);
+  double adfGeoTransform[6] = {
+    tileBounds.getMinX(), resolution, 0,
+    tileBounds.getMaxY() - firstRow * resolution, 0, -resolution
+  };
+
+  GDALTile *rasterTile = tiler.createRasterTile(dataset, adfGeoTransform, tileSizeX, rowCount);
+  GDALRasterBand *heightsBand = rasterTile->dataset->GetRasterBand(1);
+
+  if (heightsBand->RasterIO(GF_Read, 0, 0, tileSizeX, rowCount,
+                            (void *) (rasterHeights + firstRow * tileSizeX), tileSizeX, rowCount, GDT_Float32,
+                            0, 0) != CE_None) {
+    delete rasterTile;
+    throw CTBException("Could not read heights from raster");
+  }
+  delete rasterTile;
+}
+
+/**
+ * @details
+ * The heights are adjusted as the tiler's options ask: holes are filled (see
+ * `fillNoData`) and orthometric heights are made ellipsoidal with a geoid
+ * grid (see `GeoidGrid::toEllipsoidal`).
+ */
+void
+ctb::GDALDatasetReader::adjustHeights(const GDALTiler &tiler, GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY, float *rasterHeights) {
+  fillNoData(tiler, dataset, coord, tileSizeX, tileSizeY, rasterHeights);
+
+  if (tiler.options.geoid) {
+    double resolution;
+    const CRSBounds tileBounds = tiler.rasterTileBounds(coord, resolution);
+    tiler.options.geoid->toEllipsoidal(tiler.grid(), tileBounds, resolution, tileSizeX, tileSizeY,
+                                       rasterHeights, noDataValue(tiler.dataset()));
+  }
+}
+
+/**
+ * @details
+ * The cells of a grid without weight are filled from a pyramid of grids half
+ * the size of the one below, each cell of which is the average of the cells
+ * with weight under it.  Filled cells are interpolated bilinearly from the
+ * cells with weight of the grid above, so holes are filled with a smooth
+ * surface reaching about `2 ^ levels` cells from their edges.
+ */
+static void
+pushPull(std::vector<float> &values, std::vector<float> &weights, int sizeX, int sizeY, int levels) {
+  if (levels < 1 || (sizeX < 2 && sizeY < 2)) {
+    return;
+  }
+
+  // Push: average the cells with weight of each 2x2 block
+  const int coarseX = (sizeX + 1) / 2, coarseY = (sizeY + 1) / 2;
+  std::vector<float> coarse(coarseX * coarseY, 0), coarseWeights(coarseX * coarseY, 0);
+
+  for (int y = 0; y < sizeY; y++) {
+    for (int x = 0; x < sizeX; x++) {
+      const float weight = weights[y * sizeX + x];
+      const int cell = (y / 2) * coarseX + x / 2;
+      coarse[cell] += weight * values[y * sizeX + x];
+      coarseWeights[cell] += weight;
+    }
+  }
+  for (size_t cell = 0; cell < coarse.size(); cell++) {
+    if (coarseWeights[cell] > 0) {
+      coarse[cell] /= coarseWeights[cell];
+      coarseWeights[cell] = 1;
+    }
+  }
+
+  pushPull(coarse, coarseWeights, coarseX, coarseY, levels - 1);
+
+  // Pull: interpolate the cells without weight from the coarse cells with weight
+  for (int y = 0; y < sizeY; y++) {
+    const double coarseRow = (y + 0.5) / 2 - 0.5;
+    const int y0 = (int) floor(coarseRow);
+    const double dy = coarseRow - y0;
+
+    for (int x = 0; x < sizeX; x++) {
+      if (weights[y * sizeX + x] > 0) continue;
+
+      const double coarseColumn = (x + 0.5) / 2 - 0.5;
+      const int x0 = (int) floor(coarseColumn);
+      const double dx = coarseColumn - x0;
+      double sum = 0, total = 0;
+
+      for (int j = 0; j < 2; j++) {
+        const int row = std::min(std::max(y0 + j, 0), coarseY - 1);
+        for (int i = 0; i < 2; i++) {
+          const int cell = row * coarseX + std::min(std::max(x0 + i, 0), coarseX - 1);
+          const double weight = (i ? dx : 1 - dx) * (j ? dy : 1 - dy) * coarseWeights[cell];
+          sum += weight * coarse[cell];
+          total += weight;
+        }
+      }
+      if (total > 0) {
+        values[y * sizeX + x] = (float) (sum / total);
+        weights[y * sizeX + x] = 1;
+      }
+    }
+  }
+}
+
+/**
+ * @details
+ * Heights without data within about `TilerOptions::fillNoDataDistance` pixels
+ * of heights with data are interpolated from them, as `gdal_fillnodata` would
+ * do to the source, so that holes don't become pits in the terrain.  Only
+ * tiles with holes pay for the filling: their heights are read again with an
+ * apron of that many pixels from the neighbouring tiles, so that a hole on the
+ * edge of a tile is filled the same way in the tiles either side.  Heights
+ * outside of the dataset are left without data.
+ */
+void
+ctb::GDALDatasetReader::fillNoData(const GDALTiler &tiler, GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY, float *rasterHeights) {
+  const int distance = tiler.options.fillNoDataDistance;
+  if (distance < 1) {
+    return;
+  }
+
+  const float noData = noDataValue(tiler.dataset());
+  const ctb::i_tile TILE_CELL_SIZE = tileSizeX * tileSizeY;
+  bool hasHoles = false;
+  for (ctb::i_tile i = 0; i < TILE_CELL_SIZE && !hasHoles; i++) {
+    hasHoles = rasterHeights[i] == noData || std::isnan(rasterHeights[i]);
+  }
+  if (!hasHoles) {
+    return;
+  }
+
+  // Read the heights with an apron around the tile
+  double resolution;
+  const CRSBounds tileBounds = tiler.rasterTileBounds(coord, resolution);
+  const int apronX = tileSizeX + 2 * distance, apronY = tileSizeY + 2 * distance;
+  double adfGeoTransform[6] = {
+    tileBounds.getMinX() - distance * resolution, resolution, 0,
+    tileBounds.getMaxY() + distance * resolution, 0, -resolution
+  };
+
+  std::vector<float> values(apronX * apronY, noData), weights(apronX * apronY, 0);
+  try {
+    GDALTile *rasterTile = tiler.createRasterTile(dataset, adfGeoTransform, apronX, apronY);
+    if (rasterTile->dataset->GetRasterBand(1)->RasterIO(GF_Read, 0, 0, apronX, apronY,
+                                                        (void *) values.data(), apronX, apronY, GDT_Float32,
+                                                        0, 0) != CE_None) {
+      std::fill(values.begin(), values.end(), noData);
+    }
+    delete rasterTile;
+  } catch (CTBException &) {
+    // Fill the holes from the heights of the tile alone
+  }
+
+  // The heights of the tile itself are kept as they were read
+  for (ctb::i_tile y = 0; y < tileSizeY; y++) {
+    std::copy(rasterHeights + y * tileSizeX, rasterHeights + (y + 1) * tileSizeX,
+              values.begin() + (y + distance) * apronX + distance);
+  }
+  for (size_t i = 0; i < values.size(); i++) {
+    weights[i] = (values[i] == noData || std::isnan(values[i])) ? 0 : 1;
+  }
+
+  int levels = 1;
+  while ((1 << levels) < distance) levels++;
+  pushPull(values, weights, apronX, apronY, levels);
+
+  // Fill the holes within the dataset
+  const CRSBounds &datasetBounds = tiler.bounds();
+  for (ctb::i_tile y = 0; y < tileSizeY; y++) {
+    const double northing = tileBounds.getMaxY() - (y + 0.5) * resolution;
+    if (northing < datasetBounds.getMinY() || northing > datasetBounds.getMaxY()) continue;
+
+    for (ctb::i_tile x = 0; x < tileSizeX; x++) {
+      const double easting = tileBounds.getMinX() + (x + 0.5) * resolution;
+      float &height = rasterHeights[y * tileSizeX + x];
+
+      if ((height == noData || std::isnan(height))
+          && easting >= datasetBounds.getMinX() && easting <= datasetBounds.getMaxX()) {
+        height = values[(y + distance) * apronX + x + distance];
+      }
+    }
+  }
+}
+
+/**
+ * @details
+ * This is the no data value of the first band, or -32768 if it has none, as
+ * given to the warper by `GDALTiler::createRasterTile`.
+ */
+float
+ctb::GDALDatasetReader::noDataValue(GDALDataset *dataset) {
+  int bGotNoData = FALSE;
+  const double noDataValue = dataset->GetRasterBand(1)->GetNoDataValue(&bGotNoData);
+  return (float) (bGotNoData ? noDataValue : -32768);
+}
+
 /// Create a raster tile from a tile coordinate
 GDALTile *
 ctb::GDALDatasetReader::createRasterTile(const GDALTiler &tiler, GDALDataset *dataset, const TileCoordinate &coord) {
@@ -140,6 +356,8 @@ ctb::GDALDatasetReaderWithOverviews::readRasterHeights(GDALDataset *dataset, con
     CPLFree(rasterHeights);
     throw CTBException("Could not read heights from raster");
   }
+
+  adjustHeights(poTiler, mainDataset, coord, tileSizeX, tileSizeY, rasterHeights);
   return rasterHeights;
 }
 
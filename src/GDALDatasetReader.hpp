@@ -53,6 +53,22 @@ public:
   virtual float *
   readRasterHeights(GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) = 0;
 
+  /// Read a strip of rows of the raster heights of a Coordinate into an array of the whole tile
+  static void
+  readRasterHeights(const GDALTiler &tiler, GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY, ctb::i_tile firstRow, ctb::i_tile rowCount, float *rasterHeights);
+
+  /// Fill the holes in the heights of a tile and convert them to the output datum
+  static void
+  adjustHeights(const GDALTiler &tiler, GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY, float *rasterHeights);
+
+  /// Fill the heights without data of a tile from the heights around them
+  static void
+  fillNoData(const GDALTiler &tiler, GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY, float *rasterHeights);
+
+  /// Get the height given to pixels without data when reading a dataset
+  static float
+  noDataValue(GDALDataset *dataset);
+
 protected:
   /// Create a raster tile from a tile coordinate
   static GDALTile *
@@ -0,0 +1,437 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file GDALMappedDatasetReader.cpp
+ * @brief This defines the `GDALMappedRaster` and `GDALMappedDatasetReader` classes
+ */
+
+#include <string.h>             // for memcpy
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "gdal_priv.h"
+#include "cpl_conv.h"
+#include "cpl_string.h"
+#include "cpl_vsi.h"
+
+#include "GDALMappedDatasetReader.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// The offset of a block which is absent from a sparse file
+static const uint64_t ABSENT_BLOCK = ~(uint64_t) 0;
+
+/// The source pixels per tile pixel from which GDAL would read an overview instead
+static const double OVERVIEW_SCALE = 2.0;
+
+/// The mappings of the files in use, shared by all datasets and threads
+static mutex mappingsMutex;
+static map<string, weak_ptr<const GDALMappedRaster>> mappings;
+
+/// Is a file on a local file system rather than a GDAL virtual file system?
+static bool
+isLocalFile(const string &filename) {
+  return !filename.empty() && filename.compare(0, 4, "/vsi") != 0;
+}
+
+/**
+ * @details The mapping is shared with any other dataset of the same file that
+ * is still being read.
+ */
+std::shared_ptr<const GDALMappedRaster>
+ctb::GDALMappedRaster::open(GDALDataset *dataset) {
+  const string name = dataset->GetDescription();
+  lock_guard<mutex> lock(mappingsMutex);
+
+  shared_ptr<const GDALMappedRaster> mapped = mappings[name].lock();
+  if (mapped) {
+    return mapped;
+  }
+
+  // Only the heights of the first band are mapped
+  double adfGeoTransform[6];
+  if (dataset->GetRasterCount() < 1
+      || dataset->GetRasterBand(1)->GetRasterDataType() != GDT_Float32
+      || dataset->GetGeoTransform(adfGeoTransform) != CE_None
+      || adfGeoTransform[2] != 0 || adfGeoTransform[4] != 0) {
+    return nullptr;
+  }
+
+  shared_ptr<GDALMappedRaster> raster(new GDALMappedRaster());
+  string filename;
+  raster->mWidth = dataset->GetRasterXSize();
+  raster->mHeight = dataset->GetRasterYSize();
+  std::copy(adfGeoTransform, adfGeoTransform + 6, raster->mGeoTransform);
+
+  raster->mNoDataValue = GDALDatasetReader::noDataValue(dataset);
+
+  if (!(readTiffLayout(dataset, *raster, filename) || readRawLayout(dataset, *raster, filename))
+      || !isLocalFile(filename) || !raster->map(filename)) {
+    return nullptr;
+  }
+
+  mappings[name] = raster;
+  return raster;
+}
+
+ctb::GDALMappedRaster::~GDALMappedRaster() {
+#ifndef _WIN32
+  if (mData) {
+    munmap((void *) mData, mSize);
+  }
+#endif
+}
+
+/**
+ * @details The offset of each block is read from the `TIFF` metadata domain of
+ * the GeoTIFF driver.  Stripped files are read as blocks of whole rows.
+ */
+bool
+ctb::GDALMappedRaster::readTiffLayout(GDALDataset *dataset, GDALMappedRaster &raster, std::string &filename) {
+  GDALDriver *poDriver = dataset->GetDriver();
+  if (poDriver == NULL || !EQUAL(poDriver->GetDescription(), "GTiff")
+      || dataset->GetMetadataItem("COMPRESSION", "IMAGE_STRUCTURE") != NULL) {
+    return false;
+  }
+  filename = dataset->GetDescription();
+
+  // The pixels must be in the byte order of the host
+  char byteOrder[2] = {0, 0};
+  VSILFILE *fp = VSIFOpenL(filename.c_str(), "rb");
+  if (fp == NULL) {
+    return false;
+  }
+  const bool readHeader = VSIFReadL(byteOrder, 1, 2, fp) == 2;
+  VSIFCloseL(fp);
+#ifdef CPL_LSB
+  if (!readHeader || byteOrder[0] != 'I' || byteOrder[1] != 'I') return false;
+#else
+  if (!readHeader || byteOrder[0] != 'M' || byteOrder[1] != 'M') return false;
+#endif
+
+  // Floats of 16 or 24 bits aren't stored as the 4 byte floats read by GDAL
+  GDALRasterBand *heightsBand = dataset->GetRasterBand(1);
+  if (heightsBand->GetMetadataItem("NBITS", "IMAGE_STRUCTURE") != NULL
+      || dataset->GetMetadataItem("NBITS", "IMAGE_STRUCTURE") != NULL) {
+    return false;
+  }
+
+  const char *interleave = dataset->GetMetadataItem("INTERLEAVE", "IMAGE_STRUCTURE");
+  const bool pixelInterleaved = dataset->GetRasterCount() > 1 && interleave && EQUAL(interleave, "PIXEL");
+
+  heightsBand->GetBlockSize(&raster.mBlockWidth, &raster.mBlockHeight);
+  if (raster.mBlockWidth < 1 || raster.mBlockHeight < 1) {
+    return false;
+  }
+  raster.mBlocksPerRow = (raster.mWidth + raster.mBlockWidth - 1) / raster.mBlockWidth;
+  raster.mPixelStride = sizeof(float) * (pixelInterleaved ? dataset->GetRasterCount() : 1);
+  raster.mLineStride = raster.mBlockWidth * raster.mPixelStride;
+
+  const int blockRows = (raster.mHeight + raster.mBlockHeight - 1) / raster.mBlockHeight;
+  raster.mBlockOffsets.clear();
+  raster.mBlockOffsets.reserve((size_t) raster.mBlocksPerRow * blockRows);
+
+  for (int blockY = 0; blockY < blockRows; blockY++) {
+    for (int blockX = 0; blockX < raster.mBlocksPerRow; blockX++) {
+      const char *offset = heightsBand->GetMetadataItem(CPLSPrintf("BLOCK_OFFSET_%d_%d", blockX, blockY), "TIFF");
+      const uint64_t value = offset ? strtoull(offset, NULL, 10) : 0;
+      raster.mBlockOffsets.push_back(value > 0 ? value : ABSENT_BLOCK);
+    }
+  }
+  return true;
+}
+
+/**
+ * @details Raw rasters, such as ENVI files, describe their layout through
+ * `GDALDataset::GetRawBinaryLayout`, which was added in GDAL 3.1.  The whole
+ * band is read as a single block.
+ */
+bool
+ctb::GDALMappedRaster::readRawLayout(GDALDataset *dataset, GDALMappedRaster &raster, std::string &filename) {
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,1,0)
+  GDALDataset::RawBinaryLayout layout;
+  if (!dataset->GetRawBinaryLayout(layout) || layout.eDataType != GDT_Float32
+      || layout.nPixelOffset < (GIntBig) sizeof(float) || layout.nLineOffset <= 0 || layout.nImageOffset < 0) {
+    return false;
+  }
+#ifdef CPL_LSB
+  if (!layout.bLittleEndianOrder) return false;
+#else
+  if (layout.bLittleEndianOrder) return false;
+#endif
+
+  filename = layout.osRawFilename;
+  raster.mBlockWidth = raster.mWidth;
+  raster.mBlockHeight = raster.mHeight;
+  raster.mBlocksPerRow = 1;
+  raster.mPixelStride = (size_t) layout.nPixelOffset;
+  raster.mLineStride = (size_t) layout.nLineOffset;
+  raster.mBlockOffsets.assign(1, (uint64_t) layout.nImageOffset);
+  return true;
+#else
+  (void) dataset;
+  (void) raster;
+  (void) filename;
+  return false;
+#endif
+}
+
+/**
+ * @details The file is mapped for random access, as neighbouring tiles of a
+ * tiled file are rarely neighbours in the file, and the pages to be read are
+ * advised instead (see `willNeed`).
+ */
+bool
+ctb::GDALMappedRaster::map(const std::string &filename) {
+#ifdef _WIN32
+  (void) filename;
+  return false;
+#else
+  const int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size > 0) {
+    data = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  }
+  ::close(fd);                  // the mapping keeps the file open
+
+  if (data == MAP_FAILED) {
+    return false;
+  }
+  mData = (const unsigned char *) data;
+  mSize = (size_t) st.st_size;
+  madvise(data, mSize, MADV_RANDOM);
+
+  // Every block present must lie within the file
+  for (size_t i = 0; i < mBlockOffsets.size(); i++) {
+    if (mBlockOffsets[i] == ABSENT_BLOCK) continue;
+
+    const int blockX = (int) (i % mBlocksPerRow), blockY = (int) (i / mBlocksPerRow);
+    const size_t rows = std::min(mBlockHeight, mHeight - blockY * mBlockHeight),
+      columns = std::min(mBlockWidth, mWidth - blockX * mBlockWidth);
+    const uint64_t end = mBlockOffsets[i] + (rows - 1) * mLineStride + (columns - 1) * mPixelStride + sizeof(float);
+
+    if (end > mSize) {
+      return false;
+    }
+  }
+  return true;
+#endif
+}
+
+bool
+ctb::GDALMappedRaster::read(int x, int y, float &height) const {
+  const int blockX = x / mBlockWidth, blockY = y / mBlockHeight;
+  const uint64_t offset = mBlockOffsets[(size_t) blockY * mBlocksPerRow + blockX];
+
+  if (offset == ABSENT_BLOCK) {
+    return false;
+  }
+
+  // The blocks of a file need not be aligned for floats
+  memcpy(&height, mData + offset
+         + (y - blockY * mBlockHeight) * mLineStride
+         + (x - blockX * mBlockWidth) * mPixelStride, sizeof(float));
+  return true;
+}
+
+/**
+ * @details The rows of the window in each block are advised as one range,
+ * unless the block is much wider than the window (as a raw raster is), when
+ * each row is advised separately.
+ */
+void
+ctb::GDALMappedRaster::willNeed(int minX, int minY, int maxX, int maxY) const {
+#ifndef _WIN32
+  minX = std::max(minX, 0);
+  minY = std::max(minY, 0);
+  maxX = std::min(maxX, mWidth - 1);
+  maxY = std::min(maxY, mHeight - 1);
+  if (minX > maxX || minY > maxY) {
+    return;
+  }
+
+  static const uint64_t pageMask = ~(uint64_t) (sysconf(_SC_PAGESIZE) - 1);
+  auto advise = [this](uint64_t start, uint64_t end) {
+    start &= pageMask;
+    madvise((void *) (mData + start), (size_t) (std::min(end, (uint64_t) mSize) - start), MADV_WILLNEED);
+  };
+
+  for (int blockY = minY / mBlockHeight; blockY <= maxY / mBlockHeight; blockY++) {
+    for (int blockX = minX / mBlockWidth; blockX <= maxX / mBlockWidth; blockX++) {
+      const uint64_t offset = mBlockOffsets[(size_t) blockY * mBlocksPerRow + blockX];
+      if (offset == ABSENT_BLOCK) continue;
+
+      // The window within the block
+      const int firstRow = std::max(minY - blockY * mBlockHeight, 0),
+        lastRow = std::min(maxY - blockY * mBlockHeight, mBlockHeight - 1),
+        firstColumn = std::max(minX - blockX * mBlockWidth, 0),
+        lastColumn = std::min(maxX - blockX * mBlockWidth, mBlockWidth - 1);
+      const uint64_t rowStart = offset + firstColumn * mPixelStride,
+        rowBytes = (lastColumn - firstColumn) * mPixelStride + sizeof(float);
+
+      if (rowBytes * 2 < mLineStride) {
+        for (int row = firstRow; row <= lastRow; row++) {
+          advise(rowStart + row * mLineStride, rowStart + row * mLineStride + rowBytes);
+        }
+      } else {
+        advise(rowStart + firstRow * mLineStride, rowStart + lastRow * mLineStride + rowBytes);
+      }
+    }
+  }
+#else
+  (void) minX;
+  (void) minY;
+  (void) maxX;
+  (void) maxY;
+#endif
+}
+
+/// Read a region of raster heights into an array for the specified Dataset and Coordinate
+float *
+ctb::GDALMappedDatasetReader::readRasterHeights(GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) {
+  float *rasterHeights = readMappedHeights(dataset, coord, tileSizeX, tileSizeY);
+  if (rasterHeights) {
+    adjustHeights(poTiler, dataset, coord, tileSizeX, tileSizeY, rasterHeights);
+    return rasterHeights;
+  }
+  return GDALDatasetReaderWithOverviews::readRasterHeights(dataset, coord, tileSizeX, tileSizeY);
+}
+
+/**
+ * @details Each height is resampled from the source pixels under it as the
+ * warper would: the nearest neighbour takes the pixel under its centre,
+ * bilinear weights the four pixels around its centre and average weights the
+ * pixels it covers by their overlap.  Pixels without data are left out of the
+ * weights, and heights with no source pixels are given the no data value.
+ */
+float *
+ctb::GDALMappedDatasetReader::readMappedHeights(GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) {
+  const GDALResampleAlg resampleAlg = poTiler.options.resampleAlg;
+  if (poTiler.requiresReprojection()
+      || (resampleAlg != GRA_NearestNeighbour && resampleAlg != GRA_Bilinear && resampleAlg != GRA_Average)) {
+    return NULL;
+  }
+
+  if (dataset != mDataset) {
+    mDataset = dataset;
+    mMapping = GDALMappedRaster::open(dataset);
+  }
+  if (!mMapping) {
+    return NULL;
+  }
+  const GDALMappedRaster &raster = *mMapping;
+  const double *adfGeoTransform = raster.geoTransform();
+
+  // Tiles coarser than the source are left to the overviews of the warper
+  double resolution;
+  const CRSBounds tileBounds = poTiler.rasterTileBounds(coord, resolution);
+  const double scaleX = resolution / adfGeoTransform[1],
+    scaleY = resolution / -adfGeoTransform[5];
+  if (scaleX <= 0 || scaleY <= 0 || scaleX >= OVERVIEW_SCALE || scaleY >= OVERVIEW_SCALE) {
+    return NULL;
+  }
+
+  // The source pixel position of the north west corner of the tile
+  const double originX = (tileBounds.getMinX() - adfGeoTransform[0]) / adfGeoTransform[1],
+    originY = (tileBounds.getMaxY() - adfGeoTransform[3]) / adfGeoTransform[5];
+
+  // Advise the pixels of this tile and of the next one to the east
+  raster.willNeed((int) floor(originX) - 1, (int) floor(originY) - 1,
+                  (int) ceil(originX + 2 * tileSizeX * scaleX) + 1, (int) ceil(originY + tileSizeY * scaleY) + 1);
+
+  const float noData = (float) raster.noDataValue();
+  const int width = raster.width(), height = raster.height();
+  auto valid = [&](int x, int y, float &value) {
+    return x >= 0 && y >= 0 && x < width && y < height
+      && raster.read(x, y, value) && !std::isnan(value) && value != noData;
+  };
+
+  float *rasterHeights = (float *) CPLMalloc(sizeof(float) * tileSizeX * tileSizeY);
+
+  for (ctb::i_tile j = 0; j < tileSizeY; j++) {
+    const double top = originY + j * scaleY, centreY = top + scaleY / 2;
+
+    for (ctb::i_tile i = 0; i < tileSizeX; i++) {
+      const double left = originX + i * scaleX, centreX = left + scaleX / 2;
+      float value, result = noData;
+
+      if (resampleAlg == GRA_NearestNeighbour) {
+        if (valid((int) floor(centreX), (int) floor(centreY), value)) {
+          result = value;
+        }
+      } else if (resampleAlg == GRA_Bilinear) {
+        // The pixel under the centre must have data
+        if (valid((int) floor(centreX), (int) floor(centreY), value)) {
+          const int x0 = (int) floor(centreX - 0.5), y0 = (int) floor(centreY - 0.5);
+          const double dx = centreX - 0.5 - x0, dy = centreY - 0.5 - y0;
+          double sum = 0, weights = 0;
+
+          for (int y = 0; y < 2; y++) {
+            for (int x = 0; x < 2; x++) {
+              if (valid(x0 + x, y0 + y, value)) {
+                const double weight = (x ? dx : 1 - dx) * (y ? dy : 1 - dy);
+                sum += weight * value;
+                weights += weight;
+              }
+            }
+          }
+          if (weights > 0) {
+            result = (float) (sum / weights);
+          }
+        }
+      } else {                  // GRA_Average
+        const double right = left + scaleX, bottom = top + scaleY;
+        double sum = 0, weights = 0;
+
+        for (int y = (int) floor(top + 1e-10); y < (int) ceil(bottom - 1e-10); y++) {
+          const double weightY = std::min(y + 1.0, bottom) - std::max((double) y, top);
+
+          for (int x = (int) floor(left + 1e-10); x < (int) ceil(right - 1e-10); x++) {
+            if (valid(x, y, value)) {
+              const double weight = weightY * (std::min(x + 1.0, right) - std::max((double) x, left));
+              sum += weight * value;
+              weights += weight;
+            }
+          }
+        }
+        if (weights > 0) {
+          result = (float) (sum / weights);
+        }
+      }
+
+      rasterHeights[j * tileSizeX + i] = result;
+    }
+  }
+
+  return rasterHeights;
+}
@@ -0,0 +1,154 @@
+#ifndef GDALMAPPEDDATASETREADER_HPP
+#define GDALMAPPEDDATASETREADER_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file GDALMappedDatasetReader.hpp
+ * @brief This declares the `GDALMappedRaster` and `GDALMappedDatasetReader` classes
+ */
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "GDALDatasetReader.hpp"
+
+namespace ctb {
+  class GDALMappedRaster;
+  class GDALMappedDatasetReader;
+}
+
+/**
+ * @brief A read only memory map of the first band of an uncompressed raster
+ *
+ * Uncompressed, native byte order `Float32` GeoTIFFs (tiled or stripped) and
+ * raw rasters such as ENVI files (with GDAL 3.1 or later) store their pixels
+ * at fixed offsets in the file, so their heights can be read straight from a
+ * memory map of the file rather than through the GDAL block cache.  A file is
+ * mapped once however many datasets and threads read it, so they all share
+ * the pages of the operating system's page cache.
+ */
+class CTB_DLL ctb::GDALMappedRaster {
+public:
+
+  /// Map the file of a dataset, returning `nullptr` if its layout can't be mapped
+  static std::shared_ptr<const GDALMappedRaster>
+  open(GDALDataset *dataset);
+
+  /// Unmap the file
+  ~GDALMappedRaster();
+
+  /// Read the height of a pixel, returning false if its block is absent from the file
+  bool
+  read(int x, int y, float &height) const;
+
+  /// Advise that the pixels of a window will be read soon
+  void
+  willNeed(int minX, int minY, int maxX, int maxY) const;
+
+  /// Get the width of the raster in pixels
+  inline int
+  width() const {
+    return mWidth;
+  }
+
+  /// Get the height of the raster in pixels
+  inline int
+  height() const {
+    return mHeight;
+  }
+
+  /// Get the geo transform of the raster
+  inline const double *
+  geoTransform() const {
+    return mGeoTransform;
+  }
+
+  /// Get the value of pixels without data
+  inline double
+  noDataValue() const {
+    return mNoDataValue;
+  }
+
+protected:
+  GDALMappedRaster():
+    mData(NULL),
+    mSize(0)
+  {}
+
+  /// Read the block layout of an uncompressed GeoTIFF
+  static bool
+  readTiffLayout(GDALDataset *dataset, GDALMappedRaster &raster, std::string &filename);
+
+  /// Read the layout of a raw raster
+  static bool
+  readRawLayout(GDALDataset *dataset, GDALMappedRaster &raster, std::string &filename);
+
+  /// Map a file, checking that the blocks lie within it
+  bool
+  map(const std::string &filename);
+
+  const unsigned char *mData;   ///< The mapped file
+  size_t mSize;                 ///< The size of the mapped file in bytes
+
+  int mWidth, mHeight;
+  double mGeoTransform[6];
+  double mNoDataValue;
+
+  int mBlockWidth, mBlockHeight; ///< The size of the blocks in pixels
+  int mBlocksPerRow;
+  size_t mPixelStride;          ///< The bytes between neighbouring pixels of a row
+  size_t mLineStride;           ///< The bytes between neighbouring rows of a block
+  std::vector<uint64_t> mBlockOffsets; ///< The file offset of each block
+};
+
+/**
+ * @brief Implements a GDALDatasetReader that reads mapped rasters directly
+ *
+ * Tiles of a dataset that can be mapped (see `GDALMappedRaster`) are sampled
+ * straight from the mapped blocks when no reprojection or overview is needed
+ * and the tiler resamples with the nearest neighbour, bilinear or average
+ * algorithms, which are computed as the GDAL warper does.  The blocks of the
+ * tile and of its neighbour to the east, which is usually read next, are
+ * advised to the kernel ahead of the reads.  Every other tile is read through
+ * GDAL as by the base class.
+ */
+class CTB_DLL ctb::GDALMappedDatasetReader : public ctb::GDALDatasetReaderWithOverviews {
+public:
+
+  /// Instantiate a GDALMappedDatasetReader
+  GDALMappedDatasetReader(const GDALTiler &tiler):
+    GDALDatasetReaderWithOverviews(tiler),
+    mDataset(NULL) {}
+
+  /// Read a region of raster heights into an array for the specified Dataset and Coordinate
+  virtual float *
+  readRasterHeights(GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) override;
+
+protected:
+  /// Read the heights of a tile from the mapped dataset, returning `NULL` if it can't be
+  float *
+  readMappedHeights(GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY);
+
+  /// The dataset whose mapping was looked up last
+  GDALDataset *mDataset;
+  /// The mapping of that dataset, if it can be mapped
+  std::shared_ptr<const GDALMappedRaster> mMapping;
+};
+
+#endif /* GDALMAPPEDDATASETREADER_HPP */
@@ -26,6 +26,8 @@
 #include "TileCoordinate.hpp"
 #include "GDALTile.hpp"
 
+#include <vector>
+
 #include "cpl_string.h"
 
 namespace ctb {
@@ -45,6 +47,9 @@ public:
   /// Serialize a GDALTile to the store
   virtual bool serializeTile(const ctb::GDALTile *tile, GDALDriver *driver, const char *extension, CPLStringList &creationOptions) = 0;
 
+  /// Serialize the bytes of a tile already encoded by a GDAL driver to the store
+  virtual bool serializeTile(const ctb::TileCoordinate *coordinate, const std::vector<unsigned char> &bytes, GDALDriver *driver, const char *extension) = 0;
+
   /// Serialization finished, releases any resources loaded
   virtual void endSerialization() = 0;
 };
@@ -19,8 +19,14 @@
  * @brief This defines the `GDALTile` class
  */
 
+#include <functional>
+#include <thread>
+
 #include "gdalwarper.h"
+#include "cpl_vsi.h"
 
+#include "../deps/concat.hpp"
+#include "CTBException.hpp"
 #include "GDALTile.hpp"
 
 using namespace ctb;
@@ -49,3 +55,46 @@ GDALDataset *GDALTile::detach() {
   }
   return NULL;
 }
+
+/**
+ * @details
+ * The driver writes the tile to an in memory file of the calling thread, so
+ * its many small writes and seeks never reach a file system and the encoded
+ * bytes can be written out, or stored, with a single write.  Formats writing
+ * more than one file, such as ENVI with its header, can't be held in a single
+ * blob: they return false and should be created on disk instead.  Auxiliary
+ * `.aux.xml` files written by the driver are discarded.
+ */
+bool
+GDALTile::encode(GDALDriver *driver, const char *extension, CPLStringList &creationOptions, std::vector<unsigned char> &bytes) const {
+  const std::string dirname = concat("/vsimem/ctb-encode-", std::hash<std::thread::id>()(std::this_thread::get_id()));
+  const std::string filename = concat(dirname, "/tile.", extension ? extension : "dat");
+
+  GDALDataset *poDstDS = driver->CreateCopy(filename.c_str(), dataset, FALSE, creationOptions, NULL, NULL);
+  if (poDstDS == NULL) {
+    throw CTBException("Could not create GDAL tile");
+  }
+
+  char **files = poDstDS->GetFileList();
+  const bool singleFile = CSLCount(files) <= 1;
+  CSLDestroy(files);
+  GDALClose(poDstDS);
+
+  vsi_l_offset length = 0;
+  const GByte *buffer = VSIGetMemFileBuffer(filename.c_str(), &length, FALSE);
+  if (buffer && singleFile) {
+    bytes.assign(buffer, buffer + length);
+  }
+
+  // Remove the tile and any other files the driver wrote
+  char **entries = VSIReadDir(dirname.c_str());
+  for (int i = 0; entries && entries[i]; i++) {
+    VSIUnlink(concat(dirname, "/", entries[i]).c_str());
+  }
+  CSLDestroy(entries);
+
+  if (buffer == NULL) {
+    throw CTBException("Could not read GDAL tile");
+  }
+  return singleFile;
+}
@@ -22,7 +22,10 @@
  * @brief This declares the `GDALTile` class
  */
 
+#include <vector>
+
 #include "gdal_priv.h"
+#include "cpl_string.h"
 
 #include "config.hpp"           // for CTB_DLL
 #include "Tile.hpp"
@@ -60,6 +63,9 @@ public:
   /// Detach the underlying GDAL dataset
   GDALDataset *detach();
 
+  /// Encode the tile in a GDAL format into memory, returning false for formats of several files
+  bool encode(GDALDriver *driver, const char *extension, CPLStringList &creationOptions, std::vector<unsigned char> &bytes) const;
+
 protected:
   friend class GDALTiler;
 
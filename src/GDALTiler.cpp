@@ -35,10 +35,36 @@
 
 using namespace ctb;
 
+/// Transform bounds to another spatial reference system
+static CRSBounds
+transformBounds(const CRSBounds &bounds, OGRSpatialReference &srcSRS, OGRSpatialReference &dstSRS) {
+  double x[4] = { bounds.getMinX(), bounds.getMaxX(), bounds.getMaxX(), bounds.getMinX() };
+  double y[4] = { bounds.getMinY(), bounds.getMinY(), bounds.getMaxY(), bounds.getMaxY() };
+
+  OGRCoordinateTransformation *transformer = OGRCreateCoordinateTransformation(&srcSRS, &dstSRS);
+  if (transformer == NULL) {
+    throw CTBException("The source dataset to tile grid coordinate transformation could not be created");
+  } else if (transformer->Transform(4, x, y) != true) {
+    delete transformer;
+    throw CTBException("Could not transform dataset bounds to tile spatial reference system");
+  }
+  delete transformer;
+
+  // Get the min and max values of the transformed coordinates
+  double minX = std::min(std::min(x[0], x[1]), std::min(x[2], x[3])),
+    maxX = std::max(std::max(x[0], x[1]), std::max(x[2], x[3])),
+    minY = std::min(std::min(y[0], y[1]), std::min(y[2], y[3])),
+    maxY = std::max(std::max(y[0], y[1]), std::max(y[2], y[3]));
+
+  return CRSBounds(minX, minY, maxX, maxY);
+}
+
 GDALTiler::GDALTiler(GDALDataset *poDataset, const Grid &grid, const TilerOptions &options):
   mGrid(grid),
   poDataset(poDataset),
-  options(options)
+  options(options),
+  mRegionIndexSize(0),
+  mDeepestZoom(0)
 {
 
   // Transformed bounds can give slightly different results on different threads unless mutexed
@@ -86,25 +112,7 @@ GDALTiler::GDALTiler(GDALDataset *poDataset, const Grid &grid, const TilerOption
       }
 
       // We need to transform the bounds to the grid SRS
-      double x[4] = { bounds.getMinX(), bounds.getMaxX(), bounds.getMaxX(), bounds.getMinX() };
-      double y[4] = { bounds.getMinY(), bounds.getMinY(), bounds.getMaxY(), bounds.getMaxY() };
-
-      OGRCoordinateTransformation *transformer = OGRCreateCoordinateTransformation(&srcSRS, &gridSRS);
-      if (transformer == NULL) {
-        throw CTBException("The source dataset to tile grid coordinate transformation could not be created");
-      } else if (transformer->Transform(4, x, y) != true) {
-        delete transformer;
-        throw CTBException("Could not transform dataset bounds to tile spatial reference system");
-      }
-      delete transformer;
-
-      // Get the min and max values of the transformed coordinates
-      double minX = std::min(std::min(x[0], x[1]), std::min(x[2], x[3])),
-        maxX = std::max(std::max(x[0], x[1]), std::max(x[2], x[3])),
-        minY = std::min(std::min(y[0], y[1]), std::min(y[2], y[3])),
-        maxY = std::max(std::max(y[0], y[1]), std::max(y[2], y[3]));
-
-      mBounds = CRSBounds(minX, minY, maxX, maxY); // set the bounds
+      mBounds = transformBounds(bounds, srcSRS, gridSRS); // set the bounds
       mResolution = mBounds.getWidth() / poDataset->GetRasterXSize(); // set the resolution
 
       // cache the SRS string for use in reprojections later
@@ -122,6 +130,10 @@ GDALTiler::GDALTiler(GDALDataset *poDataset, const Grid &grid, const TilerOption
       mResolution = std::abs(adfGeoTransform[1]); // use the existing dataset resolution
     }
 
+    if (options.variableDepth) {
+      readSourceRegions();
+    }
+
     poDataset->Reference();     // increase the refcount of the dataset
   }
 }
@@ -131,7 +143,11 @@ GDALTiler::GDALTiler(const GDALTiler &other):
   poDataset(other.poDataset),
   mBounds(other.mBounds),
   mResolution(other.mResolution),
-  crsWKT(other.crsWKT)
+  crsWKT(other.crsWKT),
+  mRegions(other.mRegions),
+  mRegionIndex(other.mRegionIndex),
+  mRegionIndexSize(other.mRegionIndexSize),
+  mDeepestZoom(other.mDeepestZoom)
 {
   if (poDataset != NULL) {
     poDataset->Reference();     // increase the refcount of the dataset
@@ -143,7 +159,11 @@ GDALTiler::GDALTiler(GDALTiler &other):
   poDataset(other.poDataset),
   mBounds(other.mBounds),
   mResolution(other.mResolution),
-  crsWKT(other.crsWKT)
+  crsWKT(other.crsWKT),
+  mRegions(other.mRegions),
+  mRegionIndex(other.mRegionIndex),
+  mRegionIndexSize(other.mRegionIndexSize),
+  mDeepestZoom(other.mDeepestZoom)
 {
   if (poDataset != NULL) {
     poDataset->Reference();     // increase the refcount of the dataset
@@ -164,6 +184,10 @@ GDALTiler::operator=(const GDALTiler &other) {
   mBounds = other.mBounds;
   mResolution = other.mResolution;
   crsWKT = other.crsWKT;
+  mRegions = other.mRegions;
+  mRegionIndex = other.mRegionIndex;
+  mRegionIndexSize = other.mRegionIndexSize;
+  mDeepestZoom = other.mDeepestZoom;
 
   return *this;
 }
@@ -172,6 +196,266 @@ GDALTiler::~GDALTiler() {
   closeDataset();
 }
 
+/// Get the range of cells { minX, minY, maxX, maxY } of an index overlapped by an area
+static void
+indexCells(const CRSBounds &extent, unsigned int size, const CRSBounds &area, unsigned int (&cells)[4]) {
+  const double cellWidth = extent.getWidth() / size,
+    cellHeight = extent.getHeight() / size;
+  auto clamp = [size](double cell) {
+    return (unsigned int) std::min(std::max(cell, 0.0), (double) (size - 1));
+  };
+
+  cells[0] = clamp(std::floor((area.getMinX() - extent.getMinX()) / cellWidth));
+  cells[1] = clamp(std::floor((area.getMinY() - extent.getMinY()) / cellHeight));
+  cells[2] = clamp(std::floor((area.getMaxX() - extent.getMinX()) / cellWidth));
+  cells[3] = clamp(std::floor((area.getMaxY() - extent.getMinY()) / cellHeight));
+}
+
+/**
+ * @details The maximum zoom level of a tile is that of the finest source
+ * overlapping it.  Tiles overlapping no source have a maximum zoom level of
+ * `0`.
+ */
+i_zoom
+GDALTiler::maxZoomLevel(const TileCoordinate &coord) const {
+  if (!hasVariableDepth()) {
+    return maxZoomLevel();
+  }
+
+  const CRSBounds tileBounds = mGrid.tileBounds(coord);
+  unsigned int cells[4];
+  indexCells(mBounds, mRegionIndexSize, tileBounds, cells);
+
+  i_zoom zoom = 0;
+  for (unsigned int y = cells[1]; y <= cells[3]; y++) {
+    for (unsigned int x = cells[0]; x <= cells[2]; x++) {
+      for (unsigned int i : mRegionIndex[y * mRegionIndexSize + x]) {
+        const SourceRegion &region = mRegions[i];
+
+        if (region.maxZoom > zoom && region.bounds.overlaps(tileBounds)) {
+          if ((zoom = region.maxZoom) == mDeepestZoom) {
+            return zoom;        // nothing can be finer
+          }
+        }
+      }
+    }
+  }
+
+  return zoom;
+}
+
+/**
+ * @details Extents lying within another extent are omitted, so a zoom level
+ * reached by every source has the single extent of the dataset.
+ */
+std::vector<TileBounds>
+GDALTiler::tileBoundsOfSources(i_zoom zoom) const {
+  std::vector<TileBounds> extents;
+
+  for (const SourceRegion &region : mRegions) {
+    if (region.maxZoom >= zoom) {
+      TileCoordinate ll = mGrid.crsToTile(region.bounds.getLowerLeft(), zoom),
+        ur = mGrid.crsToTile(region.bounds.getUpperRight(), zoom);
+
+      extents.push_back(TileBounds(ll, ur));
+    }
+  }
+
+  // Check the largest extents first
+  std::sort(extents.begin(), extents.end(), [](const TileBounds &a, const TileBounds &b) {
+    return (double) a.getWidth() * a.getHeight() > (double) b.getWidth() * b.getHeight();
+  });
+
+  std::vector<TileBounds> distinct;
+  for (const TileBounds &extent : extents) {
+    bool contained = false;
+
+    for (const TileBounds &other : distinct) {
+      if (other.getMinX() <= extent.getMinX() && other.getMinY() <= extent.getMinY() &&
+          other.getMaxX() >= extent.getMaxX() && other.getMaxY() >= extent.getMaxY()) {
+        contained = true;
+        break;
+      }
+    }
+    if (!contained) {
+      distinct.push_back(extent);
+    }
+  }
+
+  return distinct;
+}
+
+/**
+ * @details The warp reads the overview whose resolution is closest to, without
+ * being coarser than, that of the tile (see `getOverviewDataset`), so tiles
+ * at zoom levels coarser than every overview read the most source pixels.
+ */
+double
+GDALTiler::sourcePixelsForZoom(i_zoom zoom) const {
+  const double tileResolution = mGrid.resolution(zoom);
+  double sourceResolution = mResolution;
+
+  if (poDataset != NULL && poDataset->GetRasterCount() > 0) {
+    GDALRasterBand *poBand = poDataset->GetRasterBand(1);
+
+    for (int i = 0; i < poBand->GetOverviewCount(); i++) {
+      GDALRasterBand *poOverview = poBand->GetOverview(i);
+      if (poOverview == NULL || poOverview->GetXSize() < 1) {
+        continue;
+      }
+
+      const double resolution = mResolution * poDataset->GetRasterXSize() / poOverview->GetXSize();
+      if (resolution <= tileResolution && resolution > sourceResolution) {
+        sourceResolution = resolution;
+      }
+    }
+  }
+
+  const double pixels = mGrid.tileSize() * tileResolution / sourceResolution;
+  return pixels * pixels;
+}
+
+/**
+ * @details The bounds, in the grid SRS, are transformed to a window of source
+ * pixels padded by a pixel for the resampling kernel.  Drivers reading remote
+ * data, such as GTiff through `/vsicurl/`, then fetch the blocks of the whole
+ * window at once, merging adjacent byte ranges into single requests and
+ * issuing them in parallel, rather than block by block as the warper asks
+ * for them.  `sizeX` and `sizeY` are the size of the buffer the window will
+ * be read into, from which the driver picks an overview.  The advice is only
+ * an optimisation, so a window that cannot be worked out is ignored.
+ */
+void
+GDALTiler::adviseRead(GDALDataset *dataset, const CRSBounds &bounds, int sizeX, int sizeY) const {
+  double adfGeoTransform[6], adfInvGeoTransform[6];
+
+  if (dataset == NULL
+      || dataset->GetGeoTransform(adfGeoTransform) != CE_None
+      || !GDALInvGeoTransform(adfGeoTransform, adfInvGeoTransform)) {
+    return;
+  }
+
+  // Get the bounds in the source SRS
+  CRSBounds sourceBounds = bounds;
+  if (requiresReprojection()) {
+    OGRSpatialReference srcSRS = OGRSpatialReference(dataset->GetProjectionRef());
+    OGRSpatialReference gridSRS = mGrid.getSRS();
+
+    try {
+      sourceBounds = transformBounds(bounds, gridSRS, srcSRS);
+    } catch (CTBException &) {
+      return;
+    }
+  }
+
+  // Get the pixel window containing the corners of the bounds
+  const double x[4] = { sourceBounds.getMinX(), sourceBounds.getMaxX(), sourceBounds.getMaxX(), sourceBounds.getMinX() };
+  const double y[4] = { sourceBounds.getMinY(), sourceBounds.getMinY(), sourceBounds.getMaxY(), sourceBounds.getMaxY() };
+  double minPixel = 0, maxPixel = 0, minLine = 0, maxLine = 0;
+
+  for (int i = 0; i < 4; i++) {
+    double pixel, line;
+    GDALApplyGeoTransform(adfInvGeoTransform, x[i], y[i], &pixel, &line);
+
+    minPixel = (i == 0) ? pixel : std::min(minPixel, pixel);
+    maxPixel = (i == 0) ? pixel : std::max(maxPixel, pixel);
+    minLine = (i == 0) ? line : std::min(minLine, line);
+    maxLine = (i == 0) ? line : std::max(maxLine, line);
+  }
+
+  const int xOff = (int) std::max(std::floor(minPixel) - 1, 0.0),
+    yOff = (int) std::max(std::floor(minLine) - 1, 0.0),
+    xEnd = (int) std::min(std::ceil(maxPixel) + 1, (double) dataset->GetRasterXSize()),
+    yEnd = (int) std::min(std::ceil(maxLine) + 1, (double) dataset->GetRasterYSize());
+
+  if (xEnd <= xOff || yEnd <= yOff) {
+    return;                     // the bounds are outside the dataset
+  }
+
+  const int xSize = xEnd - xOff, ySize = yEnd - yOff;
+  dataset->AdviseRead(xOff, yOff, xSize, ySize,
+                      std::min(sizeX, xSize), std::min(sizeY, ySize),
+                      GDT_Float32, dataset->GetRasterCount(), NULL, NULL);
+}
+
+/**
+ * @details A VRT mosaic can combine sources of very different resolutions.
+ * Each source is opened to find its extent and resolution in the grid SRS,
+ * from which the maximum zoom level of its region is derived.  The sources are
+ * indexed by a grid of cells so that the sources overlapping a tile can be
+ * found quickly.  Datasets of other formats keep a uniform depth.
+ */
+void
+GDALTiler::readSourceRegions() {
+  GDALDriver *poDriver = poDataset->GetDriver();
+  if (poDriver == NULL || !EQUAL(poDriver->GetDescription(), "VRT")) {
+    return;
+  }
+
+  OGRSpatialReference gridSRS = mGrid.getSRS();
+  char **papszFiles = poDataset->GetFileList();
+
+  for (int i = 0; papszFiles != NULL && papszFiles[i] != NULL; i++) {
+    if (EQUAL(papszFiles[i], poDataset->GetDescription())) {
+      continue;                 // the VRT itself
+    }
+
+    CPLPushErrorHandler(CPLQuietErrorHandler);
+    GDALDataset *poSource = (GDALDataset *) GDALOpen(papszFiles[i], GA_ReadOnly);
+    CPLPopErrorHandler();
+
+    if (poSource == NULL) {
+      continue;                 // not a raster, e.g. an auxiliary file
+    }
+
+    double adfGeoTransform[6];
+    const char *srcWKT = poSource->GetProjectionRef();
+
+    if (poSource->GetGeoTransform(adfGeoTransform) == CE_None && strlen(srcWKT)) {
+      CRSBounds bounds(adfGeoTransform[0],
+                       adfGeoTransform[3] + (poSource->GetRasterYSize() * adfGeoTransform[5]),
+                       adfGeoTransform[0] + (poSource->GetRasterXSize() * adfGeoTransform[1]),
+                       adfGeoTransform[3]);
+      double resolution = std::abs(adfGeoTransform[1]);
+      OGRSpatialReference srcSRS = OGRSpatialReference(srcWKT);
+
+      if (!srcSRS.IsSame(&gridSRS)) {
+        try {
+          bounds = transformBounds(bounds, srcSRS, gridSRS);
+        } catch (CTBException &) {
+          GDALClose(poSource);
+          CSLDestroy(papszFiles);
+          throw;
+        }
+        resolution = bounds.getWidth() / poSource->GetRasterXSize();
+      }
+
+      SourceRegion region = { bounds, mGrid.zoomForResolution(resolution) };
+      mRegions.push_back(region);
+      mDeepestZoom = std::max(mDeepestZoom, region.maxZoom);
+    }
+
+    GDALClose(poSource);
+  }
+  CSLDestroy(papszFiles);
+
+  // Index the sources, aiming for a handful of sources in each cell
+  mRegionIndexSize = (unsigned int) std::ceil(std::sqrt((double) mRegions.size()));
+  mRegionIndexSize = std::max(1u, std::min(256u, mRegionIndexSize));
+  mRegionIndex.assign(mRegionIndexSize * mRegionIndexSize, std::vector<unsigned int>());
+
+  for (unsigned int i = 0; i < mRegions.size(); i++) {
+    unsigned int cells[4];
+    indexCells(mBounds, mRegionIndexSize, mRegions[i].bounds, cells);
+
+    for (unsigned int y = cells[1]; y <= cells[3]; y++) {
+      for (unsigned int x = cells[0]; x <= cells[2]; x++) {
+        mRegionIndex[y * mRegionIndexSize + x].push_back(i);
+      }
+    }
+  }
+}
+
 GDALTile *
 GDALTiler::createRasterTile(GDALDataset *dataset, const TileCoordinate &coord) const {
   // Convert the tile bounds into a geo transform
@@ -272,6 +556,11 @@ getOverviewDataset(GDALDatasetH hSrcDS, GDALTransformerFunc pfnTransformer, void
  */
 GDALTile *
 GDALTiler::createRasterTile(GDALDataset *dataset, double (&adfGeoTransform)[6]) const {
+  return createRasterTile(dataset, adfGeoTransform, mGrid.tileSize(), mGrid.tileSize());
+}
+
+GDALTile *
+GDALTiler::createRasterTile(GDALDataset *dataset, double (&adfGeoTransform)[6], int sizeX, int sizeY) const {
   if (dataset == NULL) {
     throw CTBException("No GDAL dataset is set");
   }
@@ -381,7 +670,7 @@ GDALTiler::createRasterTile(GDALDataset *dataset, double (&adfGeoTransform)[6])
   psWarpOptions->papszWarpOptions = warpOptions.StealList();
 
   // The raster tile is represented as a VRT dataset
-  hDstDS = GDALCreateWarpedVRT(hWrkSrcDS, mGrid.tileSize(), mGrid.tileSize(), adfGeoTransform, psWarpOptions);
+  hDstDS = GDALCreateWarpedVRT(hWrkSrcDS, sizeX, sizeY, adfGeoTransform, psWarpOptions);
 
   bool isApproxTransform = (psWarpOptions->pfnTransformer == GDALApproxTransform);
   GDALDestroyWarpOptions( psWarpOptions );
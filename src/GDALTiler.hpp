@@ -22,7 +22,9 @@
  * @brief This declares the `GDALTiler` class
  */
 
+#include <memory>
 #include <string>
+#include <vector>
 #include "gdalwarper.h"
 
 #include "TileCoordinate.hpp"
@@ -34,6 +36,9 @@ namespace ctb {
   struct TilerOptions;
   class GDALTiler;
   class GDALDatasetReader; // forward declaration
+  class GDALMappedDatasetReader;
+  class GDALCachedDatasetReader;
+  class GeoidGrid;
 }
 
 /// Options passed to a `GDALTiler`
@@ -44,6 +49,16 @@ struct ctb::TilerOptions {
   double warpMemoryLimit = 0.0; // default to GDAL internal setting
   /// The warp resampling algorithm
   GDALResampleAlg resampleAlg = GRA_Average; // recommended by GDAL maintainer
+  /// Clear the child flags of terrain tiles whose descendants would add no detail
+  bool pruneFlatTiles = false;
+  /// Limit the depth of each region of a VRT to the resolution of its source
+  bool variableDepth = false;
+  /// Remove the degenerate triangles joining the strips of meshes
+  bool optimizeMeshes = false;
+  /// Fill heights without data up to this many pixels from heights with data
+  int fillNoDataDistance = 0;   // 0 leaves holes as they are
+  /// The geoid grid converting orthometric heights to ellipsoidal heights, if any
+  std::shared_ptr<const GeoidGrid> geoid;
 };
 
 /**
@@ -88,7 +103,7 @@ public:
   operator=(const GDALTiler &other);
 
   /// The destructor
-  ~GDALTiler();
+  virtual ~GDALTiler();
 
   /// Create a tile from a tile coordinate
   virtual Tile *
@@ -97,9 +112,37 @@ public:
   /// Get the maximum zoom level for the dataset
   inline i_zoom
   maxZoomLevel() const {
-    return mGrid.zoomForResolution(resolution());
+    return hasVariableDepth() ? mDeepestZoom : mGrid.zoomForResolution(resolution());
   }
 
+  /// Get the maximum zoom level of the sources overlapping a tile
+  i_zoom
+  maxZoomLevel(const TileCoordinate &coord) const;
+
+  /// Does the resolution of the sources limit the depth of a tile?
+  inline bool
+  withinDepth(const TileCoordinate &coord) const {
+    return !hasVariableDepth() || coord.zoom <= maxZoomLevel(coord);
+  }
+
+  /// Does the maximum zoom level vary across the dataset?
+  inline bool
+  hasVariableDepth() const {
+    return !mRegions.empty();
+  }
+
+  /// Get the tile extents of the sources reaching a particular zoom level
+  std::vector<TileBounds>
+  tileBoundsOfSources(i_zoom zoom) const;
+
+  /// Estimate the number of source pixels read to create a tile at a zoom level
+  double
+  sourcePixelsForZoom(i_zoom zoom) const;
+
+  /// Advise the dataset that the source pixels of some bounds will be read
+  void
+  adviseRead(GDALDataset *dataset, const CRSBounds &bounds, int sizeX, int sizeY) const;
+
   /// Get the lower left tile for a particular zoom level
   inline TileCoordinate
   lowerLeftTile(i_zoom zoom) const {
@@ -151,12 +194,30 @@ public:
     return crsWKT.size() > 0;
   }
 
+  /// Get the bounds and resolution of the raster warped for a tile coordinate
+  virtual CRSBounds
+  rasterTileBounds(const TileCoordinate &coord, double &resolution) const {
+    resolution = mGrid.resolution(coord.zoom);
+    return mGrid.tileBounds(coord);
+  }
+
 protected:
   friend class GDALDatasetReader;
+  friend class GDALMappedDatasetReader;
+  friend class GDALCachedDatasetReader;
+
+  /// The extent and maximum zoom level of a source of the dataset
+  struct SourceRegion {
+    CRSBounds bounds;
+    i_zoom maxZoom;
+  };
 
   /// Close the underlying dataset
   void closeDataset();
 
+  /// Read the extent and resolution of each source of a VRT dataset
+  void readSourceRegions();
+
   /// Create a raster tile from a tile coordinate
   virtual GDALTile *
   createRasterTile(GDALDataset *dataset, const TileCoordinate &coord) const;
@@ -165,6 +226,10 @@ protected:
   virtual GDALTile *
   createRasterTile(GDALDataset *dataset, double (&adfGeoTransform)[6]) const;
 
+  /// Create a raster tile of a particular size from a geo transform
+  GDALTile *
+  createRasterTile(GDALDataset *dataset, double (&adfGeoTransform)[6], int sizeX, int sizeY) const;
+
   /// The grid used for generating tiles
   Grid mGrid;
 
@@ -186,6 +251,18 @@ protected:
    * reference system of the grid being used.
    */
   std::string crsWKT;
+
+  /// The sources of a variable depth dataset, empty when the depth is uniform
+  std::vector<SourceRegion> mRegions;
+
+  /// The sources overlapping each cell of an index laid over the dataset bounds
+  std::vector<std::vector<unsigned int>> mRegionIndex;
+
+  /// The number of index cells along each side of the dataset bounds
+  unsigned int mRegionIndexSize;
+
+  /// The deepest zoom level of the sources
+  i_zoom mDeepestZoom;
 };
 
 #endif /* GDALTILER_HPP */
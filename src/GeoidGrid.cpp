@@ -0,0 +1,163 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file GeoidGrid.cpp
+ * @brief This defines the `GeoidGrid` class
+ */
+
+#include <cmath>
+#include <limits>
+
+#include "gdal_priv.h"
+#include "ogr_spatialref.h"
+
+#include "CTBException.hpp"
+#include "GeoidGrid.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// The radius of the sphere of the Web Mercator projection in metres
+static const double MERCATOR_RADIUS = 6378137;
+
+/**
+ * @details The undulations without data are read as NaN so that the heights
+ * under them are left as they are.
+ */
+ctb::GeoidGrid::GeoidGrid(const char *filename) {
+  GDALDataset *poDataset = (GDALDataset *) GDALOpen(filename, GA_ReadOnly);
+  if (poDataset == NULL) {
+    throw CTBException("Could not open the geoid grid");
+  }
+
+  OGRSpatialReference srs(poDataset->GetProjectionRef());
+  if (poDataset->GetRasterCount() < 1
+      || poDataset->GetGeoTransform(mGeoTransform) != CE_None
+      || mGeoTransform[2] != 0 || mGeoTransform[4] != 0 || srs.IsProjected()) {
+    GDALClose(poDataset);
+    throw CTBException("The geoid grid must be a north up raster in geographic coordinates");
+  }
+
+  mWidth = poDataset->GetRasterXSize();
+  mHeight = poDataset->GetRasterYSize();
+  mGlobal = mWidth * mGeoTransform[1] >= 360 - mGeoTransform[1];
+  mUndulations.resize((size_t) mWidth * mHeight);
+
+  GDALRasterBand *poBand = poDataset->GetRasterBand(1);
+  if (poBand->RasterIO(GF_Read, 0, 0, mWidth, mHeight,
+                       (void *) mUndulations.data(), mWidth, mHeight, GDT_Float32,
+                       0, 0) != CE_None) {
+    GDALClose(poDataset);
+    throw CTBException("Could not read the geoid grid");
+  }
+
+  int bGotNoData = FALSE;
+  const float noData = (float) poBand->GetNoDataValue(&bGotNoData);
+  if (bGotNoData) {
+    for (float &undulation : mUndulations) {
+      if (undulation == noData) undulation = numeric_limits<float>::quiet_NaN();
+    }
+  }
+
+  GDALClose(poDataset);
+}
+
+/**
+ * @details The grids of both tile profiles are separable, the longitude of a
+ * height depending on its column alone and its latitude on its row alone.  The
+ * columns of the geoid grid and the interpolation between them are therefore
+ * found once per tile, and the undulations interpolated along a pair of geoid
+ * rows are reused by all tile rows between the two.  Each tile row is then
+ * converted in a single pass which the compiler can vectorise.  Heights
+ * without data, or outside of the geoid grid, are left as they are.
+ */
+void
+ctb::GeoidGrid::toEllipsoidal(const Grid &grid, const CRSBounds &bounds, double resolution,
+                              i_tile sizeX, i_tile sizeY, float *heights, float noData) const {
+  const bool geographic = grid.getSRS().IsGeographic();
+  const double degrees = 180 / M_PI;
+
+  // The geoid columns either side of each tile column
+  vector<int> west(sizeX), east(sizeX);
+  vector<float> eastWeight(sizeX);
+  for (i_tile i = 0; i < sizeX; i++) {
+    const double x = bounds.getMinX() + (i + 0.5) * resolution;
+    double longitude = geographic ? x : x / MERCATOR_RADIUS * degrees;
+
+    if (mGlobal) {
+      longitude = fmod(longitude - mGeoTransform[0], 360);
+      if (longitude < 0) longitude += 360;
+      longitude += mGeoTransform[0];
+    }
+
+    const double column = (longitude - mGeoTransform[0]) / mGeoTransform[1] - 0.5;
+    int column0 = (int) floor(column);
+    eastWeight[i] = (float) (column - column0);
+
+    if (mGlobal) {
+      column0 = ((column0 % mWidth) + mWidth) % mWidth;
+      west[i] = column0;
+      east[i] = (column0 + 1) % mWidth;
+    } else if (column0 >= 0 && column0 + 1 < mWidth) {
+      west[i] = column0;
+      east[i] = column0 + 1;
+    } else {
+      west[i] = east[i] = -1;   // outside of the grid
+    }
+  }
+
+  // The undulations along the geoid rows either side of a tile row
+  vector<float> north(sizeX), south(sizeX), undulations(sizeX);
+  int cachedRow = -1;
+
+  for (i_tile j = 0; j < sizeY; j++) {
+    const double y = bounds.getMaxY() - (j + 0.5) * resolution;
+    const double latitude = geographic ? y : atan(sinh(y / MERCATOR_RADIUS)) * degrees;
+    const double row = (latitude - mGeoTransform[3]) / mGeoTransform[5] - 0.5;
+    const int row0 = (int) floor(row);
+
+    if (row0 < 0 || row0 + 1 >= mHeight) {
+      continue;                 // outside of the grid
+    }
+
+    if (row0 != cachedRow) {
+      const float *northRow = &mUndulations[(size_t) row0 * mWidth],
+        *southRow = northRow + mWidth;
+
+      for (i_tile i = 0; i < sizeX; i++) {
+        if (west[i] < 0) {
+          north[i] = south[i] = numeric_limits<float>::quiet_NaN();
+        } else {
+          north[i] = northRow[west[i]] + eastWeight[i] * (northRow[east[i]] - northRow[west[i]]);
+          south[i] = southRow[west[i]] + eastWeight[i] * (southRow[east[i]] - southRow[west[i]]);
+        }
+      }
+      cachedRow = row0;
+    }
+
+    const float southWeight = (float) (row - row0);
+    float *rowHeights = heights + j * sizeX;
+
+    for (i_tile i = 0; i < sizeX; i++) {
+      undulations[i] = north[i] + southWeight * (south[i] - north[i]);
+    }
+    for (i_tile i = 0; i < sizeX; i++) {
+      const float height = rowHeights[i];
+      rowHeights[i] = (height == noData || std::isnan(undulations[i])) ? height : height + undulations[i];
+    }
+  }
+}
@@ -0,0 +1,68 @@
+#ifndef GEOIDGRID_HPP
+#define GEOIDGRID_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file GeoidGrid.hpp
+ * @brief This declares the `GeoidGrid` class
+ */
+
+#include <vector>
+
+#include "config.hpp"
+#include "types.hpp"
+#include "Bounds.hpp"
+#include "Grid.hpp"
+
+namespace ctb {
+  class GeoidGrid;
+}
+
+/**
+ * @brief The undulations of a geoid model, for converting heights between datums
+ *
+ * Most national elevation models give orthometric heights, above a geoid,
+ * whereas Cesium expects heights above the WGS84 ellipsoid.  The undulations
+ * of the geoid above the ellipsoid are read from any raster in geographic
+ * coordinates that GDAL can open (such as a GTX or GeoTIFF geoid grid) and
+ * held in memory, where they are shared read only by all tiling threads.
+ */
+class CTB_DLL ctb::GeoidGrid {
+public:
+
+  /// Read the undulations of a geoid grid
+  GeoidGrid(const char *filename);
+
+  /// Convert the orthometric heights of a tile raster to ellipsoidal heights
+  void
+  toEllipsoidal(const Grid &grid, const CRSBounds &bounds, double resolution,
+                i_tile sizeX, i_tile sizeY, float *heights, float noData) const;
+
+protected:
+
+  /// The undulations of the geoid in metres, row by row from the north
+  std::vector<float> mUndulations;
+
+  int mWidth, mHeight;
+  double mGeoTransform[6];
+
+  /// Does the grid wrap around the globe?
+  bool mGlobal;
+};
+
+#endif /* GEOIDGRID_HPP */
@@ -23,6 +23,9 @@
  */
 
 #include <iterator>
+#include <map>
+#include <vector>
+#include <algorithm>
 
 #include "TileCoordinate.hpp"
 #include "Grid.hpp"
@@ -49,6 +52,17 @@ namespace ctb {
  * By default the iterator iterates over the full extent represented by the
  * grid, but alternative extents can be passed in to the constructor, acting as
  * a spatial filter.
+ *
+ * The zoom levels can also be iterated over top-down, i.e. starting from the
+ * minimum zoom level and moving down to the maximum zoom level.  This allows the
+ * low zoom levels of a tileset to be available before the deeper levels.  Any
+ * other order of the zoom levels can be set with `GridIterator::setZoomOrder`.
+ *
+ * The tiles can be further restricted to a block of tile coordinates with
+ * `GridIterator::setTileFilter`, e.g. to build a block of a zoom level, and
+ * the tiles of a zoom level to several extents with
+ * `GridIterator::setTileExtents`, e.g. to visit only the tiles with sources
+ * fine enough for the zoom level.
  */
 class ctb::GridIterator :
   public std::iterator<std::input_iterator_tag, TileCoordinate *>
@@ -56,29 +70,35 @@ class ctb::GridIterator :
 public:
 
   /// Instantiate an iterator with a grid
-  GridIterator(const Grid &grid, i_zoom startZoom, i_zoom endZoom = 0) :
+  GridIterator(const Grid &grid, i_zoom startZoom, i_zoom endZoom = 0, bool topDown = false) :
     grid(grid),
     startZoom(startZoom),
     endZoom(endZoom),
+    topDown(topDown),
+    filtered(false),
     gridExtent(grid.getExtent()),
-    bounds(grid.getTileExtent(startZoom)),
-    currentTile(TileCoordinate(startZoom, bounds.getLowerLeft())) // the initial tile coordinate
+    bounds(grid.getTileExtent(firstZoom())),
+    currentTile(TileCoordinate(firstZoom(), bounds.getLowerLeft())), // the initial tile coordinate
+    extents(1, bounds),
+    extentIndex(0)
   {
     if (startZoom < endZoom)
       throw CTBException("Iterating from a starting zoom level that is less than the end zoom level");
   }
 
   /// Instantiate an iterator with a grid and separate bounds
-  GridIterator(const Grid &grid, const CRSBounds &extent, i_zoom startZoom, i_zoom endZoom = 0) :
+  GridIterator(const Grid &grid, const CRSBounds &extent, i_zoom startZoom, i_zoom endZoom = 0, bool topDown = false) :
     grid(grid),
     startZoom(startZoom),
     endZoom(endZoom),
+    topDown(topDown),
+    filtered(false),
     gridExtent(extent)
   {
     if (startZoom < endZoom)
       throw CTBException("Iterating from a starting zoom level that is less than the end zoom level");
 
-    currentTile.zoom = startZoom;
+    currentTile.zoom = firstZoom();
     setTileBounds();
   }
 
@@ -109,16 +129,15 @@ public:
        iterate over the next row (from bottom to top). If the rows are
        exhausted then we have iterated over that zoom level: decrease the zoom
        level and repeat the process for the new zoom level.  Do this until zoom
-       level 0 is reached.
+       level 0 is reached.  When iterating top-down the zoom level is increased
+       instead, until the start zoom level is reached.  A zoom level restricted
+       to several extents has each of them iterated over in turn.
     */
 
     if (++(currentTile.y) > bounds.getMaxY()) {
       if (++(currentTile.x) > bounds.getMaxX()) {
-        if (currentTile.zoom > endZoom) {
-          (currentTile.zoom)--;
-
-          setTileBounds();
-        }
+        ++extentIndex;
+        seekExtent();
       } else {
         currentTile.y = bounds.getMinY();
       }
@@ -141,6 +160,12 @@ public:
     return currentTile == other.currentTile
       && startZoom == other.startZoom
       && endZoom == other.endZoom
+      && topDown == other.topDown
+      && zoomOrder == other.zoomOrder
+      && filtered == other.filtered
+      && (!filtered || tileFilter == other.tileFilter)
+      && zoomExtents == other.zoomExtents
+      && extentIndex == other.extentIndex
       && bounds == other.bounds
       && gridExtent == other.gridExtent
       && grid == other.grid;
@@ -161,7 +186,7 @@ public:
   /// Return `true` if the iterator is at the end
   bool
   exhausted() const {
-    return currentTile.zoom == endZoom && currentTile.x > bounds.getMaxX() && currentTile.y > bounds.getMaxY();
+    return extentIndex >= extents.size();
   }
 
   /// Reset the iterator to a certain point
@@ -170,8 +195,81 @@ public:
     if (start < end)
       throw CTBException("Starting zoom level cannot be less than the end zoom level");
 
-    currentTile.zoom = startZoom = start;
+    startZoom = start;
     endZoom = end;
+    zoomOrder.clear();
+    currentTile.zoom = firstZoom();
+
+    setTileBounds();
+  }
+
+  /**
+   * @brief Iterate over the zoom levels in a particular order
+   *
+   * The order must contain every zoom level from the end zoom level to the
+   * start zoom level once.  The iterator is reset to the first tile of the
+   * first zoom level in the order.
+   */
+  void
+  setZoomOrder(const std::vector<i_zoom> &order) {
+    std::vector<i_zoom> sorted(order);
+    std::sort(sorted.begin(), sorted.end());
+
+    for (size_t i = 0; i < sorted.size(); ++i) {
+      if (sorted[i] != endZoom + i)
+        throw CTBException("The zoom order must contain each zoom level being iterated over once");
+    }
+    if (sorted.size() != (size_t) (startZoom - endZoom + 1))
+      throw CTBException("The zoom order must contain each zoom level being iterated over once");
+
+    zoomOrder = order;
+    currentTile.zoom = firstZoom();
+
+    setTileBounds();
+  }
+
+  /**
+   * @brief Only iterate over the tiles within a block of tile coordinates
+   *
+   * The block applies to every zoom level iterated over and must overlap the
+   * tiles of each of them.  The iterator is reset to the first tile of the
+   * first zoom level.
+   */
+  void
+  setTileFilter(const TileBounds &tiles) {
+    filtered = true;
+    tileFilter = tiles;
+    currentTile.zoom = firstZoom();
+
+    setTileBounds();
+  }
+
+  /**
+   * @brief Only iterate over the tiles of a zoom level within some extents
+   *
+   * The extents may overlap, in which case their tiles are still only
+   * iterated over once, and are clipped to the tiles of the zoom level.  No
+   * extents leave the zoom level without tiles.  The iterator is reset to the
+   * first tile of the first zoom level.
+   */
+  void
+  setTileExtents(i_zoom zoom, const std::vector<TileBounds> &tiles) {
+    std::vector<TileBounds> &distinct = zoomExtents[zoom];
+    distinct.clear();
+
+    for (const TileBounds &extent : tiles) {
+      std::vector<TileBounds> pieces(1, extent);
+
+      for (const TileBounds &other : distinct) {
+        std::vector<TileBounds> remaining;
+        for (const TileBounds &piece : pieces) {
+          subtractExtent(piece, other, remaining);
+        }
+        pieces.swap(remaining);
+      }
+      distinct.insert(distinct.end(), pieces.begin(), pieces.end());
+    }
+    currentTile.zoom = firstZoom();
 
     setTileBounds();
   }
@@ -181,16 +279,67 @@ public:
   getSize() const {
     i_tile size = 0;
     for (i_zoom zoom = endZoom; zoom <= startZoom; ++zoom) {
-      TileCoordinate ll = grid.crsToTile(gridExtent.getLowerLeft(), zoom),
-        ur = grid.crsToTile(gridExtent.getUpperRight(), zoom);
-
-      TileBounds zoomBound(ll, ur);
-      size += (zoomBound.getWidth() + 1) * (zoomBound.getHeight() + 1);
+      size += getSize(zoom);
     }
 
     return size;
   }
 
+  /// Get the number of elements in the iterator for a zoom level
+  i_tile
+  getSize(i_zoom zoom) const {
+    i_tile size = 0;
+    for (const TileBounds &extent : getTileExtents(zoom)) {
+      size += (extent.getWidth() + 1) * (extent.getHeight() + 1);
+    }
+    return size;
+  }
+
+  /// Get the tile extent iterated over for a zoom level
+  TileBounds
+  getTileBounds(i_zoom zoom) const {
+    TileCoordinate ll = grid.crsToTile(gridExtent.getLowerLeft(), zoom),
+      ur = grid.crsToTile(gridExtent.getUpperRight(), zoom);
+
+    if (filtered) {
+      return TileBounds(std::max(ll.x, tileFilter.getMinX()), std::max(ll.y, tileFilter.getMinY()),
+                        std::min(ur.x, tileFilter.getMaxX()), std::min(ur.y, tileFilter.getMaxY()));
+    }
+    return TileBounds(ll, ur);
+  }
+
+  /// Get the distinct extents of the tiles iterated over for a zoom level
+  std::vector<TileBounds>
+  getTileExtents(i_zoom zoom) const {
+    TileCoordinate ll = grid.crsToTile(gridExtent.getLowerLeft(), zoom),
+      ur = grid.crsToTile(gridExtent.getUpperRight(), zoom);
+    TileBounds zoomBounds(ll, ur);
+    std::vector<TileBounds> result;
+
+    if (filtered && !intersectExtents(zoomBounds, tileFilter, zoomBounds)) {
+      return result;
+    }
+
+    std::map<i_zoom, std::vector<TileBounds>>::const_iterator found = zoomExtents.find(zoom);
+    if (found == zoomExtents.end()) {
+      result.push_back(zoomBounds);
+    } else {
+      TileBounds clipped;
+      for (const TileBounds &extent : found->second) {
+        if (intersectExtents(extent, zoomBounds, clipped)) {
+          result.push_back(clipped);
+        }
+      }
+    }
+    return result;
+  }
+
+  /// Are the zoom levels iterated over from the lowest to the highest?
+  bool
+  isTopDown() const {
+    return topDown;
+  }
+
   /// Get the grid we are iterating over
   const Grid &
   getGrid() const {
@@ -199,25 +348,102 @@ public:
 
 protected:
 
+  /// The zoom level the iteration starts from
+  inline i_zoom
+  firstZoom() const {
+    if (!zoomOrder.empty())
+      return zoomOrder.front();
+    return topDown ? endZoom : startZoom;
+  }
+
+  /// The zoom level the iteration finishes at
+  inline i_zoom
+  lastZoom() const {
+    if (!zoomOrder.empty())
+      return zoomOrder.back();
+    return topDown ? startZoom : endZoom;
+  }
+
+  /// The zoom level iterated over after the current one
+  inline i_zoom
+  nextZoom() const {
+    if (!zoomOrder.empty())
+      return *(std::find(zoomOrder.begin(), zoomOrder.end(), currentTile.zoom) + 1);
+    return topDown ? currentTile.zoom + 1 : currentTile.zoom - 1;
+  }
+
   /// Set the tile bounds of the grid for the current zoom level
   void
   setTileBounds() {
-    TileCoordinate ll = grid.crsToTile(gridExtent.getLowerLeft(), currentTile.zoom),
-      ur = grid.crsToTile(gridExtent.getUpperRight(), currentTile.zoom);
+    extents = getTileExtents(currentTile.zoom);
+    extentIndex = 0;
+    seekExtent();
+  }
+
+  /// Move to the first tile of the current extent, or of the next zoom level with tiles
+  void
+  seekExtent() {
+    while (extentIndex >= extents.size() && currentTile.zoom != lastZoom()) {
+      currentTile.zoom = nextZoom();
+      extents = getTileExtents(currentTile.zoom);
+      extentIndex = 0;
+    }
+
+    if (extentIndex < extents.size()) {
+      // set the bounds
+      bounds = extents[extentIndex];
 
-    // set the bounds
-    bounds = TileBounds(ll, ur);
+      // set the current tile
+      currentTile.setPoint(bounds.getLowerLeft());
+    }
+  }
+
+  /// Get the overlap of two extents, returning `false` if they don't overlap
+  static bool
+  intersectExtents(const TileBounds &a, const TileBounds &b, TileBounds &result) {
+    const i_tile minX = std::max(a.getMinX(), b.getMinX()), minY = std::max(a.getMinY(), b.getMinY()),
+      maxX = std::min(a.getMaxX(), b.getMaxX()), maxY = std::min(a.getMaxY(), b.getMaxY());
+
+    if (minX > maxX || minY > maxY) {
+      return false;
+    }
+    result = TileBounds(minX, minY, maxX, maxY);
+    return true;
+  }
+
+  /// Add the parts of an extent outside of another extent to a list
+  static void
+  subtractExtent(const TileBounds &extent, const TileBounds &other, std::vector<TileBounds> &result) {
+    TileBounds overlap;
+    if (!intersectExtents(extent, other, overlap)) {
+      result.push_back(extent);
+      return;
+    }
 
-    // set the current tile
-    currentTile.setPoint(ll);
+    // The columns either side of the overlap, then the rows above and below it
+    if (extent.getMinX() < overlap.getMinX())
+      result.push_back(TileBounds(extent.getMinX(), extent.getMinY(), overlap.getMinX() - 1, extent.getMaxY()));
+    if (overlap.getMaxX() < extent.getMaxX())
+      result.push_back(TileBounds(overlap.getMaxX() + 1, extent.getMinY(), extent.getMaxX(), extent.getMaxY()));
+    if (extent.getMinY() < overlap.getMinY())
+      result.push_back(TileBounds(overlap.getMinX(), extent.getMinY(), overlap.getMaxX(), overlap.getMinY() - 1));
+    if (overlap.getMaxY() < extent.getMaxY())
+      result.push_back(TileBounds(overlap.getMinX(), overlap.getMaxY() + 1, overlap.getMaxX(), extent.getMaxY()));
   }
 
   const Grid &grid;      ///< The grid we are iterating over
   i_zoom startZoom;      ///< The starting zoom level
   i_zoom endZoom;        ///< The final zoom level
+  bool topDown;          ///< Iterate from the end zoom level up to the start zoom level?
+  std::vector<i_zoom> zoomOrder; ///< The order of the zoom levels, if not monotonic
+  bool filtered;         ///< Are the tiles restricted to `tileFilter`?
+  TileBounds tileFilter; ///< The block of tiles iterated over, if `filtered`
   CRSBounds gridExtent;  ///< The extent of the underlying grid to iterate over
-  TileBounds bounds;     ///< The extent of the currently iterated zoom level
+  TileBounds bounds;     ///< The extent of the zoom level currently iterated over
   TileCoordinate currentTile; ///< The identity of the current tile being pointed to
+  std::map<i_zoom, std::vector<TileBounds>> zoomExtents; ///< The distinct extents of the zoom levels restricted to them
+  std::vector<TileBounds> extents; ///< The extents of the current zoom level
+  size_t extentIndex;    ///< The extent of the current zoom level being iterated over
 };
 
 #endif /* GRIDITERATOR_HPP */
@@ -0,0 +1,248 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file HeightmapImage.cpp
+ * @brief This defines the `HeightmapImage` class
+ */
+
+#include <cstdlib>
+
+#include "zlib.h"
+#include "gdal_priv.h"
+
+#include "CTBException.hpp"
+#include "GDALTile.hpp"
+#include "HeightmapImage.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// The largest 24 bit colour code
+static const double MAX_CODE = 16777215;
+
+bool
+ctb::HeightmapImage::fromName(const std::string &name, HeightmapImage &image) {
+  if (name == "TerrainRGB") {
+    image = HeightmapImage(TERRAIN_RGB, PNG);
+  } else if (name == "Terrarium") {
+    image = HeightmapImage(TERRARIUM, PNG);
+  } else if (name == "TerrainRGBWebP") {
+    image = HeightmapImage(TERRAIN_RGB, WEBP);
+  } else if (name == "TerrariumWebP") {
+    image = HeightmapImage(TERRARIUM, WEBP);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @details Heights without data are encoded as 0m, which clients render as
+ * sea level.  The codes are computed in double precision, as offsetting a
+ * float height by 32768m loses the finest Terrarium steps, and the loop has
+ * no branches, so that the compiler vectorises it.
+ */
+void
+ctb::HeightmapImage::encodeColours(const float *heights, size_t count, float noData, uint32_t *codes) const {
+  const double offset = (mEncoding == TERRARIUM) ? 32768 : 10000,
+    scale = (mEncoding == TERRARIUM) ? 256 : 10;
+
+  for (size_t i = 0; i < count; i++) {
+    const float height = (heights[i] == noData || heights[i] != heights[i]) ? 0 : heights[i];
+    double code = (height + offset) * scale + 0.5;
+    code = (code < 0) ? 0 : ((code > MAX_CODE) ? MAX_CODE : code);
+    codes[i] = (uint32_t) code;
+  }
+}
+
+void
+ctb::HeightmapImage::encode(const float *heights, i_tile sizeX, i_tile sizeY, float noData,
+                            const CPLStringList &creationOptions, std::vector<unsigned char> &bytes) const {
+  vector<uint32_t> codes((size_t) sizeX * sizeY);
+  encodeColours(heights, codes.size(), noData, codes.data());
+
+  if (mFormat == WEBP) {
+    writeWebP(codes.data(), sizeX, sizeY, creationOptions, bytes);
+  } else {
+    writePNG(codes.data(), sizeX, sizeY, bytes);
+  }
+}
+
+/// Append a big endian 32 bit integer
+static void
+appendUInt32(vector<unsigned char> &bytes, uint32_t value) {
+  bytes.push_back((unsigned char) (value >> 24));
+  bytes.push_back((unsigned char) (value >> 16));
+  bytes.push_back((unsigned char) (value >> 8));
+  bytes.push_back((unsigned char) value);
+}
+
+/// Append a PNG chunk with its length and CRC
+static void
+appendChunk(vector<unsigned char> &bytes, const char *type, const unsigned char *data, size_t size) {
+  appendUInt32(bytes, (uint32_t) size);
+  const size_t start = bytes.size();
+  bytes.insert(bytes.end(), type, type + 4);
+  bytes.insert(bytes.end(), data, data + size);
+  appendUInt32(bytes, (uint32_t) crc32(0, &bytes[start], (uInt) (size + 4)));
+}
+
+/// The Paeth predictor of the PNG specification
+static inline unsigned char
+paeth(int left, int up, int upLeft) {
+  const int estimate = left + up - upLeft,
+    toLeft = abs(estimate - left), toUp = abs(estimate - up), toUpLeft = abs(estimate - upLeft);
+
+  if (toLeft <= toUp && toLeft <= toUpLeft) return (unsigned char) left;
+  return (unsigned char) ((toUp <= toUpLeft) ? up : upLeft);
+}
+
+/**
+ * @details Each row is filtered with each of the five PNG filters and the one
+ * whose bytes have the smallest sum of magnitudes is kept, which is the
+ * heuristic recommended by the PNG specification.  Neighbouring heights
+ * mostly differ in their low byte only, so the `Sub` and `Paeth` filters turn
+ * most rows into runs of small values.  The filtered rows are compressed in a
+ * single call with the strategy zlib provides for filtered image data.
+ */
+void
+ctb::HeightmapImage::writePNG(const uint32_t *codes, i_tile sizeX, i_tile sizeY, std::vector<unsigned char> &bytes) {
+  const size_t rowSize = (size_t) sizeX * 3;
+  vector<unsigned char> previous(rowSize, 0), current(rowSize);
+  vector<unsigned char> candidates[5];
+  vector<unsigned char> filtered;
+  filtered.reserve((rowSize + 1) * sizeY);
+
+  for (auto &candidate : candidates) {
+    candidate.resize(rowSize);
+  }
+
+  for (i_tile j = 0; j < sizeY; j++) {
+    const uint32_t *rowCodes = codes + (size_t) j * sizeX;
+    for (i_tile i = 0; i < sizeX; i++) {
+      current[i * 3] = (unsigned char) (rowCodes[i] >> 16);
+      current[i * 3 + 1] = (unsigned char) (rowCodes[i] >> 8);
+      current[i * 3 + 2] = (unsigned char) rowCodes[i];
+    }
+
+    // None, Sub, Up, Average and Paeth
+    unsigned long sums[5] = { 0, 0, 0, 0, 0 };
+    for (size_t k = 0; k < rowSize; k++) {
+      const int left = (k >= 3) ? current[k - 3] : 0, up = previous[k], upLeft = (k >= 3) ? previous[k - 3] : 0;
+      candidates[0][k] = current[k];
+      candidates[1][k] = (unsigned char) (current[k] - left);
+      candidates[2][k] = (unsigned char) (current[k] - up);
+      candidates[3][k] = (unsigned char) (current[k] - ((left + up) >> 1));
+      candidates[4][k] = (unsigned char) (current[k] - paeth(left, up, upLeft));
+
+      for (int f = 0; f < 5; f++) {
+        sums[f] += abs((int) (signed char) candidates[f][k]);
+      }
+    }
+
+    int best = 0;
+    for (int f = 1; f < 5; f++) {
+      if (sums[f] < sums[best]) best = f;
+    }
+
+    filtered.push_back((unsigned char) best);
+    filtered.insert(filtered.end(), candidates[best].begin(), candidates[best].end());
+    previous.swap(current);
+  }
+
+  // Compress the filtered rows
+  z_stream stream;
+  stream.zalloc = Z_NULL;
+  stream.zfree = Z_NULL;
+  stream.opaque = Z_NULL;
+  if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15, 9, Z_FILTERED) != Z_OK) {
+    throw CTBException("Could not initialize zlib");
+  }
+
+  vector<unsigned char> compressed(deflateBound(&stream, (uLong) filtered.size()));
+  stream.next_in = filtered.data();
+  stream.avail_in = (uInt) filtered.size();
+  stream.next_out = compressed.data();
+  stream.avail_out = (uInt) compressed.size();
+
+  const int ret = deflate(&stream, Z_FINISH);
+  compressed.resize(stream.total_out);
+  deflateEnd(&stream);
+  if (ret != Z_STREAM_END) {
+    throw CTBException("Could not compress the PNG image");
+  }
+
+  // The signature, header, image data and end chunks
+  static const unsigned char signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+  bytes.assign(signature, signature + 8);
+
+  vector<unsigned char> header;
+  appendUInt32(header, sizeX);
+  appendUInt32(header, sizeY);
+  header.push_back(8);          // bit depth
+  header.push_back(2);          // RGB colour
+  header.push_back(0);          // deflate compression
+  header.push_back(0);          // adaptive filtering
+  header.push_back(0);          // no interlace
+
+  appendChunk(bytes, "IHDR", header.data(), header.size());
+  appendChunk(bytes, "IDAT", compressed.data(), compressed.size());
+  appendChunk(bytes, "IEND", NULL, 0);
+}
+
+/**
+ * @details The colour codes are written to an in memory dataset, which the
+ * GDAL WEBP driver encodes losslessly unless the creation options ask
+ * otherwise.  Lossy WebP would corrupt the encoded heights.
+ */
+void
+ctb::HeightmapImage::writeWebP(const uint32_t *codes, i_tile sizeX, i_tile sizeY,
+                               const CPLStringList &creationOptions, std::vector<unsigned char> &bytes) {
+  GDALDriver *poMemDriver = GetGDALDriverManager()->GetDriverByName("MEM"),
+    *poWebPDriver = GetGDALDriverManager()->GetDriverByName("WEBP");
+  if (poMemDriver == NULL || poWebPDriver == NULL) {
+    throw CTBException("Could not retrieve the MEM and WEBP GDAL drivers");
+  }
+
+  GDALDataset *poDataset = poMemDriver->Create("", sizeX, sizeY, 3, GDT_Byte, NULL);
+  if (poDataset == NULL) {
+    throw CTBException("Could not create the in memory image dataset");
+  }
+  GDALTile tile(poDataset, NULL);
+
+  const size_t pixelCount = (size_t) sizeX * sizeY;
+  vector<unsigned char> bands(pixelCount * 3);
+  for (size_t i = 0; i < pixelCount; i++) {
+    bands[i] = (unsigned char) (codes[i] >> 16);
+    bands[pixelCount + i] = (unsigned char) (codes[i] >> 8);
+    bands[2 * pixelCount + i] = (unsigned char) codes[i];
+  }
+
+  if (poDataset->RasterIO(GF_Write, 0, 0, sizeX, sizeY, (void *) bands.data(), sizeX, sizeY, GDT_Byte,
+                          3, NULL, 0, 0, 0) != CE_None) {
+    throw CTBException("Could not write the colours to the in memory image dataset");
+  }
+
+  CPLStringList options(creationOptions);
+  if (options.FetchNameValue("LOSSLESS") == NULL) {
+    options.SetNameValue("LOSSLESS", "YES");
+  }
+
+  if (!tile.encode(poWebPDriver, "webp", options, bytes)) {
+    throw CTBException("Could not encode the WebP image");
+  }
+}
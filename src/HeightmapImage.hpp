@@ -0,0 +1,105 @@
+#ifndef HEIGHTMAPIMAGE_HPP
+#define HEIGHTMAPIMAGE_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file HeightmapImage.hpp
+ * @brief This declares the `HeightmapImage` class
+ */
+
+#include <string>
+#include <vector>
+
+#include "cpl_string.h"
+
+#include "config.hpp"
+#include "types.hpp"
+
+namespace ctb {
+  class HeightmapImage;
+}
+
+/**
+ * @brief An image format encoding heights into the colours of its pixels
+ *
+ * Web map clients such as MapLibre and deck.gl read terrain from RGB images
+ * whose colours encode a height: the Mapbox Terrain-RGB encoding in steps of
+ * 0.1m from -10000m, or the Terrarium encoding in steps of 1/256m from
+ * -32768m.  The heights are encoded straight into the pixel rows and written
+ * as PNG with a built in encoder, or as lossless WebP through GDAL.
+ */
+class CTB_DLL ctb::HeightmapImage {
+public:
+
+  /// The encoding of heights into colours
+  enum Encoding {
+    TERRAIN_RGB,                ///< height = -10000 + (R * 65536 + G * 256 + B) * 0.1
+    TERRARIUM                   ///< height = R * 256 + G + B / 256 - 32768
+  };
+
+  /// The image file format
+  enum Format {
+    PNG,
+    WEBP
+  };
+
+  HeightmapImage(Encoding encoding = TERRAIN_RGB, Format format = PNG):
+    mEncoding(encoding),
+    mFormat(format)
+  {}
+
+  /// Get the heightmap image of a format name, returning false if the name is not one
+  static bool
+  fromName(const std::string &name, HeightmapImage &image);
+
+  /// Get the file extension of the images
+  inline const char *
+  extension() const {
+    return (mFormat == WEBP) ? "webp" : "png";
+  }
+
+  /// Get the name of the GDAL driver of the image format
+  inline const char *
+  driverName() const {
+    return (mFormat == WEBP) ? "WEBP" : "PNG";
+  }
+
+  /// Encode heights into 24 bit colour codes
+  void
+  encodeColours(const float *heights, size_t count, float noData, uint32_t *codes) const;
+
+  /// Encode the heights of a tile as an image
+  void
+  encode(const float *heights, i_tile sizeX, i_tile sizeY, float noData,
+         const CPLStringList &creationOptions, std::vector<unsigned char> &bytes) const;
+
+  /// Write 24 bit colour codes as an RGB PNG image
+  static void
+  writePNG(const uint32_t *codes, i_tile sizeX, i_tile sizeY, std::vector<unsigned char> &bytes);
+
+protected:
+  /// Write 24 bit colour codes as a lossless WebP image
+  static void
+  writeWebP(const uint32_t *codes, i_tile sizeX, i_tile sizeY,
+            const CPLStringList &creationOptions, std::vector<unsigned char> &bytes);
+
+  Encoding mEncoding;
+  Format mFormat;
+};
+
+#endif /* HEIGHTMAPIMAGE_HPP */
@@ -35,23 +35,83 @@ namespace ctb {
 
 /**
  * @brief An abstract base class for a mesh of triangles
+ *
+ * The vertices are either stored as CRS coordinates in `vertices` or, for a
+ * mesh created from the regular grid of heights of a tile, compactly as grid
+ * positions in `gridVertices`.  In the latter case the CRS coordinates are
+ * derived on demand by `vertex()`.
  */
 class ctb::Mesh
 {
 public:
 
+  /// A vertex positioned on the grid of a tile
+  struct GridVertex {
+    uint16_t x;                 ///< The grid column, from the west
+    uint16_t y;                 ///< The grid row, from the north
+    float height;               ///< The height of the vertex
+
+    GridVertex(uint16_t x, uint16_t y, float height):
+      x(x), y(y), height(height) {}
+  };
+
   /// Create an empty mesh
-  Mesh()
+  Mesh():
+    mGridSizeX(0),
+    mGridSizeY(0),
+    mCellSizeX(0),
+    mCellSizeY(0)
   {}
 
 public:
 
-  /// The array of shared vertices of a mesh
+  /// The array of shared vertices of a mesh in CRS coordinates
   std::vector<CRSVertex> vertices;
 
+  /// The array of shared vertices of a mesh as grid positions
+  std::vector<GridVertex> gridVertices;
+
   /// The index collection for each triangle in the mesh (3 for each triangle)
   std::vector<uint32_t> indices;
 
+  /// Use `gridVertices` on a grid of `sizeX` x `sizeY` points covering `bounds`
+  void setGrid(const CRSBounds &bounds, i_tile sizeX, i_tile sizeY) {
+    mGridBounds = bounds;
+    mGridSizeX = sizeX;
+    mGridSizeY = sizeY;
+    mCellSizeX = (bounds.getMaxX() - bounds.getMinX()) / (double)(sizeX - 1);
+    mCellSizeY = (bounds.getMaxY() - bounds.getMinY()) / (double)(sizeY - 1);
+  }
+
+  /// Are the vertices stored as grid positions?
+  bool hasGridVertices() const {
+    return mGridSizeX > 0;
+  }
+
+  /// The number of vertices in the mesh
+  size_t vertexCount() const {
+    return hasGridVertices() ? gridVertices.size() : vertices.size();
+  }
+
+  /// Get the CRS coordinates of a grid position
+  CRSVertex gridToCRS(const GridVertex &vertex) const {
+    return CRSVertex(mGridBounds.getMinX() + (vertex.x * mCellSizeX),
+                     mGridBounds.getMaxY() - (vertex.y * mCellSizeY),
+                     vertex.height);
+  }
+
+  /// Get the CRS coordinates of a vertex
+  CRSVertex vertex(size_t index) const {
+    return hasGridVertices() ? gridToCRS(gridVertices[index]) : vertices[index];
+  }
+
+  /// Remove all vertices and triangles
+  void clear() {
+    vertices.clear();
+    gridVertices.clear();
+    indices.clear();
+  }
+
   /// Write mesh data to a WKT file
   void writeWktFile(const char *fileName) const {
     FILE *fp = fopen(fileName, "w");
@@ -64,9 +124,9 @@ public:
     memset(wktText, 0, sizeof(wktText));
 
     for (int i = 0, icount = indices.size(); i < icount; i += 3) {
-      CRSVertex v0 = vertices[indices[i]];
-      CRSVertex v1 = vertices[indices[i+1]];
-      CRSVertex v2 = vertices[indices[i+2]];
+      CRSVertex v0 = vertex(indices[i]);
+      CRSVertex v1 = vertex(indices[i+1]);
+      CRSVertex v2 = vertex(indices[i+2]);
 
       sprintf(wktText, "(%.8f %.8f %f, %.8f %.8f %f, %.8f %.8f %f, %.8f %.8f %f)",
         v0.x, v0.y, v0.z,
@@ -77,6 +137,11 @@ public:
     }
     fclose(fp);
   };
+
+protected:
+  CRSBounds mGridBounds;        ///< The extent covered by the grid
+  i_tile mGridSizeX, mGridSizeY; ///< The number of grid points in each direction
+  double mCellSizeX, mCellSizeY; ///< The distance between grid points
 };
 
 #endif /* CTBMESH_HPP */
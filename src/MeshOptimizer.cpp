@@ -0,0 +1,80 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file MeshOptimizer.cpp
+ * @brief This defines the `MeshOptimizer` class
+ */
+
+#include <limits>
+
+#include "MeshOptimizer.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/**
+ * @details The triangles are compacted in place, keeping their order and
+ * winding, and the vertices are then renumbered and compacted in the order
+ * that the remaining triangles first use them.
+ */
+void
+MeshOptimizer::optimize(Mesh &mesh) {
+  vector<uint32_t> &indices = mesh.indices;
+  size_t count = 0;
+
+  for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+    const uint32_t a = indices[i], b = indices[i + 1], c = indices[i + 2];
+    if (a == b || b == c || a == c) {
+      continue;                 // a degenerate triangle
+    }
+    indices[count++] = a;
+    indices[count++] = b;
+    indices[count++] = c;
+  }
+  indices.resize(count);
+
+  // Number the vertices in the order the triangles first use them
+  const uint32_t unset = numeric_limits<uint32_t>::max();
+  vector<uint32_t> order(mesh.vertexCount(), unset);
+  uint32_t next = 0;
+
+  for (uint32_t &index : indices) {
+    if (order[index] == unset) {
+      order[index] = next++;
+    }
+    index = order[index];
+  }
+
+  if (mesh.hasGridVertices()) {
+    // Grid vertices have no default, so the vector is filled before being permuted
+    vector<Mesh::GridVertex> vertices;
+    vertices.reserve(next);
+    for (size_t i = 0; i < order.size(); i++) {
+      if (order[i] != unset) vertices.push_back(mesh.gridVertices[i]);
+    }
+    for (size_t i = 0; i < order.size(); i++) {
+      if (order[i] != unset) vertices[order[i]] = mesh.gridVertices[i];
+    }
+    mesh.gridVertices.swap(vertices);
+  } else {
+    vector<CRSVertex> vertices(next);
+    for (size_t i = 0; i < order.size(); i++) {
+      if (order[i] != unset) vertices[order[i]] = mesh.vertices[i];
+    }
+    mesh.vertices.swap(vertices);
+  }
+}
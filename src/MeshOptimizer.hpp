@@ -0,0 +1,56 @@
+#ifndef MESHOPTIMIZER_HPP
+#define MESHOPTIMIZER_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file MeshOptimizer.hpp
+ * @brief This declares the `MeshOptimizer` class
+ */
+
+#include <cstdint>
+#include <vector>
+
+#include "config.hpp"
+#include "Mesh.hpp"
+
+namespace ctb {
+  class MeshOptimizer;
+}
+
+/**
+ * @brief Removes the redundant triangles and vertices of a mesh
+ *
+ * The chunker emits each tile as triangle strips, joining the strips with
+ * degenerate triangles, having two or three vertices the same, which cover no
+ * area and are dropped by the renderer.  A quantized mesh is a triangle list,
+ * so these are written for nothing: they are removed, along with any vertices
+ * that only they use, and the vertices are numbered in the order that the
+ * triangles first use them as the high water mark encoding of the indices
+ * requires.  The order of the strips, which follows the surface of the tile
+ * and suits both the vertex cache and the compression of the vertex deltas,
+ * is kept.
+ */
+class CTB_DLL ctb::MeshOptimizer {
+public:
+
+  /// Remove the degenerate triangles and unused vertices of a mesh in place
+  static void
+  optimize(Mesh &mesh);
+};
+
+#endif /* MESHOPTIMIZER_HPP */
@@ -21,6 +21,8 @@
  */
 
 #include <cmath>
+#include <climits>
+#include <limits>
 #include <vector>
 #include <map>
 #include "cpl_conv.h"
@@ -116,16 +118,43 @@ static inline int quantizeIndices(const double &origin, const double &factor, co
   return int(std::round((value - origin) * factor));
 }
 
-// Write the edge indices of the mesh
-template <typename T> int writeEdgeIndices(CTBOutputStream &ostream, const Mesh &mesh, double edgeCoord, int componentIndex) {
+// Quantize an exact grid offset within a grid range to 0..SHORT_MAX, rounding half up
+static inline int quantizeGridIndices(int offset, int range) {
+  return range ? int((2 * int64_t(offset) * int64_t(SHORT_MAX) + range) / (2 * int64_t(range))) : 0;
+}
+
+// The extent of the grid positions and heights of a mesh
+struct GridExtent {
+  int minX, minY, maxX, maxY;
+  float minHeight, maxHeight;
+
+  GridExtent(const Mesh &mesh):
+    minX(INT_MAX), minY(INT_MAX), maxX(INT_MIN), maxY(INT_MIN),
+    minHeight(std::numeric_limits<float>::infinity()),
+    maxHeight(-std::numeric_limits<float>::infinity())
+  {
+    for (size_t i = 0, icount = mesh.gridVertices.size(); i < icount; i++) {
+      const Mesh::GridVertex &vertex = mesh.gridVertices[i];
+
+      if (vertex.x < minX) minX = vertex.x;
+      if (vertex.y < minY) minY = vertex.y;
+      if (vertex.x > maxX) maxX = vertex.x;
+      if (vertex.y > maxY) maxY = vertex.y;
+      if (vertex.height < minHeight) minHeight = vertex.height;
+      if (vertex.height > maxHeight) maxHeight = vertex.height;
+    }
+  }
+};
+
+// Write the edge indices of the mesh, being those of the vertices on the edge
+template <typename T, typename OnEdge> int writeEdgeIndices(CTBOutputStream &ostream, const Mesh &mesh, OnEdge onEdge) {
   std::vector<uint32_t> indices;
   std::map<uint32_t, size_t> ihash;
 
   for (size_t i = 0, icount = mesh.indices.size(); i < icount; i++) {
     uint32_t indice = mesh.indices[i];
-    double val = mesh.vertices[indice][componentIndex];
 
-    if (val == edgeCoord) {
+    if (onEdge(indice)) {
       std::map<uint32_t, size_t>::iterator it = ihash.find(indice);
 
       if (it == ihash.end()) {
@@ -145,6 +174,27 @@ template <typename T> int writeEdgeIndices(CTBOutputStream &ostream, const Mesh
   return indices.size();
 }
 
+// Write all vertices on the edge of the tile (W, S, E, N)
+template <typename T> void writeEdges(CTBOutputStream &ostream, const Mesh &mesh, const BoundingBox<double> &bounds) {
+  if (mesh.hasGridVertices()) {
+    // Grid rows increase southwards
+    const GridExtent extent(mesh);
+    const std::vector<Mesh::GridVertex> &vertices = mesh.gridVertices;
+
+    writeEdgeIndices<T>(ostream, mesh, [&](uint32_t i) { return vertices[i].x == extent.minX; });
+    writeEdgeIndices<T>(ostream, mesh, [&](uint32_t i) { return vertices[i].y == extent.maxY; });
+    writeEdgeIndices<T>(ostream, mesh, [&](uint32_t i) { return vertices[i].x == extent.maxX; });
+    writeEdgeIndices<T>(ostream, mesh, [&](uint32_t i) { return vertices[i].y == extent.minY; });
+  } else {
+    const std::vector<CRSVertex> &vertices = mesh.vertices;
+
+    writeEdgeIndices<T>(ostream, mesh, [&](uint32_t i) { return vertices[i].x == bounds.min.x; });
+    writeEdgeIndices<T>(ostream, mesh, [&](uint32_t i) { return vertices[i].y == bounds.min.y; });
+    writeEdgeIndices<T>(ostream, mesh, [&](uint32_t i) { return vertices[i].x == bounds.max.x; });
+    writeEdgeIndices<T>(ostream, mesh, [&](uint32_t i) { return vertices[i].y == bounds.max.y; });
+  }
+}
+
 // ZigZag-Encodes a number (-1 = 1, -2 = 3, 0 = 0, 1 = 2, 2 = 4)
 static inline uint16_t zigZagEncode(int n) {
   return (n << 1) ^ (n >> 31);
@@ -223,14 +273,21 @@ MeshTile::writeFile(CTBOutputStream &ostream, bool writeVertexNormals) const {
   BoundingBox<double> cartesianBounds;
   BoundingBox<double> bounds;
 
-  cartesianVertices.resize(mMesh.vertices.size());
-  for (size_t i = 0, icount = mMesh.vertices.size(); i < icount; i++) {
-    const CRSVertex &vertex = mMesh.vertices[i];
+  cartesianVertices.resize(mMesh.vertexCount());
+  for (size_t i = 0, icount = mMesh.vertexCount(); i < icount; i++) {
+    const CRSVertex vertex = mMesh.vertex(i);
     cartesianVertices[i] = LLH2ECEF(vertex);
   }
   cartesianBoundingSphere.fromPoints(cartesianVertices);
   cartesianBounds.fromPoints(cartesianVertices);
-  bounds.fromPoints(mMesh.vertices);
+
+  if (mMesh.hasGridVertices()) {
+    const GridExtent extent(mMesh);
+    bounds.min = mMesh.gridToCRS(Mesh::GridVertex(extent.minX, extent.maxY, extent.minHeight));
+    bounds.max = mMesh.gridToCRS(Mesh::GridVertex(extent.maxX, extent.minY, extent.maxHeight));
+  } else {
+    bounds.fromPoints(mMesh.vertices);
+  }
 
 
   // # Write the mesh header data:
@@ -269,24 +326,55 @@ MeshTile::writeFile(CTBOutputStream &ostream, bool writeVertexNormals) const {
 
 
   // # Write mesh vertices (X Y Z components of each vertex):
-  int vertexCount = mMesh.vertices.size();
+  int vertexCount = mMesh.vertexCount();
   ostream.write(&vertexCount, sizeof(int));
-  for (int c = 0; c < 3; c++) {
-    double origin = bounds.min[c];
+  if (mMesh.hasGridVertices()) {
+    // The u and v values are exact integer ratios of the grid positions
+    const GridExtent extent(mMesh);
+    const std::vector<Mesh::GridVertex> &vertices = mMesh.gridVertices;
     double factor = 0;
-    if (bounds.max[c] > bounds.min[c]) factor = SHORT_MAX / (bounds.max[c] - bounds.min[c]);
-
-    // Move the initial value
-    int u0 = quantizeIndices(origin, factor, mMesh.vertices[0][c]), u1, ud;
-    uint16_t sval = zigZagEncode(u0);
-    ostream.write(&sval, sizeof(uint16_t));
-
-    for (size_t i = 1, icount = mMesh.vertices.size(); i < icount; i++) {
-      u1 = quantizeIndices(origin, factor, mMesh.vertices[i][c]);
-      ud = u1 - u0;
-      sval = zigZagEncode(ud);
+    if (extent.maxHeight > extent.minHeight) factor = SHORT_MAX / ((double) extent.maxHeight - extent.minHeight);
+
+    for (int c = 0; c < 3; c++) {
+      int u0 = 0, u1;
+
+      for (size_t i = 0; i < vertices.size(); i++) {
+        const Mesh::GridVertex &vertex = vertices[i];
+
+        switch (c) {
+        case 0:
+          u1 = quantizeGridIndices(vertex.x - extent.minX, extent.maxX - extent.minX);
+          break;
+        case 1:
+          u1 = quantizeGridIndices(extent.maxY - vertex.y, extent.maxY - extent.minY);
+          break;
+        default:
+          u1 = quantizeIndices(extent.minHeight, factor, vertex.height);
+        }
+
+        uint16_t sval = zigZagEncode(u1 - u0);
+        ostream.write(&sval, sizeof(uint16_t));
+        u0 = u1;
+      }
+    }
+  } else {
+    for (int c = 0; c < 3; c++) {
+      double origin = bounds.min[c];
+      double factor = 0;
+      if (bounds.max[c] > bounds.min[c]) factor = SHORT_MAX / (bounds.max[c] - bounds.min[c]);
+
+      // Move the initial value
+      int u0 = quantizeIndices(origin, factor, mMesh.vertices[0][c]), u1, ud;
+      uint16_t sval = zigZagEncode(u0);
       ostream.write(&sval, sizeof(uint16_t));
-      u0 = u1;
+
+      for (size_t i = 1, icount = mMesh.vertices.size(); i < icount; i++) {
+        u1 = quantizeIndices(origin, factor, mMesh.vertices[i][c]);
+        ud = u1 - u0;
+        sval = zigZagEncode(ud);
+        ostream.write(&sval, sizeof(uint16_t));
+        u0 = u1;
+      }
     }
   }
 
@@ -305,10 +393,7 @@ MeshTile::writeFile(CTBOutputStream &ostream, bool writeVertexNormals) const {
     }
 
     // Write all vertices on the edge of the tile (W, S, E, N)
-    writeEdgeIndices<uint32_t>(ostream, mMesh, bounds.min.x, 0);
-    writeEdgeIndices<uint32_t>(ostream, mMesh, bounds.min.y, 1);
-    writeEdgeIndices<uint32_t>(ostream, mMesh, bounds.max.x, 0);
-    writeEdgeIndices<uint32_t>(ostream, mMesh, bounds.max.y, 1);
+    writeEdges<uint32_t>(ostream, mMesh, bounds);
   }
   else {
     uint16_t highest = 0;
@@ -322,10 +407,7 @@ MeshTile::writeFile(CTBOutputStream &ostream, bool writeVertexNormals) const {
     }
 
     // Write all vertices on the edge of the tile (W, S, E, N)
-    writeEdgeIndices<uint16_t>(ostream, mMesh, bounds.min.x, 0);
-    writeEdgeIndices<uint16_t>(ostream, mMesh, bounds.min.y, 1);
-    writeEdgeIndices<uint16_t>(ostream, mMesh, bounds.max.x, 0);
-    writeEdgeIndices<uint16_t>(ostream, mMesh, bounds.max.y, 1);
+    writeEdges<uint16_t>(ostream, mMesh, bounds);
   }
 
   // # Write 'Oct-Encoded Per-Vertex Normals' for Terrain Lighting:
@@ -20,9 +20,12 @@
  * @author Alvaro Huarte <ahuarte47@yahoo.es>
  */
 
+#include <mutex>
+
 #include "CTBException.hpp"
 #include "MeshTiler.hpp"
 #include "HeightFieldChunker.hpp"
+#include "MeshOptimizer.hpp"
 #include "GDALDatasetReader.hpp"
 
 using namespace ctb;
@@ -34,10 +37,7 @@ using namespace ctb;
  */
 class WrapperMesh : public ctb::chunk::mesh {
 private:
-  CRSBounds &mBounds;
   Mesh &mMesh;
-  double mCellSizeX;
-  double mCellSizeY;
 
   std::map<int, int> mIndicesMap;
   Coordinate<int> mTriangles[3];
@@ -47,16 +47,14 @@ private:
 public:
   WrapperMesh(CRSBounds &bounds, Mesh &mesh, i_tile tileSizeX, i_tile tileSizeY):
     mMesh(mesh),
-    mBounds(bounds),
     mTriOddOrder(false),
     mTriIndex(0) {
-    mCellSizeX = (bounds.getMaxX() - bounds.getMinX()) / (double)(tileSizeX - 1);
-    mCellSizeY = (bounds.getMaxY() - bounds.getMinY()) / (double)(tileSizeY - 1);
+    // Store the vertices compactly as positions on the grid of heights
+    mMesh.setGrid(bounds, tileSizeX, tileSizeY);
   }
 
   virtual void clear() {
-    mMesh.vertices.clear();
-    mMesh.indices.clear();
+    mMesh.clear();
     mIndicesMap.clear();
     mTriOddOrder = false;
     mTriIndex = 0;
@@ -93,13 +91,9 @@ public:
     std::map<int, int>::iterator it = mIndicesMap.find(index);
 
     if (it == mIndicesMap.end()) {
-      iv = mMesh.vertices.size();
-
-      double xmin = mBounds.getMinX();
-      double ymax = mBounds.getMaxY();
-      double height = heightfield.height(x, y);
+      iv = mMesh.gridVertices.size();
 
-      mMesh.vertices.push_back(CRSVertex(xmin + (x * mCellSizeX), ymax - (y * mCellSizeY), height));
+      mMesh.gridVertices.push_back(Mesh::GridVertex(x, y, heightfield.height(x, y)));
       mIndicesMap.insert(std::make_pair(index, iv));
     }
     else {
@@ -109,40 +103,82 @@ public:
   }
 };
 
+/**
+ * Get the mesh of a tile of constant height
+ *
+ * The chunker reduces a tile of constant height to the same pair of triangles
+ * whatever the height, so this is created once for each tile size and the
+ * heights of its vertices are set as required.
+ */
+static const Mesh &
+flatMesh(i_tile tileSize) {
+  static std::map<i_tile, Mesh> meshes;
+  static std::mutex mutex;
+  std::lock_guard<std::mutex> lock(mutex);
+
+  std::map<i_tile, Mesh>::iterator it = meshes.find(tileSize);
+  if (it == meshes.end()) {
+    std::vector<float> heights(tileSize * tileSize, 0);
+    CRSBounds bounds(0, 0, 1, 1);
+    Mesh &flat = meshes[tileSize];
+
+    ctb::chunk::heightfield heightfield(heights.data(), tileSize);
+    heightfield.applyGeometricError(1.0, false);
+    WrapperMesh mesh(bounds, flat, tileSize, tileSize);
+    heightfield.generateMesh(mesh, 0);
+    heightfield.clear();
+
+    return flat;
+  }
+  return it->second;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 
 void 
 ctb::MeshTiler::prepareSettingsOfTile(MeshTile *terrainTile, const TileCoordinate &coord, float *rasterHeights, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) const {
   const ctb::i_tile TILE_SIZE = tileSizeX;
 
-  // Number of tiles in the horizontal direction at tile level zero.
-  double resolutionAtLevelZero = mGrid.resolution(0);
-  int numberOfTilesAtLevelZero = (int)(mGrid.getExtent().getWidth() / (tileSizeX * resolutionAtLevelZero));
-  // Default quality of terrain created from heightmaps (TerrainProvider.js).
-  double heightmapTerrainQuality = 0.25;
-  // Earth semi-major-axis in meters.
-  const double semiMajorAxis = 6378137.0;
-  // Appropriate geometric error estimate when the geometry comes from a heightmap (TerrainProvider.js).
-  double maximumGeometricError = MeshTiler::getEstimatedLevelZeroGeometricErrorForAHeightmap(
-    semiMajorAxis,
-    heightmapTerrainQuality * mMeshQualityFactor,
-    TILE_SIZE,
-    numberOfTilesAtLevelZero
-  );
   // Geometric error for current Level.
-  maximumGeometricError /= (double)(1 << coord.zoom);
-
-  // Convert the raster grid into an irregular mesh applying the Chunked LOD strategy by 'Thatcher Ulrich'.
-  // http://tulrich.com/geekstuff/chunklod.html
-  //
-  ctb::chunk::heightfield heightfield(rasterHeights, TILE_SIZE);
-  heightfield.applyGeometricError(maximumGeometricError, coord.zoom <= 6);
-  //
+  double maximumGeometricError = levelGeometricError(coord.zoom, TILE_SIZE);
+
   ctb::CRSBounds mGridBounds = mGrid.tileBounds(coord);
   Mesh &tileMesh = terrainTile->getMesh();
-  WrapperMesh mesh(mGridBounds, tileMesh, tileSizeX, tileSizeY);
-  heightfield.generateMesh(mesh, 0);
-  heightfield.clear();
+  const bool smoothSmallZooms = coord.zoom <= 6;
+
+  float minHeight, maxHeight;
+  heightRange(rasterHeights, tileSizeX * tileSizeY, minHeight, maxHeight);
+
+  if (minHeight == maxHeight && !smoothSmallZooms) {
+    // A tile of constant height doesn't need chunking
+    const Mesh &flat = flatMesh(TILE_SIZE);
+
+    tileMesh.setGrid(mGridBounds, tileSizeX, tileSizeY);
+    tileMesh.gridVertices = flat.gridVertices;
+    tileMesh.indices = flat.indices;
+    for (size_t i = 0; i < tileMesh.gridVertices.size(); i++) {
+      tileMesh.gridVertices[i].height = minHeight;
+    }
+  } else {
+    // Convert the raster grid into an irregular mesh applying the Chunked LOD strategy by 'Thatcher Ulrich'.
+    // http://tulrich.com/geekstuff/chunklod.html
+    //
+    ctb::chunk::heightfield heightfield(rasterHeights, TILE_SIZE);
+    heightfield.applyGeometricError(maximumGeometricError, smoothSmallZooms);
+    //
+    WrapperMesh mesh(mGridBounds, tileMesh, tileSizeX, tileSizeY);
+    heightfield.generateMesh(mesh, 0);
+    heightfield.clear();
+  }
+
+  if (options.optimizeMeshes) {
+    MeshOptimizer::optimize(tileMesh);
+  }
+
+  // A tiler without a dataset leaves the child flags to its caller
+  if (poDataset == NULL) {
+    return;
+  }
 
   // If we are not at the maximum zoom level we need to set child flags on the
   // tile where child tiles overlap the dataset bounds.
@@ -166,6 +202,11 @@ ctb::MeshTiler::prepareSettingsOfTile(MeshTile *terrainTile, const TileCoordinat
       }
     }
   }
+
+  // Children are only created where the sources have the detail for them
+  if (hasVariableDepth() && coord.zoom != maxZoomLevel()) {
+    clearChildrenBeyondDepth(coord, terrainTile);
+  }
 }
 
 MeshTile *
@@ -186,10 +227,17 @@ ctb::MeshTiler::createMesh(GDALDataset *dataset, const TileCoordinate &coord, ct
   // Copy the raster data into an array
   float *rasterHeights = reader->readRasterHeights(dataset, coord, mGrid.tileSize(), mGrid.tileSize());
 
+  MeshTile *terrainTile = createMesh(coord, rasterHeights);
+  CPLFree(rasterHeights);
+
+  return terrainTile;
+}
+
+MeshTile *
+ctb::MeshTiler::createMesh(const TileCoordinate &coord, float *rasterHeights) const {
   // Get a mesh tile represented by the tile coordinate
   MeshTile *terrainTile = new MeshTile(coord);
   prepareSettingsOfTile(terrainTile, coord, rasterHeights, mGrid.tileSize(), mGrid.tileSize());
-  CPLFree(rasterHeights);
 
   return terrainTile;
 }
@@ -200,14 +248,3 @@ ctb::MeshTiler::operator=(const MeshTiler &other) {
 
   return *this;
 }
-
-double ctb::MeshTiler::getEstimatedLevelZeroGeometricErrorForAHeightmap(
-  double maximumRadius,
-  double heightmapTerrainQuality,
-  int tileWidth,
-  int numberOfTilesAtLevelZero)
-{
-  double error = maximumRadius * 2 * M_PI * heightmapTerrainQuality;
-  error /= (double)(tileWidth * numberOfTilesAtLevelZero);
-  return error;
-}
@@ -68,17 +68,20 @@ public:
   MeshTile *
   createMesh(GDALDataset *dataset, const TileCoordinate &coord, GDALDatasetReader *reader) const;
 
+  /// Create a mesh from the heights already read for a tile coordinate at the grid tile size
+  MeshTile *
+  createMesh(const TileCoordinate &coord, float *rasterHeights) const;
+
 protected:
 
   // Specifies the factor of the quality to convert terrain heightmaps to meshes.
   double mMeshQualityFactor;
 
-  // Determines an appropriate geometric error estimate when the geometry comes from a heightmap.
-  static double getEstimatedLevelZeroGeometricErrorForAHeightmap(
-    double maximumRadius, 
-    double heightmapTerrainQuality, 
-    int tileWidth, 
-    int numberOfTilesAtLevelZero);
+  /// The quality of terrain created from heightmaps, scaled by the mesh quality factor
+  virtual double
+  heightmapTerrainQuality() const override {
+    return TerrainTiler::heightmapTerrainQuality() * mMeshQualityFactor;
+  }
 
   /// Assigns settings of Tile just to use.
   void prepareSettingsOfTile(MeshTile *tile, const TileCoordinate &coord, float *rasterHeights, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) const;
@@ -50,8 +50,8 @@ public:
   {}
 
   /// The target constructor
-  RasterIterator(const RasterTiler &tiler, i_zoom startZoom, i_zoom endZoom):
-    TilerIterator(tiler, startZoom, endZoom)
+  RasterIterator(const RasterTiler &tiler, i_zoom startZoom, i_zoom endZoom, bool topDown = false):
+    TilerIterator(tiler, startZoom, endZoom, topDown)
   {}
 
   virtual GDALTile *
@@ -48,8 +48,8 @@ public:
   {}
 
   /// The target constructor
-  TerrainIterator(const TerrainTiler &tiler, i_zoom startZoom, i_zoom endZoom):
-    TilerIterator(tiler, startZoom, endZoom)
+  TerrainIterator(const TerrainTiler &tiler, i_zoom startZoom, i_zoom endZoom, bool topDown = false):
+    TilerIterator(tiler, startZoom, endZoom, topDown)
   {}
 
   virtual TerrainTile *
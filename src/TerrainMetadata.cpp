@@ -0,0 +1,176 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TerrainMetadata.cpp
+ * @brief This defines the `TerrainMetadata` class
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#include "CTBException.hpp"
+#include "TerrainMetadata.hpp"
+
+using namespace std;
+using namespace ctb;
+
+void
+ctb::TerrainMetadata::add(const Grid &grid, const TileCoordinate *coordinate) {
+  CRSBounds tileBounds = grid.tileBounds(*coordinate);
+  i_zoom zoom = coordinate->zoom;
+
+  if ((1 + zoom) > levels.size()) {
+    for (size_t i = 0; i <= zoom; i++) {
+      levels.push_back(LevelInfo());
+    }
+  }
+  LevelInfo &level = levels[zoom];
+  level.add(coordinate);
+
+  if (bounds.getMaxX() == bounds.getMinX()) {
+    bounds = tileBounds;
+  }
+  else {
+    bounds.setMinX(std::min(bounds.getMinX(), tileBounds.getMinX()));
+    bounds.setMinY(std::min(bounds.getMinY(), tileBounds.getMinY()));
+    bounds.setMaxX(std::max(bounds.getMaxX(), tileBounds.getMaxX()));
+    bounds.setMaxY(std::max(bounds.getMaxY(), tileBounds.getMaxY()));
+  }
+}
+
+void
+ctb::TerrainMetadata::setAvailable(const GDALTiler &tiler, i_zoom startZoom) {
+  if (tiler.hasVariableDepth() && sources.empty()) {
+    for (i_zoom zoom = 0; zoom <= startZoom; zoom++) {
+      sources.push_back(tiler.tileBoundsOfSources(zoom));
+    }
+  }
+}
+
+void
+ctb::TerrainMetadata::add(const TerrainMetadata &otherMetadata) {
+  if (sources.empty()) {
+    sources = otherMetadata.sources;
+  }
+  if (otherMetadata.levels.size() > 0) {
+    const CRSBounds &otherBounds = otherMetadata.bounds;
+
+    for (size_t i = 0, icount = (otherMetadata.levels.size() - levels.size()); i < icount; i++) {
+      levels.push_back(LevelInfo());
+    }
+    for (size_t i = 0; i < levels.size(); i++) {
+      levels[i].add(otherMetadata.levels[i]);
+    }
+
+    bounds.setMinX(std::min(bounds.getMinX(), otherBounds.getMinX()));
+    bounds.setMinY(std::min(bounds.getMinY(), otherBounds.getMinY()));
+    bounds.setMaxX(std::max(bounds.getMaxX(), otherBounds.getMaxX()));
+    bounds.setMaxY(std::max(bounds.getMaxY(), otherBounds.getMaxY()));
+  }
+}
+
+/**
+ * @details The format of the file is described at
+ * http://help.agi.com/TerrainServer/RESTAPIGuide.html, for example
+ * https://assets.agi.com/stk-terrain/v1/tilesets/world/tiles/layer.json
+ */
+void
+ctb::TerrainMetadata::writeJsonFile(const std::string &filename, const std::string &datasetName, const std::string &outputFormat,
+                                    const std::string &profile, bool writeVertexNormals, bool writeAvailable) const {
+  FILE *fp = fopen(filename.c_str(), "w");
+
+  if (fp == NULL) {
+    throw CTBException("Failed to open metadata file");
+  }
+
+  fprintf(fp, "{\n");
+  fprintf(fp, "  \"tilejson\": \"2.1.0\",\n");
+  fprintf(fp, "  \"name\": \"%s\",\n", datasetName.c_str());
+  fprintf(fp, "  \"description\": \"\",\n");
+  fprintf(fp, "  \"version\": \"1.1.0\",\n");
+
+  if (strcmp(outputFormat.c_str(), "Terrain") == 0) {
+    fprintf(fp, "  \"format\": \"heightmap-1.0\",\n");
+  }
+  else if (strcmp(outputFormat.c_str(), "Mesh") == 0) {
+    fprintf(fp, "  \"format\": \"quantized-mesh-1.0\",\n");
+  }
+  else {
+    fprintf(fp, "  \"format\": \"GDAL\",\n");
+  }
+  fprintf(fp, "  \"attribution\": \"\",\n");
+  fprintf(fp, "  \"schema\": \"tms\",\n");
+  if (writeVertexNormals) {
+    fprintf(fp, "  \"extensions\": [ \"octvertexnormals\" ],\n");
+  }
+  fprintf(fp, "  \"tiles\": [ \"{z}/{x}/{y}.terrain?v={version}\" ],\n");
+
+  if (strcmp(profile.c_str(), "geodetic") == 0) {
+    fprintf(fp, "  \"projection\": \"EPSG:4326\",\n");
+  }
+  else {
+    fprintf(fp, "  \"projection\": \"EPSG:3857\",\n");
+  }
+  fprintf(fp, "  \"bounds\": [ %.2f, %.2f, %.2f, %.2f ]",
+    bounds.getMinX(),
+    bounds.getMinY(),
+    bounds.getMaxX(),
+    bounds.getMaxY());
+
+  if (writeAvailable) {
+    fprintf(fp, ",\n  \"available\": [\n");
+    for (size_t i = 0, icount = levels.size(); i < icount; i++) {
+      const LevelInfo &level = levels[i];
+
+      if (i > 0)
+        fprintf(fp, "   ,[ ");
+      else
+        fprintf(fp, "    [ ");
+
+      if (level.finalX >= level.startX && i < sources.size()) {
+        // Only the parts of the level with fine enough sources are available
+        const char *separator = "";
+
+        for (const TileBounds &extent : sources[i]) {
+          const long startX = std::max(level.startX, (int) extent.getMinX()),
+            startY = std::max(level.startY, (int) extent.getMinY()),
+            finalX = std::min(level.finalX, (int) extent.getMaxX()),
+            finalY = std::min(level.finalY, (int) extent.getMaxY());
+
+          if (finalX >= startX && finalY >= startY) {
+            fprintf(fp, "%s{ \"startX\": %li, \"startY\": %li, \"endX\": %li, \"endY\": %li }",
+              separator, startX, startY, finalX, finalY);
+            separator = ", ";
+          }
+        }
+      } else if (level.finalX >= level.startX) {
+        fprintf(fp, "{ \"startX\": %li, \"startY\": %li, \"endX\": %li, \"endY\": %li }",
+          (long) level.startX,
+          (long) level.startY,
+          (long) level.finalX,
+          (long) level.finalY);
+      }
+      fprintf(fp, " ]\n");
+    }
+    fprintf(fp, "  ]\n");
+  } else {
+    fprintf(fp, "\n");
+  }
+
+  fprintf(fp, "}\n");
+  fclose(fp);
+}
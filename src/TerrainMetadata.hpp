@@ -0,0 +1,101 @@
+#ifndef TERRAINMETADATA_HPP
+#define TERRAINMETADATA_HPP
+
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file TerrainMetadata.hpp
+ * @brief This declares the `TerrainMetadata` class
+ */
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "config.hpp"
+#include "types.hpp"
+#include "TileCoordinate.hpp"
+#include "Grid.hpp"
+#include "GDALTiler.hpp"
+
+namespace ctb {
+  class TerrainMetadata;
+}
+
+/**
+ * @brief The metadata of a tileset, written to its `layer.json` file
+ *
+ * This records the extent of the tiles built in each zoom level and the
+ * bounds they cover.  The metadata of the tiles built by different threads,
+ * workers or runs of a build is merged with `add()`.
+ */
+class CTB_DLL ctb::TerrainMetadata {
+public:
+
+  /// The valid tile indexes of a level in a tileset
+  struct LevelInfo {
+  public:
+    LevelInfo() {
+      startX = startY = std::numeric_limits<int>::max();
+      finalX = finalY = std::numeric_limits<int>::min();
+    }
+    int startX, startY;
+    int finalX, finalY;
+
+    inline void add(const TileCoordinate *coordinate) {
+      startX = std::min(startX, (int)coordinate->x);
+      startY = std::min(startY, (int)coordinate->y);
+      finalX = std::max(finalX, (int)coordinate->x);
+      finalY = std::max(finalY, (int)coordinate->y);
+    }
+    inline void add(const LevelInfo &level) {
+      startX = std::min(startX, level.startX);
+      startY = std::min(startY, level.startY);
+      finalX = std::max(finalX, level.finalX);
+      finalY = std::max(finalY, level.finalY);
+    }
+  };
+
+  /// Add the metadata of a tile
+  void
+  add(const Grid &grid, const TileCoordinate *coordinate);
+
+  /// Use the sources of a variable depth tiler to define the available tiles
+  void
+  setAvailable(const GDALTiler &tiler, i_zoom startZoom);
+
+  /// Add the metadata of other tiles
+  void
+  add(const TerrainMetadata &otherMetadata);
+
+  /// Output the layer.json metadata file
+  void
+  writeJsonFile(const std::string &filename, const std::string &datasetName, const std::string &outputFormat = "Terrain",
+                const std::string &profile = "geodetic", bool writeVertexNormals = false, bool writeAvailable = true) const;
+
+  /// The valid tile indexes of each level
+  std::vector<LevelInfo> levels;
+
+  /// The tile extents of the sources reaching each level of a variable depth tileset
+  std::vector<std::vector<TileBounds>> sources;
+
+  /// The bounding box covered by the terrain
+  CRSBounds bounds;
+};
+
+#endif /* TERRAINMETADATA_HPP */
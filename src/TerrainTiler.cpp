@@ -19,6 +19,8 @@
  * @brief This defines the `TerrainTiler` class
  */
 
+#include <cmath>                 // for std::abs
+
 #include "CTBException.hpp"
 #include "TerrainTiler.hpp"
 #include "GDALDatasetReader.hpp"
@@ -60,6 +62,71 @@ ctb::TerrainTiler::prepareSettingsOfTile(TerrainTile *terrainTile, const TileCoo
       }
     }
   }
+
+  // Children are only created where the sources have the detail for them
+  if (hasVariableDepth() && coord.zoom != maxZoomLevel()) {
+    clearChildrenBeyondDepth(coord, terrainTile);
+  }
+
+  // Descendants of a leaf tile are not needed
+  if (options.pruneFlatTiles && coord.zoom != maxZoomLevel() && isLeafTile(coord, rasterHeights, tileSizeX, tileSizeY)) {
+    terrainTile->setAllChildren(false);
+  }
+}
+
+double
+ctb::TerrainTiler::levelGeometricError(i_zoom zoom, i_tile tileSize) const {
+  // Number of tiles in the horizontal direction at tile level zero.
+  double resolutionAtLevelZero = mGrid.resolution(0);
+  int numberOfTilesAtLevelZero = (int)(mGrid.getExtent().getWidth() / (tileSize * resolutionAtLevelZero));
+  // Earth semi-major-axis in meters.
+  const double semiMajorAxis = 6378137.0;
+  // Appropriate geometric error estimate when the geometry comes from a heightmap (TerrainProvider.js).
+  double maximumGeometricError = getEstimatedLevelZeroGeometricErrorForAHeightmap(
+    semiMajorAxis,
+    heightmapTerrainQuality(),
+    tileSize,
+    numberOfTilesAtLevelZero
+  );
+
+  return maximumGeometricError / (double)(1 << zoom);
+}
+
+bool
+ctb::TerrainTiler::isLeafTile(const TileCoordinate &coord, const float *rasterHeights, i_tile tileSizeX, i_tile tileSizeY) const {
+  const double maximumError = levelGeometricError(coord.zoom + 1, tileSizeX);
+  const float h00 = rasterHeights[0],
+    h10 = rasterHeights[tileSizeX - 1],
+    h01 = rasterHeights[(tileSizeY - 1) * tileSizeX],
+    h11 = rasterHeights[tileSizeY * tileSizeX - 1];
+
+  // Compare every height with the bilinear surface through the corners
+  for (i_tile y = 0; y < tileSizeY; y++) {
+    const double v = y / (double)(tileSizeY - 1),
+      west = h00 + (h01 - h00) * v,
+      east = h10 + (h11 - h10) * v;
+
+    for (i_tile x = 0; x < tileSizeX; x++) {
+      const double u = x / (double)(tileSizeX - 1),
+        height = west + (east - west) * u;
+
+      if (std::abs(rasterHeights[y * tileSizeX + x] - height) > maximumError) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+double ctb::TerrainTiler::getEstimatedLevelZeroGeometricErrorForAHeightmap(
+  double maximumRadius,
+  double heightmapTerrainQuality,
+  int tileWidth,
+  int numberOfTilesAtLevelZero)
+{
+  double error = maximumRadius * 2 * M_PI * heightmapTerrainQuality;
+  error /= (double)(tileWidth * numberOfTilesAtLevelZero);
+  return error;
 }
 
 TerrainTile *
@@ -80,10 +147,17 @@ ctb::TerrainTiler::createTile(GDALDataset *dataset, const TileCoordinate &coord,
   // Copy the raster data into an array
   float *rasterHeights = reader->readRasterHeights(dataset, coord, TILE_SIZE, TILE_SIZE);
 
-  // Get a mesh tile represented by the tile coordinate
+  TerrainTile *terrainTile = createTile(coord, rasterHeights);
+  CPLFree(rasterHeights);
+
+  return terrainTile;
+}
+
+TerrainTile *
+ctb::TerrainTiler::createTile(const TileCoordinate &coord, float *rasterHeights) const {
+  // Get a terrain tile represented by the tile coordinate
   TerrainTile *terrainTile = new TerrainTile(coord);
   prepareSettingsOfTile(terrainTile, coord, rasterHeights, TILE_SIZE, TILE_SIZE);
-  CPLFree(rasterHeights);
 
   return terrainTile;
 }
@@ -65,6 +65,16 @@ public:
   TerrainTile *
   createTile(GDALDataset *dataset, const TileCoordinate &coord, GDALDatasetReader *reader) const;
 
+  /// Create a tile from the `TILE_SIZE` x `TILE_SIZE` heights already read for a tile coordinate
+  TerrainTile *
+  createTile(const TileCoordinate &coord, float *rasterHeights) const;
+
+  /// Get the bounds and resolution of the raster warped for a terrain tile
+  virtual CRSBounds
+  rasterTileBounds(const TileCoordinate &coord, double &resolution) const override {
+    return terrainTileBounds(coord, resolution);
+  }
+
 protected:
 
   /// Create a `GDALTile` representing the required terrain tile data
@@ -104,6 +114,59 @@ protected:
 
   /// Assigns settings of Tile just to use.
   void prepareSettingsOfTile(TerrainTile *tile, const TileCoordinate &coord, float *rasterHeights, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) const;
+
+  /// The quality of terrain created from heightmaps, used to estimate geometric errors
+  virtual double
+  heightmapTerrainQuality() const {
+    return 0.25;                // the default of TerrainProvider.js
+  }
+
+  /// Get the geometric error in meters of the tiles of a zoom level
+  double
+  levelGeometricError(i_zoom zoom, i_tile tileSize) const;
+
+  /**
+   * @brief Is a tile a leaf of the tile pyramid?
+   *
+   * A tile is a leaf when the surface interpolated from its corners lies
+   * within the geometric error of the next zoom level at every height: deeper
+   * tiles would add no detail.
+   */
+  bool
+  isLeafTile(const TileCoordinate &coord, const float *rasterHeights, i_tile tileSizeX, i_tile tileSizeY) const;
+
+  /// Clear the child flags of children deeper than the sources they overlap
+  template <class T> void
+  clearChildrenBeyondDepth(const TileCoordinate &coord, T *tile) const {
+    const i_zoom zoom = coord.zoom + 1;
+    const i_tile x = coord.x * 2, y = coord.y * 2;
+
+    if (!withinDepth(TileCoordinate(zoom, x, y))) tile->setChildSW(false);
+    if (!withinDepth(TileCoordinate(zoom, x + 1, y))) tile->setChildSE(false);
+    if (!withinDepth(TileCoordinate(zoom, x, y + 1))) tile->setChildNW(false);
+    if (!withinDepth(TileCoordinate(zoom, x + 1, y + 1))) tile->setChildNE(false);
+  }
+
+  // Determines an appropriate geometric error estimate when the geometry comes from a heightmap.
+  static double getEstimatedLevelZeroGeometricErrorForAHeightmap(
+    double maximumRadius,
+    double heightmapTerrainQuality,
+    int tileWidth,
+    int numberOfTilesAtLevelZero);
+
+  /// Get the minimum and maximum of an array of heights
+  static inline void
+  heightRange(const float *heights, size_t count, float &minHeight, float &maxHeight) {
+    // Branchless comparisons in a simple loop allow the compiler to vectorize it
+    float lo = heights[0], hi = heights[0];
+    for (size_t i = 1; i < count; i++) {
+      const float height = heights[i];
+      lo = (height < lo) ? height : lo;
+      hi = (height > hi) ? height : hi;
+    }
+    minHeight = lo;
+    maxHeight = hi;
+  }
 };
 
 #endif /* TERRAINTILER_HPP */
@@ -47,8 +47,8 @@ public:
     TilerIterator(tiler, tiler.maxZoomLevel(), 0)
   {}
 
-  TilerIterator(const GDALTiler &tiler, i_zoom startZoom, i_zoom endZoom = 0) :
-    GridIterator(tiler.grid(), tiler.bounds(), startZoom, endZoom),
+  TilerIterator(const GDALTiler &tiler, i_zoom startZoom, i_zoom endZoom = 0, bool topDown = false) :
+    GridIterator(tiler.grid(), tiler.bounds(), startZoom, endZoom, topDown),
     tiler(tiler)
   {}
 
@@ -0,0 +1,502 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file ctb-convert.cpp
+ * @brief The heightmap to quantized mesh conversion tool
+ *
+ * This tool converts an existing tileset of heightmap terrain tiles into a
+ * tileset of quantized mesh tiles, without needing the source raster.  Each
+ * heightmap tile is read from the tileset, its heights are dequantized and
+ * meshed as `ctb-tile` meshes the heights it reads from a raster, and the
+ * child flags of the heightmap tile are kept so that the new tileset has the
+ * same tree of tiles as the old one.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+
+#include "cpl_conv.h"
+#include "cpl_vsi.h"
+#include "cpl_string.h"
+#include "gdal_priv.h"
+#include "commander.hpp"
+
+#include "config.hpp"
+#include "CTBException.hpp"
+#include "TerrainTile.hpp"
+#include "MeshTile.hpp"
+#include "MeshTiler.hpp"
+#include "GlobalGeodetic.hpp"
+#include "GlobalMercator.hpp"
+#include "CTBFileTileSerializer.hpp"
+#include "CTBObjectStoreTileSerializer.hpp"
+#include "CTBObjectStoreUploader.hpp"
+#include "CTBMBTilesTileSerializer.hpp"
+#include "MBTiler.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// Handle the terrain conversion CLI options
+class TerrainConvert : public Command {
+public:
+  TerrainConvert(const char *name, const char *version) :
+    Command(name, version),
+    outputDir("."),
+    outputFormat("Mesh"),
+    profile("geodetic"),
+    threadCount(-1),
+    startZoom(-1),
+    endZoom(-1),
+    verbosity(1),
+    resume(false),
+    meshQualityFactor(1.0),
+    vertexNormals(false),
+    optimizeMeshes(false)
+  {}
+
+  void
+  check() const {
+    switch(command->argc) {
+    case 1:
+      return;
+    case 0:
+      cerr << "  Error: The input tileset directory must be specified" << endl;
+      break;
+    default:
+      cerr << "  Error: Only one input tileset directory can be specified" << endl;
+      break;
+    }
+
+    help();                     // print help and exit
+  }
+
+  static void
+  setOutputDir(command_t *command) {
+    static_cast<TerrainConvert *>(Command::self(command))->outputDir = command->arg;
+  }
+
+  static void
+  setOutputFormat(command_t *command) {
+    static_cast<TerrainConvert *>(Command::self(command))->outputFormat = command->arg;
+  }
+
+  static void
+  setProfile(command_t *command) {
+    static_cast<TerrainConvert *>(Command::self(command))->profile = command->arg;
+  }
+
+  static void
+  setThreadCount(command_t *command) {
+    static_cast<TerrainConvert *>(Command::self(command))->threadCount = atoi(command->arg);
+  }
+
+  static void
+  setStartZoom(command_t *command) {
+    static_cast<TerrainConvert *>(Command::self(command))->startZoom = atoi(command->arg);
+  }
+
+  static void
+  setEndZoom(command_t *command) {
+    static_cast<TerrainConvert *>(Command::self(command))->endZoom = atoi(command->arg);
+  }
+
+  static void
+  setQuiet(command_t *command) {
+    --(static_cast<TerrainConvert *>(Command::self(command))->verbosity);
+  }
+
+  static void
+  setVerbose(command_t *command) {
+    ++(static_cast<TerrainConvert *>(Command::self(command))->verbosity);
+  }
+
+  static void
+  setResume(command_t* command) {
+    static_cast<TerrainConvert *>(Command::self(command))->resume = true;
+  }
+
+  static void
+  setMeshQualityFactor(command_t *command) {
+    static_cast<TerrainConvert *>(Command::self(command))->meshQualityFactor = atof(command->arg);
+  }
+
+  static void
+  setVertexNormals(command_t *command) {
+    static_cast<TerrainConvert *>(Command::self(command))->vertexNormals = true;
+  }
+
+  static void
+  setMeshOptimize(command_t *command) {
+    static_cast<TerrainConvert *>(Command::self(command))->optimizeMeshes = true;
+  }
+
+  const char *
+  getInputDir() const {
+    return (command->argc == 1) ? command->argv[0] : NULL;
+  }
+
+  const char *outputDir,
+    *outputFormat,
+    *profile;
+
+  int threadCount,
+    startZoom,
+    endZoom,
+    verbosity;
+
+  bool resume;
+
+  double meshQualityFactor;
+  bool vertexNormals,
+    optimizeMeshes;
+};
+
+/// Is a string a non negative decimal integer?
+static bool
+isNumber(const char *text) {
+  if (*text == '\0') return false;
+  for (; *text; text++) {
+    if (*text < '0' || *text > '9') return false;
+  }
+  return true;
+}
+
+/**
+ * @brief List the heightmap tiles of a tileset
+ *
+ * The tiles are found in the `{z}/{x}/{y}.terrain` layout written by
+ * `ctb-tile`, and are listed zoom level by zoom level.
+ */
+static vector<TileCoordinate>
+listTiles(const string &inputDir, int startZoom, int endZoom) {
+  vector<TileCoordinate> coords;
+  char **zooms = VSIReadDir(inputDir.c_str());
+
+  for (int i = 0; zooms && zooms[i]; i++) {
+    if (!isNumber(zooms[i])) continue;
+    const int zoom = atoi(zooms[i]);
+    // As in `ctb-tile`, the start zoom is the finest level and the end zoom the coarsest
+    if ((startZoom >= 0 && zoom > startZoom) || (endZoom >= 0 && zoom < endZoom)) continue;
+
+    const string zoomDir = inputDir + "/" + zooms[i];
+    char **columns = VSIReadDir(zoomDir.c_str());
+
+    for (int j = 0; columns && columns[j]; j++) {
+      if (!isNumber(columns[j])) continue;
+
+      const string columnDir = zoomDir + "/" + columns[j];
+      char **rows = VSIReadDir(columnDir.c_str());
+
+      for (int k = 0; rows && rows[k]; k++) {
+        const string row = rows[k];
+        const size_t extension = row.rfind(".terrain");
+        if (extension == string::npos || extension + 8 != row.size()
+            || !isNumber(row.substr(0, extension).c_str())) continue;
+
+        coords.push_back(TileCoordinate(zoom, atoi(columns[j]), atoi(row.c_str())));
+      }
+      CSLDestroy(rows);
+    }
+    CSLDestroy(columns);
+  }
+  CSLDestroy(zooms);
+
+  // Coarse tiles first, as a viewer would need them
+  sort(coords.begin(), coords.end(), [](const TileCoordinate &a, const TileCoordinate &b) {
+    return a.zoom != b.zoom ? a.zoom < b.zoom : (a.y != b.y ? a.y < b.y : a.x < b.x);
+  });
+
+  return coords;
+}
+
+/// The state shared by the conversion threads
+struct Conversion {
+  Conversion(const TerrainConvert &command, const Grid &grid, const vector<TileCoordinate> &coords):
+    command(command),
+    grid(grid),
+    coords(coords),
+    next(0),
+    converted(0),
+    skipped(0),
+    failed(false),
+    mbtiler(NULL)
+  {}
+
+  const TerrainConvert &command;
+  const Grid &grid;
+  const vector<TileCoordinate> &coords;
+
+  atomic<size_t> next;          ///< The index of the next tile to convert
+  atomic<size_t> converted, skipped;
+  atomic<bool> failed;
+
+  MBTiler *mbtiler;             ///< The MBTiles output, if any
+  unique_ptr<CTBObjectStoreUploader> uploader; ///< The object store output, if any
+
+  mutex progressMutex;
+  string error;                 ///< The first error of a thread
+};
+
+/// Create the serializer of a conversion thread
+static MeshSerializer *
+createSerializer(Conversion &conversion) {
+  const TerrainConvert &command = conversion.command;
+
+  if (conversion.mbtiler) {
+    return new CTBMBTilesTileSerializer(conversion.mbtiler, command.resume);
+  }
+  if (conversion.uploader) {
+    return new CTBObjectStoreTileSerializer(string(command.outputDir), command.resume, *conversion.uploader);
+  }
+  return new CTBFileTileSerializer(string(command.outputDir), command.resume);
+}
+
+/// Convert the tiles taken from the shared list until it is exhausted
+static void
+convertTiles(Conversion *conversion) {
+  const TerrainConvert &command = conversion->command;
+  const string inputDir(command.getInputDir());
+  const size_t total = conversion->coords.size();
+
+  try {
+    // The tiler meshes the heights it's given, so it needs no dataset
+    TilerOptions options;
+    options.optimizeMeshes = command.optimizeMeshes;
+    const MeshTiler tiler(NULL, conversion->grid, options, command.meshQualityFactor);
+    unique_ptr<MeshSerializer> serializer(createSerializer(*conversion));
+    vector<float> heights(TILE_SIZE * TILE_SIZE);
+
+    size_t index;
+    while (!conversion->failed && (index = conversion->next++) < total) {
+      const TileCoordinate &coord = conversion->coords[index];
+
+      if (serializer->mustSerializeCoordinate(&coord)) {
+        const string filename = CPLSPrintf("%s/%d/%d/%d.terrain", inputDir.c_str(), coord.zoom, coord.x, coord.y);
+        Terrain terrain;
+        terrain.readFile(filename.c_str());
+
+        // Heights are stored as 1/5 metre units above -1000 metres
+        const vector<i_terrain_height> &values = terrain.getHeights();
+        for (size_t i = 0; i < heights.size(); i++) {
+          heights[i] = values[i] / 5.0f - 1000;
+        }
+
+        unique_ptr<MeshTile> tile(tiler.createMesh(coord, heights.data()));
+        tile->setChildSW(terrain.hasChildSW());
+        tile->setChildSE(terrain.hasChildSE());
+        tile->setChildNW(terrain.hasChildNW());
+        tile->setChildNE(terrain.hasChildNE());
+
+        if (!serializer->serializeTile(tile.get(), command.vertexNormals)) {
+          throw CTBException("Failed to serialize a tile");
+        }
+        conversion->converted++;
+      } else {
+        conversion->skipped++;
+      }
+
+      if (command.verbosity > 0) {
+        lock_guard<mutex> lock(conversion->progressMutex);
+        GDALTermProgress((double) (conversion->converted + conversion->skipped) / total, NULL, NULL);
+      }
+    }
+  } catch (const exception &e) {
+    lock_guard<mutex> lock(conversion->progressMutex);
+    if (!conversion->failed) {
+      conversion->error = e.what();
+      conversion->failed = true;
+    }
+  }
+}
+
+/**
+ * @brief Write the layer.json of the converted tileset
+ *
+ * The tiles are available where they were in the heightmap tileset, so its
+ * metadata is kept with the format changed to quantized mesh.
+ */
+static void
+writeLayerFile(const TerrainConvert &command, CTBObjectStoreUploader *uploader) {
+  const string inputFile = string(command.getInputDir()) + "/layer.json";
+  GByte *data = NULL;
+  if (!VSIIngestFile(NULL, inputFile.c_str(), &data, NULL, -1)) {
+    if (command.verbosity > 0) {
+      cerr << "Warning: " << inputFile << " could not be read so no layer.json is written" << endl;
+    }
+    return;
+  }
+  string json((const char *) data);
+  VSIFree(data);
+
+  const size_t format = json.find("\"heightmap-1.0\"");
+  if (format != string::npos) {
+    json.replace(format, 15, "\"quantized-mesh-1.0\"");
+  }
+
+  const size_t tiles = json.find("\"tiles\"");
+  if (command.vertexNormals && tiles != string::npos && json.find("\"extensions\"") == string::npos) {
+    json.insert(tiles, "\"extensions\": [ \"octvertexnormals\" ],\n  ");
+  }
+
+  const string filename = string(command.outputDir) + "/layer.json";
+  const string tempFilename = uploader ? string(CPLGenerateTempFilename("ctb-layer")) + ".json" : filename + ".tmp";
+
+  VSILFILE *fp = VSIFOpenL(tempFilename.c_str(), "wb");
+  if (fp == NULL || VSIFWriteL(json.data(), 1, json.size(), fp) != json.size()) {
+    if (fp) VSIFCloseL(fp);
+    throw CTBException("Failed to write the metadata file");
+  }
+  VSIFCloseL(fp);
+
+  if (uploader) {
+    uploader->uploadFile(tempFilename, filename, "application/json");
+    VSIUnlink(tempFilename.c_str());
+  } else if (VSIRename(tempFilename.c_str(), filename.c_str()) != 0) {
+    throw CTBException("Could not rename temporary metadata file");
+  }
+}
+
+int
+main(int argc, char *argv[]) {
+  // Setup the command interface
+  TerrainConvert command = TerrainConvert(argv[0], version.cstr);
+
+  command.setUsage("[options] TILESET_DIR");
+  command.option("-o", "--output-dir <dir>", "specify the output directory for the mesh tiles (defaults to working directory)", TerrainConvert::setOutputDir);
+  command.option("-f", "--output-format <format>", "specify the output format for the tiles. This is either `Mesh` (the default) or `MBTilesMesh` (to write them in the `<output-dir>.sqlite3` file)", TerrainConvert::setOutputFormat);
+  command.option("-p", "--profile <profile>", "specify the TMS profile of the heightmap tileset. This is either `geodetic` (the default) or `mercator`", TerrainConvert::setProfile);
+  command.option("-c", "--thread-count <count>", "specify the number of threads to use for the conversion. On multicore machines this defaults to the number of CPUs", TerrainConvert::setThreadCount);
+  command.option("-s", "--start-zoom <zoom>", "specify the zoom level to start at. This should be greater than the end zoom level (defaults to the finest zoom level of the tileset)", TerrainConvert::setStartZoom);
+  command.option("-e", "--end-zoom <zoom>", "specify the zoom level to end at. This should be less than the start zoom level and >= 0 (defaults to the coarsest zoom level of the tileset)", TerrainConvert::setEndZoom);
+  command.option("-g", "--mesh-qfactor <factor>", "specify the factor to multiply the estimated geometric error to convert heightmaps to irregular meshes. Larger values should mean minor quality (defaults to 1.0)", TerrainConvert::setMeshQualityFactor);
+  command.option("-N", "--vertex-normals", "write 'Oct-Encoded Per-Vertex Normals' for Terrain Lighting", TerrainConvert::setVertexNormals);
+  command.option("-M", "--mesh-optimize", "remove the degenerate triangles joining the triangle strips of meshes, making the tiles smaller", TerrainConvert::setMeshOptimize);
+  command.option("-R", "--resume", "do not overwrite existing files", TerrainConvert::setResume);
+  command.option("-q", "--quiet", "only output errors", TerrainConvert::setQuiet);
+  command.option("-v", "--verbose", "be more noisy", TerrainConvert::setVerbose);
+
+  // Parse and check the arguments
+  command.parse(argc, argv);
+  command.check();
+
+  GDALAllRegister();
+
+  Grid grid;
+  if (strcmp(command.profile, "geodetic") == 0) {
+    grid = GlobalGeodetic(TILE_SIZE);
+  } else if (strcmp(command.profile, "mercator") == 0) {
+    grid = GlobalMercator(TILE_SIZE);
+  } else {
+    cerr << "Error: Unknown profile: " << command.profile << endl;
+    return 1;
+  }
+
+  const bool mbtiles = strcmp(command.outputFormat, "MBTilesMesh") == 0;
+  if (!mbtiles && strcmp(command.outputFormat, "Mesh") != 0) {
+    cerr << "Error: Unknown output format: " << command.outputFormat << endl;
+    return 1;
+  }
+
+  // Heightmap tiles are read with zlib, so they must be in a local directory
+  const string inputDir(command.getInputDir());
+  if (inputDir.compare(0, 4, "/vsi") == 0) {
+    cerr << "Error: The heightmap tileset must be in a local directory" << endl;
+    return 1;
+  }
+
+  VSIStatBufL stat;
+  if (!mbtiles && !CTBObjectStoreUploader::isObjectStorePath(command.outputDir)) {
+    if (VSIStatExL(command.outputDir, &stat, VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG)) {
+      cerr << "Error: The output directory does not exist" << endl;
+      return 1;
+    } else if (!VSI_ISDIR(stat.st_mode)) {
+      cerr << "Error: The output filepath is not a directory" << endl;
+      return 1;
+    }
+  }
+
+  const vector<TileCoordinate> coords = listTiles(inputDir, command.startZoom, command.endZoom);
+  if (coords.empty()) {
+    cerr << "Error: No heightmap tiles were found in " << inputDir << endl;
+    return 1;
+  }
+  if (command.verbosity > 0) {
+    cout << "Converting " << coords.size() << " tiles" << endl;
+  }
+
+  Conversion conversion(command, grid, coords);
+
+  try {
+    if (mbtiles) {
+      const string outputFile = string(command.outputDir) + ".sqlite3";
+      if (!command.resume) {
+        VSIUnlink(outputFile.c_str());
+      }
+      conversion.mbtiler = new MBTiler(outputFile.c_str());
+      conversion.mbtiler->setMetadata("name", "cesium terrain");
+      conversion.mbtiler->setMetadata("format", "application/vnd.quantized-mesh");
+    } else if (CTBObjectStoreUploader::isObjectStorePath(command.outputDir)) {
+      conversion.uploader.reset(new CTBObjectStoreUploader());
+    }
+
+    // Convert the tiles in parallel
+    const int threadCount = (command.threadCount > 0) ? command.threadCount : CPLGetNumCPUs();
+    vector<thread> threads;
+    for (int i = 0; i < threadCount; ++i) {
+      threads.push_back(thread(convertTiles, &conversion));
+    }
+    for (thread &worker : threads) {
+      worker.join();
+    }
+
+    if (conversion.failed) {
+      throw CTBException(conversion.error.c_str());
+    }
+
+    if (!mbtiles) {
+      writeLayerFile(command, conversion.uploader.get());
+    }
+    if (conversion.uploader) {
+      conversion.uploader->finish();
+    }
+  } catch (const exception &e) {
+    delete conversion.mbtiler;
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  delete conversion.mbtiler;
+
+  if (command.verbosity > 0) {
+    cout << conversion.converted << " tiles converted";
+    if (conversion.skipped) {
+      cout << ", " << conversion.skipped << " already written";
+    }
+    cout << endl;
+  }
+
+  return 0;
+}
@@ -0,0 +1,423 @@
+/*******************************************************************************
+ * Copyright 2018 GeoData <geodata@soton.ac.uk>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License"); you may not
+ * use this file except in compliance with the License.  You may obtain a copy
+ * of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+ * WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.  See the
+ * License for the specific language governing permissions and limitations
+ * under the License.
+ *******************************************************************************/
+
+/**
+ * @file ctb-mesh-bench.cpp
+ * @brief A tool to compare the triangle orders of quantized mesh tiles
+ *
+ * This tool meshes heightmap tiles as `ctb-tile -f Mesh` does and writes the
+ * meshes in several triangle orders, printing the total gzipped size of the
+ * tiles and the average cache miss ratio (ACMR) of each order.  The orders
+ * are those of the chunker's triangle strips, the strips without their
+ * degenerate triangles (as `--mesh-optimize` writes them), a vertex cache
+ * order after Tom Forsyth's "Linear-Speed Vertex Cache Optimisation" and the
+ * Morton order of the triangle centroids.  The heightmaps are either the
+ * heightmap terrain tiles given on the command line or, by default, random
+ * synthetic terrain, so that the figures can be reproduced anywhere.  It
+ * exits with `0` on success or `1` otherwise.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <limits>
+
+#include "commander.hpp"
+
+#include "config.hpp"
+#include "CTBException.hpp"
+#include "CTBZOutputStream.hpp"
+#include "TerrainTile.hpp"
+#include "MeshTile.hpp"
+#include "MeshTiler.hpp"
+#include "MeshOptimizer.hpp"
+#include "GlobalGeodetic.hpp"
+
+using namespace std;
+using namespace ctb;
+
+/// The vertices held by the simulated vertex cache
+static const size_t CACHE_SIZE = 32;
+
+/// Handle the mesh benchmark CLI options
+class MeshBench : public Command {
+public:
+  MeshBench(const char *name, const char *version) :
+    Command(name, version),
+    tileCount(50),
+    seed(3),
+    zoom(14),
+    meshQualityFactor(1.0)
+  {}
+
+  static void
+  setTileCount(command_t *command) {
+    static_cast<MeshBench *>(Command::self(command))->tileCount = atoi(command->arg);
+  }
+
+  static void
+  setSeed(command_t *command) {
+    static_cast<MeshBench *>(Command::self(command))->seed = atoi(command->arg);
+  }
+
+  static void
+  setZoom(command_t *command) {
+    static_cast<MeshBench *>(Command::self(command))->zoom = atoi(command->arg);
+  }
+
+  static void
+  setMeshQualityFactor(command_t *command) {
+    static_cast<MeshBench *>(Command::self(command))->meshQualityFactor = atof(command->arg);
+  }
+
+  /// Get the heightmap tiles given on the command line
+  vector<string>
+  getInputFilenames() const {
+    return vector<string>(command->argv, command->argv + command->argc);
+  }
+
+  int tileCount;
+  int seed;
+  int zoom;
+  double meshQualityFactor;
+};
+
+/// The totals of the tiles written in a triangle order
+struct OrderTotals {
+  const char *name;
+  size_t triangles;
+  size_t vertices;
+  size_t bytes;
+  size_t misses;                ///< The vertex cache misses
+};
+
+/**
+ * Create the heights of a random synthetic terrain tile
+ *
+ * The terrain is the sum of six octaves of sine waves with random phases and
+ * frequencies, each half the amplitude of the one before, giving ridges and
+ * valleys at several scales.
+ */
+static vector<float>
+syntheticHeights(mt19937 &random) {
+  vector<float> heights(TILE_SIZE * TILE_SIZE);
+  uniform_real_distribution<float> uniform(0, 1);
+  float waves[6][4];
+
+  for (int octave = 0; octave < 6; octave++) {
+    waves[octave][0] = uniform(random) * 6.28f; // the x phase
+    waves[octave][1] = uniform(random) * 6.28f; // the y phase
+    waves[octave][2] = (float) pow(2, octave) * 0.05f * (1 + uniform(random)); // the frequency
+    waves[octave][3] = 300.0f / pow(2, octave); // the amplitude
+  }
+
+  for (int y = 0; y < TILE_SIZE; y++) {
+    for (int x = 0; x < TILE_SIZE; x++) {
+      float height = 0;
+      for (const float *wave : waves) {
+        height += wave[3] * sin(wave[2] * x + wave[0]) * cos(wave[2] * 0.8f * y + wave[1]);
+      }
+      heights[y * TILE_SIZE + x] = height + 500;
+    }
+  }
+
+  return heights;
+}
+
+/// Read the heights of a heightmap terrain tile, and its coordinate if its path gives it
+static vector<float>
+terrainHeights(const string &filename, TileCoordinate &coord) {
+  Terrain terrain(filename.c_str());
+  const vector<i_terrain_height> &values = terrain.getHeights();
+  vector<float> heights(values.size());
+
+  // Heights are stored as 1/5 metre units above -1000 metres
+  for (size_t i = 0; i < heights.size(); i++) {
+    heights[i] = values[i] / 5.0f - 1000;
+  }
+
+  // The coordinate is given by a path ending in <zoom>/<x>/<y>.terrain
+  size_t start = filename.size();
+  for (int components = 0; components < 3 && start != string::npos && start > 0; components++) {
+    start = filename.find_last_of('/', start - 1);
+  }
+  const string tail = (start == string::npos) ? filename : filename.substr(start + 1);
+  unsigned int zoom, x, y;
+  if (sscanf(tail.c_str(), "%u/%u/%u.terrain", &zoom, &x, &y) == 3) {
+    coord = TileCoordinate(zoom, x, y);
+  }
+
+  return heights;
+}
+
+/// Get the score of a vertex for the vertex cache order
+static float
+vertexScore(int cachePosition, uint32_t remainingTriangles) {
+  if (remainingTriangles == 0) {
+    return -1.0f;               // the vertex is no longer used
+  }
+
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    // The vertices of the last triangle are scored the same, so that the
+    // order is not tied to the order of its vertices
+    score = (cachePosition < 3) ? 0.75f
+      : pow(1.0f - (cachePosition - 3) / (float) (CACHE_SIZE - 3), 1.5f);
+  }
+
+  // Favour the vertices with few triangles left, so that none are stranded
+  return score + 2.0f * pow((float) remainingTriangles, -0.5f);
+}
+
+/**
+ * Reorder the triangles of a mesh for a vertex cache
+ *
+ * This is Tom Forsyth's linear-speed algorithm: the triangle with the best
+ * score among those of the cached vertices is emitted next, the vertices of a
+ * triangle being scored by their position in a simulated cache and the number
+ * of their triangles not yet emitted.
+ */
+static void
+vertexCacheOrder(Mesh &mesh) {
+  const vector<uint32_t> &indices = mesh.indices;
+  const size_t triangleCount = indices.size() / 3, vertexCount = mesh.vertexCount();
+
+  // The triangles of each vertex, those not yet emitted coming first
+  vector<uint32_t> offsets(vertexCount + 1, 0);
+  for (uint32_t index : indices) ++offsets[index + 1];
+  for (size_t vertex = 0; vertex < vertexCount; vertex++) offsets[vertex + 1] += offsets[vertex];
+
+  vector<uint32_t> triangles(indices.size()), remaining(vertexCount, 0);
+  for (size_t i = 0; i < indices.size(); i++) {
+    const uint32_t vertex = indices[i];
+    triangles[offsets[vertex] + remaining[vertex]++] = i / 3;
+  }
+
+  vector<int> cachePosition(vertexCount, -1);
+  vector<float> scores(vertexCount), triangleScores(triangleCount, 0);
+  for (size_t vertex = 0; vertex < vertexCount; vertex++) {
+    scores[vertex] = vertexScore(-1, remaining[vertex]);
+  }
+  for (size_t i = 0; i < indices.size(); i++) {
+    triangleScores[i / 3] += scores[indices[i]];
+  }
+
+  vector<bool> emitted(triangleCount, false);
+  vector<uint32_t> order, cache;
+  order.reserve(indices.size());
+
+  while (order.size() < indices.size()) {
+    // The best triangle of the cached vertices, or of all if they have none
+    long best = -1;
+    float bestScore = -numeric_limits<float>::max();
+    for (uint32_t vertex : cache) {
+      for (uint32_t i = offsets[vertex]; i < offsets[vertex] + remaining[vertex]; i++) {
+        if (triangleScores[triangles[i]] > bestScore) {
+          best = triangles[i];
+          bestScore = triangleScores[best];
+        }
+      }
+    }
+    if (best < 0) {
+      for (size_t triangle = 0; triangle < triangleCount; triangle++) {
+        if (!emitted[triangle] && triangleScores[triangle] > bestScore) {
+          best = triangle;
+          bestScore = triangleScores[triangle];
+        }
+      }
+    }
+
+    // Emit the triangle, moving its vertices to the front of the cache
+    emitted[best] = true;
+    order.insert(order.end(), indices.begin() + best * 3, indices.begin() + best * 3 + 3);
+
+    vector<uint32_t> updated(cache);
+    for (int corner = 2; corner >= 0; corner--) {
+      const uint32_t vertex = indices[best * 3 + corner];
+
+      uint32_t *first = &triangles[offsets[vertex]], *last = first + remaining[vertex] - 1;
+      *find(first, last + 1, (uint32_t) best) = *last;
+      --remaining[vertex];
+
+      cache.erase(remove(cache.begin(), cache.end(), vertex), cache.end());
+      cache.insert(cache.begin(), vertex);
+      updated.push_back(vertex);
+    }
+    sort(updated.begin(), updated.end());
+    updated.erase(unique(updated.begin(), updated.end()), updated.end());
+
+    // Evict the vertices beyond the end of the cache
+    for (size_t position = CACHE_SIZE; position < cache.size(); position++) {
+      cachePosition[cache[position]] = -1;
+    }
+    if (cache.size() > CACHE_SIZE) cache.resize(CACHE_SIZE);
+    for (size_t position = 0; position < cache.size(); position++) {
+      cachePosition[cache[position]] = position;
+    }
+
+    // Rescore the vertices whose cache position changed, and their triangles
+    for (uint32_t vertex : updated) {
+      const float score = vertexScore(cachePosition[vertex], remaining[vertex]);
+      const float change = score - scores[vertex];
+      scores[vertex] = score;
+      for (uint32_t i = offsets[vertex]; i < offsets[vertex] + remaining[vertex]; i++) {
+        triangleScores[triangles[i]] += change;
+      }
+    }
+  }
+
+  mesh.indices.swap(order);
+}
+
+/// Spread the bits of a 16 bit integer to the even bits of a 32 bit integer
+static uint32_t
+spreadBits(uint32_t value) {
+  value = (value | (value << 8)) & 0x00FF00FF;
+  value = (value | (value << 4)) & 0x0F0F0F0F;
+  value = (value | (value << 2)) & 0x33333333;
+  value = (value | (value << 1)) & 0x55555555;
+  return value;
+}
+
+/// Reorder the triangles of a mesh of grid vertices by the Morton order of their centroids
+static void
+mortonOrder(Mesh &mesh) {
+  const vector<uint32_t> &indices = mesh.indices;
+  vector<pair<uint32_t, uint32_t>> keys;
+
+  for (uint32_t triangle = 0; triangle < indices.size() / 3; triangle++) {
+    uint32_t x = 0, y = 0;      // three times the centroid
+    for (int corner = 0; corner < 3; corner++) {
+      const Mesh::GridVertex &vertex = mesh.gridVertices[indices[triangle * 3 + corner]];
+      x += vertex.x;
+      y += vertex.y;
+    }
+    keys.push_back(make_pair(spreadBits(x) | (spreadBits(y) << 1), triangle));
+  }
+  stable_sort(keys.begin(), keys.end());
+
+  vector<uint32_t> order;
+  order.reserve(indices.size());
+  for (const auto &key : keys) {
+    order.insert(order.end(), indices.begin() + key.second * 3, indices.begin() + key.second * 3 + 3);
+  }
+  mesh.indices.swap(order);
+}
+
+/// Count the misses of a FIFO vertex cache drawing the triangles of a mesh
+static size_t
+cacheMisses(const Mesh &mesh) {
+  vector<uint32_t> cache;
+  size_t misses = 0;
+
+  for (uint32_t index : mesh.indices) {
+    if (find(cache.begin(), cache.end(), index) == cache.end()) {
+      ++misses;
+      cache.push_back(index);
+      if (cache.size() > CACHE_SIZE) cache.erase(cache.begin());
+    }
+  }
+  return misses;
+}
+
+/// Add a mesh to the totals of its order, writing it as a gzipped tile
+static void
+addMesh(OrderTotals &totals, const TileCoordinate &coord, const Mesh &mesh) {
+  MeshTile tile(coord);
+  tile.getMesh() = mesh;
+
+  CTBZOutputStream ostream;
+  tile.writeFile(ostream);
+  ostream.finish();
+
+  totals.triangles += mesh.indices.size() / 3;
+  totals.vertices += mesh.vertexCount();
+  totals.bytes += ostream.size();
+  totals.misses += cacheMisses(mesh);
+}
+
+int
+main(int argc, char *argv[]) {
+  // Set up the command interface
+  MeshBench command = MeshBench(argv[0], version.cstr);
+  command.setUsage("[options] [TERRAIN_FILE...]");
+  command.option("-n", "--tile-count <count>", "the number of synthetic tiles to mesh when no heightmap terrain tiles are given (defaults to 50)", MeshBench::setTileCount);
+  command.option("-s", "--seed <seed>", "the seed of the random synthetic tiles (defaults to 3)", MeshBench::setSeed);
+  command.option("-z", "--zoom <zoom>", "the zoom level of the synthetic tiles, and of the terrain tiles whose path isn't of the form <zoom>/<x>/<y>.terrain (defaults to 14)", MeshBench::setZoom);
+  command.option("-g", "--mesh-qfactor <factor>", "specify the factor to multiply the estimated geometric error to convert heightmaps to irregular meshes. Larger values should mean minor quality (defaults to 1.0)", MeshBench::setMeshQualityFactor);
+
+  // Parse the arguments
+  command.parse(argc, argv);
+
+  const vector<string> filenames = command.getInputFilenames();
+  const int count = filenames.empty() ? command.tileCount : (int) filenames.size();
+  const GlobalGeodetic grid(TILE_SIZE);
+  const MeshTiler tiler(NULL, grid, TilerOptions(), command.meshQualityFactor);
+  mt19937 random(command.seed);
+
+  OrderTotals orders[] = {
+    { "chunker strips", 0, 0, 0, 0 },
+    { "degenerates removed", 0, 0, 0, 0 },
+    { "vertex cache (Forsyth)", 0, 0, 0, 0 },
+    { "Morton", 0, 0, 0, 0 }
+  };
+
+  try {
+    for (int i = 0; i < count; i++) {
+      TileCoordinate coord(command.zoom, i, 0);
+      vector<float> heights = filenames.empty() ? syntheticHeights(random) : terrainHeights(filenames[i], coord);
+
+      unique_ptr<MeshTile> tile(tiler.createMesh(coord, heights.data()));
+      const Mesh &strips = tile->getMesh();
+      addMesh(orders[0], coord, strips);
+
+      // The reordered meshes are numbered in first use order again as the
+      // high water mark encoding of the indices requires
+      Mesh optimized = strips;
+      MeshOptimizer::optimize(optimized);
+      addMesh(orders[1], coord, optimized);
+
+      Mesh cacheOrdered = optimized;
+      vertexCacheOrder(cacheOrdered);
+      MeshOptimizer::optimize(cacheOrdered);
+      addMesh(orders[2], coord, cacheOrdered);
+
+      Mesh mortonOrdered = optimized;
+      mortonOrder(mortonOrdered);
+      MeshOptimizer::optimize(mortonOrdered);
+      addMesh(orders[3], coord, mortonOrdered);
+    }
+  } catch (CTBException &e) {
+    cerr << "Error: " << e.what() << endl;
+    return 1;
+  }
+
+  cout << "Meshed " << count << (filenames.empty() ? " synthetic" : "") << " tiles" << endl;
+  printf("%-24s %10s %10s %12s %8s\n", "order", "triangles", "vertices", "gzip bytes", "ACMR");
+  for (const OrderTotals &totals : orders) {
+    printf("%-24s %10zu %10zu %12zu %8.3f\n", totals.name, totals.triangles, totals.vertices, totals.bytes,
+           totals.triangles ? totals.misses / (double) totals.triangles : 0.0);
+  }
+
+  return 0;
+}
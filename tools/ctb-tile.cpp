@@ -40,10 +40,31 @@
 #include <thread>
 #include <mutex>
 #include <future>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <algorithm>
+#include <unordered_set>
+#include <random>
+#include <cmath>
+
+#ifndef _WIN32
+#include <sys/resource.h>       // for getrusage
+#endif
+#ifdef __linux__
+#include <sched.h>              // for sched_setaffinity
+#endif
 
 #include "cpl_multiproc.h"      // for CPLGetNumCPUs
 #include "cpl_vsi.h"            // for virtual filesystem
 #include "gdal_priv.h"
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,3,0)
+#include "cpl_json.h"           // for job files
+#endif
 #include "commander.hpp"        // for cli parsing
 #include "concat.hpp"
 
@@ -53,8 +74,21 @@
 #include "MBTiler.hpp"
 #include "MeshIterator.hpp"
 #include "GDALDatasetReader.hpp"
+#include "GDALMappedDatasetReader.hpp"
+#include "GDALCachedDatasetReader.hpp"
+#include "GeoidGrid.hpp"
+#include "HeightmapImage.hpp"
 #include "CTBFileTileSerializer.hpp"
 #include "CTBMBTilesTileSerializer.hpp"
+#include "CTBCompressionCache.hpp"
+#include "CTBObjectStoreTileSerializer.hpp"
+#include "CTBObjectStoreUploader.hpp"
+#include "CTBCOGPyramidTileSerializer.hpp"
+#include "CTBFileOutputStream.hpp"
+#include "CTBZOutputStream.hpp"
+#include "TerrainMetadata.hpp"
+#include "BuildCheckpoint.hpp"
+#include "BuildCoordinator.hpp"
 
 using namespace std;
 using namespace ctb;
@@ -82,7 +116,20 @@ public:
     meshQualityFactor(1.0),
     metadata(false),
     cesiumFriendly(false),
-    vertexNormals(false)
+    vertexNormals(false),
+    progressive(false),
+    checkpointInterval(0),
+    continueBuild(false),
+    compressionCacheSize(64),
+    estimate(false),
+    numa(false),
+    uploadConnections(8),
+    coordinatorPort(0),
+    workerAddress(NULL),
+    jobFile(NULL),
+    geoidFile(NULL),
+    skipEmpty(false),
+    heightCacheDir(NULL)
   {}
 
   void
@@ -91,6 +138,7 @@ public:
     case 1:
       return;
     case 0:
+      if (jobFile) return;
       cerr << "  Error: The gdal datasource must be specified" << endl;
       break;
     default:
@@ -146,6 +194,11 @@ public:
     ++(static_cast<TerrainBuild *>(Command::self(command))->verbosity);
   }
 
+  static void
+  setSkipEmpty(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->skipEmpty = true;
+  }
+
   static void
   setResume(command_t* command) {
     static_cast<TerrainBuild *>(Command::self(command))->resume = true;
@@ -207,6 +260,56 @@ public:
     return  (command->argc == 1) ? command->argv[0] : NULL;
   }
 
+  /// The formats listed by a comma separated `--output-format`
+  vector<string>
+  getOutputFormats() const {
+    vector<string> formats;
+    stringstream stream(outputFormat);
+    string format;
+
+    while (getline(stream, format, ',')) {
+      if (!format.empty()) formats.push_back(format);
+    }
+    return formats;
+  }
+
+  /// Are the zoom levels built from the top down?
+  bool
+  isTopDown() const {
+    return progressive || tilerOptions.pruneFlatTiles;
+  }
+
+  /// Are the heights read filled or converted to ellipsoidal heights?
+  bool
+  adjustsHeights() const {
+    return tilerOptions.fillNoDataDistance > 0 || tilerOptions.geoid;
+  }
+
+  /// Are tiles being created in more than one format?
+  bool
+  isMultiFormat() const {
+    return getOutputFormats().size() > 1;
+  }
+
+  /// Are the tiles being uploaded to an object store rather than written to files?
+  bool
+  isObjectStore() const {
+    return CTBObjectStoreUploader::isObjectStorePath(outputDir);
+  }
+
+  /// The separator of the output paths, which is always `/` in an object store
+  const char *
+  getDirSeparator() const {
+    return isObjectStore() ? "/" : osDirSep;
+  }
+
+  /// The output directory of a format, which has its own subdirectory in a multi-format build
+  string
+  getFormatDir(const string &format) const {
+    string dirname = string(outputDir) + getDirSeparator();
+    return isMultiFormat() ? dirname + format + getDirSeparator() : dirname;
+  }
+
   static void
     setMeshQualityFactor(command_t *command) {
     static_cast<TerrainBuild *>(Command::self(command))->meshQualityFactor = atof(command->arg);
@@ -227,6 +330,86 @@ public:
     static_cast<TerrainBuild *>(Command::self(command))->vertexNormals = true;
   }
 
+  static void
+    setMeshOptimize(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->tilerOptions.optimizeMeshes = true;
+  }
+
+  static void
+    setProgressive(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->progressive = true;
+  }
+
+  static void
+    setCheckpointInterval(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->checkpointInterval = atoi(command->arg);
+  }
+
+  static void
+    setContinue(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->continueBuild = true;
+  }
+
+  static void
+    setPrune(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->tilerOptions.pruneFlatTiles = true;
+  }
+
+  static void
+    setVariableDepth(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->tilerOptions.variableDepth = true;
+  }
+
+  static void
+    setFillNoData(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->tilerOptions.fillNoDataDistance = atoi(command->arg);
+  }
+
+  static void
+    setCompressionCacheSize(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->compressionCacheSize = atoi(command->arg);
+  }
+
+  static void
+    setEstimate(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->estimate = true;
+  }
+
+  static void
+    setNuma(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->numa = true;
+  }
+
+  static void
+    setUploadConnections(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->uploadConnections = atoi(command->arg);
+  }
+
+  static void
+    setCoordinatorPort(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->coordinatorPort = atoi(command->arg);
+  }
+
+  static void
+    setWorkerAddress(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->workerAddress = command->arg;
+  }
+
+  static void
+    setJobFile(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->jobFile = command->arg;
+  }
+
+  static void
+    setGeoidFile(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->geoidFile = command->arg;
+  }
+
+  static void
+    setHeightCacheDir(command_t *command) {
+    static_cast<TerrainBuild *>(Command::self(command))->heightCacheDir = command->arg;
+  }
+
   const char *outputDir,
     *outputFormat,
     *profile;
@@ -246,8 +429,230 @@ public:
   bool metadata;
   bool cesiumFriendly;
   bool vertexNormals;
+  bool progressive;
+  int checkpointInterval;
+  bool continueBuild;
+  int compressionCacheSize;
+  bool estimate;
+  bool numa;
+  int uploadConnections;
+  int coordinatorPort;
+  const char *workerAddress;
+  const char *jobFile;
+  const char *geoidFile;
+  bool skipEmpty;
+  const char *heightCacheDir;
+};
+
+/**
+ * Place the tiling threads on the NUMA nodes of the host
+ *
+ * Each thread is pinned to the CPUs of one node before it opens its dataset
+ * or allocates anything, so that its malloc arena, tile buffers and zlib
+ * state are first touched, and therefore allocated, on that node.  The
+ * threads are spread over the nodes in contiguous blocks.  Rather than taking
+ * single tiles from the shared iterator, the threads of a node take runs of
+ * `CHUNK_TILES` consecutive tiles, which lie next to each other, so that the
+ * source blocks read by a node are mostly read by that node alone.
+ *
+ * The nodes are read from `/sys/devices/system/node`, so this only has an
+ * effect on Linux hosts with more than one node.
+ */
+class NumaPlacement {
+public:
+  /// The number of consecutive tiles taken by a node at a time
+  static const int CHUNK_TILES = 64;
+
+  /// Cross node memory traffic counters of a node, from its `numastat` file
+  struct Traffic {
+    Traffic(): miss(0), foreign(0), otherNode(0) {}
+
+    unsigned long long miss;      ///< Pages allocated here instead of the preferred node
+    unsigned long long foreign;   ///< Pages meant for here but allocated elsewhere
+    unsigned long long otherNode; ///< Pages allocated here by a process running elsewhere
+  };
+
+  NumaPlacement():
+    threadCount(0)
+  {}
+
+  /// Read the nodes of the host and spread a number of threads over them
+  bool enable(int threads) {
+    disable();
+    threadCount = threads;
+
+#ifdef __linux__
+    for (int node = 0; ; ++node) {
+      const std::string cpulist = readFile(nodePath(node, "cpulist"));
+      if (cpulist.empty()) break;
+
+      std::vector<int> cpus = parseCpuList(cpulist);
+      if (!cpus.empty()) {
+        nodes.push_back(Node(node, cpus));
+      }
+    }
+#endif
+
+    if (nodes.size() < 2) {
+      nodes.clear();
+      return false;
+    }
+    chunks.assign(nodes.size(), Chunk());
+    return true;
+  }
+
+  /// Stop placing threads on nodes
+  void disable() {
+    nodes.clear();
+    chunks.clear();
+  }
+
+  /// Are the threads being placed on nodes?
+  bool isEnabled() const {
+    return !nodes.empty();
+  }
+
+  /// Get the number of nodes in use
+  size_t nodeCount() const {
+    return nodes.size();
+  }
+
+  /// Pin the calling thread, the `worker`th tiling thread, to its node
+  void pin(int worker) {
+    if (!isEnabled() || worker < 0) return;
+
+    const size_t index = (size_t) worker * nodes.size() / std::max(threadCount, 1);
+    currentNode = (int) std::min(index, nodes.size() - 1);
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : nodes[currentNode].cpus) {
+      CPU_SET(cpu, &set);
+    }
+    sched_setaffinity(0, sizeof(set), &set); // 0 is the calling thread
+#endif
+  }
+
+  /**
+   * Get the next global iterator index for the calling thread
+   *
+   * This must be called with the iterator lock held.  Threads not pinned to
+   * a node take the next index, as do all threads when `chunked` is false.
+   */
+  int next(int &globalIndex, bool chunked) {
+    if (!isEnabled() || !chunked || currentNode < 0) {
+      return globalIndex++;
+    }
+
+    Chunk &chunk = chunks[currentNode];
+    if (chunk.next >= chunk.end) {
+      chunk.next = globalIndex;
+      chunk.end = globalIndex += CHUNK_TILES;
+    }
+    return chunk.next++;
+  }
+
+  /// Forget the runs of tiles taken by the nodes
+  void resetChunks() {
+    chunks.assign(nodes.size(), Chunk());
+  }
+
+  /// Read the cross node traffic counters of the nodes in use
+  std::vector<Traffic> traffic() const {
+    std::vector<Traffic> result;
+
+    for (const Node &node : nodes) {
+      std::istringstream stream(readFile(nodePath(node.id, "numastat")));
+      std::string name;
+      unsigned long long value;
+      Traffic counters;
+
+      while (stream >> name >> value) {
+        if (name == "numa_miss") counters.miss = value;
+        else if (name == "numa_foreign") counters.foreign = value;
+        else if (name == "other_node") counters.otherNode = value;
+      }
+      result.push_back(counters);
+    }
+    return result;
+  }
+
+  /// Print the cross node traffic since an earlier reading of the counters
+  void reportTraffic(const std::vector<Traffic> &before) const {
+    const std::vector<Traffic> after = traffic();
+
+    cout << "NUMA traffic during the build (pages, whole host):" << endl;
+    for (size_t i = 0; i < nodes.size() && i < before.size(); ++i) {
+      cout << "  node " << nodes[i].id << ": "
+           << after[i].miss - before[i].miss << " miss, "
+           << after[i].foreign - before[i].foreign << " foreign, "
+           << after[i].otherNode - before[i].otherNode << " other node" << endl;
+    }
+  }
+
+private:
+  /// The CPUs of a node
+  struct Node {
+    Node(int id, const std::vector<int> &cpus): id(id), cpus(cpus) {}
+
+    int id;
+    std::vector<int> cpus;
+  };
+
+  /// The run of tiles being taken by the threads of a node
+  struct Chunk {
+    Chunk(): next(0), end(0) {}
+
+    int next, end;
+  };
+
+  static std::string nodePath(int node, const char *file) {
+    return concat("/sys/devices/system/node/node", node, "/", file);
+  }
+
+  static std::string readFile(const std::string &filename) {
+    std::string contents;
+    FILE *fp = fopen(filename.c_str(), "r");
+    if (fp == NULL) return contents;
+
+    char buffer[4096];
+    size_t read;
+    while ((read = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+      contents.append(buffer, read);
+    }
+    fclose(fp);
+    return contents;
+  }
+
+  /// Parse a list of CPUs such as `0-15,32-47`
+  static std::vector<int> parseCpuList(const std::string &list) {
+    std::vector<int> cpus;
+    std::istringstream stream(list);
+    std::string range;
+
+    while (std::getline(stream, range, ',')) {
+      int first, last;
+      const int count = sscanf(range.c_str(), "%d-%d", &first, &last);
+      if (count < 1) continue;
+      if (count == 1) last = first;
+      for (int cpu = first; cpu <= last; ++cpu) {
+        cpus.push_back(cpu);
+      }
+    }
+    return cpus;
+  }
+
+  std::vector<Node> nodes;
+  std::vector<Chunk> chunks;
+  int threadCount;
+  static thread_local int currentNode; ///< The node of the calling thread, or -1
 };
 
+thread_local int NumaPlacement::currentNode = -1;
+
+static NumaPlacement numaPlacement;
+
 /**
  * Increment a TilerIterator whilst cooperating between threads
  *
@@ -255,24 +660,52 @@ public:
  * ensures the iterator is incremented to point to the next global index.  This
  * can therefore be called with different tiler iterators by different threads
  * to ensure all tiles are iterated over consecutively.  It assumes individual
- * tile iterators point to the same source GDAL dataset.
+ * tile iterators point to the same source GDAL dataset.  When the threads
+ * are placed on NUMA nodes those of a node take runs of tiles, except in top
+ * down builds where a tile may wait on its parent being built by any thread.
+ * Once the iteration is stopped every iterator is run to its end, so that the
+ * threads finish the tiles they hold and take no more.
  */
 static int globalIteratorIndex = 0; // keep track of where we are globally
+static bool chunkedIteration = false; // take runs of tiles per NUMA node?
+static atomic<bool> iterationStopped(false); // have the threads been told to stop?
 template<typename T> int
 incrementIterator(T &iter, int currentIndex) {
   static mutex mutex;        // ensure iterations occur serially between threads
 
   lock_guard<std::mutex> lock(mutex);
 
-  while (currentIndex < globalIteratorIndex) {
+  if (iterationStopped) {
+    while (!iter.exhausted()) {
+      ++iter;
+      ++currentIndex;
+    }
+    return currentIndex;
+  }
+
+  const int nextIndex = numaPlacement.next(globalIteratorIndex, chunkedIteration);
+  while (currentIndex < nextIndex) {
     ++iter;
     ++currentIndex;
   }
-  ++globalIteratorIndex;
 
   return currentIndex;
 }
 
+/// Restart the global iteration at an index
+static void
+resetIteratorIndex(int index) {
+  globalIteratorIndex = index;
+  iterationStopped = false;
+  numaPlacement.resetChunks();
+}
+
+/// Stop the threads of the build taking any more tiles
+static void
+stopIteration() {
+  iterationStopped = true;
+}
+
 /// Get a handle on the total number of tiles to be created
 static int iteratorSize = 0;    // the total number of tiles
 template<typename T> void
@@ -356,153 +789,253 @@ fileCopy(const std::string& sourceFilename, const std::string& targetFilename) {
   return fileSize > 0;
 }
 
-/// Handle the terrain metadata
-class TerrainMetadata {
-public:
-  TerrainMetadata() {
-  }
+/// The uploader of the tiles of a build to an object store, if any
+static unique_ptr<CTBObjectStoreUploader> tileUploader;
 
-  // Defines the valid tile indexes of a level in a Tileset
-  struct LevelInfo {
-  public:
-    LevelInfo() {
-      startX = startY = std::numeric_limits<int>::max();
-      finalX = finalY = std::numeric_limits<int>::min();
-    }
-    int startX, startY;
-    int finalX, finalY;
+/// The single GeoTIFF pyramid written by a `COGPyramid` build, if any
+static unique_ptr<COGPyramid> cogPyramid;
 
-    inline void add(const TileCoordinate *coordinate) {
-      startX = std::min(startX, (int)coordinate->x);
-      startY = std::min(startY, (int)coordinate->y);
-      finalX = std::max(finalX, (int)coordinate->x);
-      finalY = std::max(finalY, (int)coordinate->y);
+/// Write the layer.json metadata file, replacing any previous one atomically
+static void
+writeLayerFile(const TerrainMetadata &metadata, const TerrainBuild *command) {
+  std::string datasetName(command->getInputFilename());
+  datasetName = datasetName.substr(datasetName.find_last_of("/\\") + 1);
+  const size_t rfindpos = datasetName.rfind('.');
+  if (std::string::npos != rfindpos) datasetName = datasetName.erase(rfindpos);
+
+  // Each format of a multi-format build has its own layer.json
+  for (const string &format : command->getOutputFormats()) {
+    const string dirname = command->getFormatDir(format);
+    const std::string filename = concat(dirname, "layer.json");
+    const std::string temp_filename = tileUploader ? concat(CPLGenerateTempFilename("ctb-layer"), ".json") : concat(filename, ".tmp");
+
+    // Pruned tilesets rely on the child flags as levels aren't fully available
+    metadata.writeJsonFile(temp_filename, datasetName, format, std::string(command->profile), command->vertexNormals, !command->tilerOptions.pruneFlatTiles);
+
+    // An object is replaced atomically, so a local file is uploaded in its place
+    if (tileUploader) {
+      tileUploader->uploadFile(temp_filename, filename, "application/json");
+      VSIUnlink(temp_filename.c_str());
+      continue;
     }
-    inline void add(const LevelInfo &level) {
-      startX = std::min(startX, level.startX);
-      startY = std::min(startY, level.startY);
-      finalX = std::max(finalX, level.finalX);
-      finalY = std::max(finalY, level.finalY);
+
+    if (VSIRename(temp_filename.c_str(), filename.c_str()) != 0) {
+      throw CTBException("Could not rename temporary metadata file");
     }
-  };
-  std::vector<LevelInfo> levels;
+  }
+}
+
+static BuildCheckpoint checkpoint;
+
+/**
+ * Publish the layer.json metadata file as zoom levels are completed
+ *
+ * When building the lowest zoom levels first the tileset is usable before the
+ * deeper zoom levels have been created.  This keeps count of the tiles finished
+ * by all threads for each zoom level and rewrites the layer.json file whenever
+ * a zoom level, and all of the levels above it, are complete.
+ */
+class LevelProgress {
+public:
+  LevelProgress():
+    command(NULL),
+    publishedZoom(-1)
+  {}
+
+  /// Forget the state of any previous build
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
 
-  // Defines the bounding box covered by the Terrain
-  CRSBounds bounds;
+    command = NULL;
+    levels.clear();
+    expected.clear();
+    completed.clear();
+    publishedZoom = -1;
+    metadata = TerrainMetadata();
+  }
 
-  // Add metadata of the specified Coordinate
-  void add(const Grid &grid, const TileCoordinate *coordinate) {
-    CRSBounds tileBounds = grid.tileBounds(*coordinate);
-    i_zoom zoom = coordinate->zoom;
+  /// Set the zoom levels to be tracked from an iterator (only the first call counts)
+  void init(const GridIterator &iter, const GDALTiler &tiler, const TerrainBuild *buildCommand, i_zoom startZoom, i_zoom endZoom, const BuildCheckpoint &previous) {
+    std::lock_guard<std::mutex> lock(mutex);
 
-    if ((1 + zoom) > levels.size()) {
-      for (size_t i = 0; i <= zoom; i++) {
-        levels.push_back(LevelInfo());
+    if (command == NULL) {
+      command = buildCommand;
+      grid = iter.getGrid();
+      metadata.setAvailable(tiler, startZoom);
+      for (i_zoom zoom = 0; zoom <= startZoom; ++zoom) {
+        levels.push_back(iter.getTileBounds(zoom));
+        expected.push_back((zoom < endZoom) ? 0 : iter.getSize(zoom));
+        completed.push_back(previous.finishedInZoom(zoom));
       }
+      publishedZoom = (int) endZoom - 1;
     }
-    LevelInfo &level = levels[zoom];
-    level.add(coordinate);
+  }
+
+  /// Record a finished tile, publishing the metadata of any completed zoom levels
+  void add(const TileCoordinate *coordinate) {
+    std::lock_guard<std::mutex> lock(mutex);
+    bool publish = false;
 
-    if (bounds.getMaxX() == bounds.getMinX()) {
-      bounds = tileBounds;
+    ++completed[coordinate->zoom];
+
+    while (publishedZoom + 1 < (int) levels.size()
+           && completed[publishedZoom + 1] == expected[publishedZoom + 1]) {
+      const TileBounds &level = levels[++publishedZoom];
+      const TileCoordinate ll(publishedZoom, level.getLowerLeft()),
+        ur(publishedZoom, level.getUpperRight());
+
+      metadata.add(grid, &ll);
+      metadata.add(grid, &ur);
+      publish = true;
     }
-    else {
-      bounds.setMinX(std::min(bounds.getMinX(), tileBounds.getMinX()));
-      bounds.setMinY(std::min(bounds.getMinY(), tileBounds.getMinY()));
-      bounds.setMaxX(std::max(bounds.getMaxX(), tileBounds.getMaxX()));
-      bounds.setMaxY(std::max(bounds.getMaxY(), tileBounds.getMaxY()));
+
+    if (publish) {
+      writeLayerFile(metadata, command);
     }
   }
 
-  // Add metadata info
-  void add(const TerrainMetadata &otherMetadata) {
-    if (otherMetadata.levels.size() > 0) {
-      const CRSBounds &otherBounds = otherMetadata.bounds;
+protected:
+  std::mutex mutex;
+  const TerrainBuild *command;      ///< The options of the build
+  Grid grid;                        ///< The grid being tiled
+  std::vector<TileBounds> levels;   ///< The tile extent of each zoom level
+  std::vector<i_tile> expected;     ///< The number of tiles in each zoom level
+  std::vector<i_tile> completed;    ///< The number of tiles finished in each zoom level
+  int publishedZoom;                ///< The deepest zoom level written to layer.json
+  TerrainMetadata metadata;         ///< The metadata of the published zoom levels
+};
 
-      for (size_t i = 0, icount = (otherMetadata.levels.size() - levels.size()); i < icount; i++) {
-        levels.push_back(LevelInfo());
-      }
-      for (size_t i = 0; i < levels.size(); i++) {
-        levels[i].add(otherMetadata.levels[i]);
-      }
+static LevelProgress levelProgress;
 
-      bounds.setMinX(std::min(bounds.getMinX(), otherBounds.getMinX()));
-      bounds.setMinY(std::min(bounds.getMinY(), otherBounds.getMinY()));
-      bounds.setMaxX(std::max(bounds.getMaxX(), otherBounds.getMaxX()));
-      bounds.setMaxY(std::max(bounds.getMaxY(), otherBounds.getMaxY()));
-    }
+/**
+ * Skip the descendants of leaf tiles
+ *
+ * When pruning, the tiler clears the child flags of tiles whose descendants
+ * would add no detail.  The zoom levels are built from the top down and such
+ * leaf tiles are recorded so that tiles below them are skipped.  As a zoom
+ * level must be complete before its leaves are known, threads wait for the
+ * previous zoom level to be finished before starting on the next.
+ */
+class TilePruner {
+public:
+  TilePruner():
+    enabled(false),
+    aborted(false),
+    startZoom(0),
+    endZoom(0)
+  {}
+
+  /// Forget the state of any previous build
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    enabled = aborted = false;
+    expected.clear();
+    completed.clear();
+    leaves.clear();
   }
 
-  /// Output the layer.json metadata file
-  /// http://help.agi.com/TerrainServer/RESTAPIGuide.html
-  /// Example:
-  /// https://assets.agi.com/stk-terrain/v1/tilesets/world/tiles/layer.json
-  void writeJsonFile(const std::string &filename, const std::string &datasetName, const std::string &outputFormat = "Terrain", const std::string &profile = "geodetic", bool writeVertexNormals = false) const {
-    FILE *fp = fopen(filename.c_str(), "w");
+  /// Set the zoom levels to be tracked from an iterator (only the first call counts)
+  void init(const GridIterator &iter, i_zoom start, i_zoom end) {
+    std::lock_guard<std::mutex> lock(mutex);
 
-    if (fp == NULL) {
-      throw CTBException("Failed to open metadata file");
+    if (!enabled) {
+      startZoom = start;
+      endZoom = end;
+      for (i_zoom zoom = 0; zoom <= startZoom; ++zoom) {
+        expected.push_back((zoom < endZoom) ? 0 : iter.getSize(zoom));
+        completed.push_back(0);
+      }
+      leaves.resize(startZoom + 1);
+      enabled = true;
     }
+  }
+
+  /// Is the build being pruned?
+  bool isEnabled() const {
+    return enabled;
+  }
 
-    fprintf(fp, "{\n");
-    fprintf(fp, "  \"tilejson\": \"2.1.0\",\n");
-    fprintf(fp, "  \"name\": \"%s\",\n", datasetName.c_str());
-    fprintf(fp, "  \"description\": \"\",\n");
-    fprintf(fp, "  \"version\": \"1.1.0\",\n");
+  /// Is an ancestor of a tile a leaf?  This waits for the zoom level above to be finished.
+  bool isPruned(const TileCoordinate *coordinate) {
+    if (!enabled || coordinate->zoom <= endZoom) return false;
 
-    if (strcmp(outputFormat.c_str(), "Terrain") == 0) {
-      fprintf(fp, "  \"format\": \"heightmap-1.0\",\n");
-    }
-    else if (strcmp(outputFormat.c_str(), "Mesh") == 0) {
-      fprintf(fp, "  \"format\": \"quantized-mesh-1.0\",\n");
-    }
-    else {
-      fprintf(fp, "  \"format\": \"GDAL\",\n");
-    }
-    fprintf(fp, "  \"attribution\": \"\",\n");
-    fprintf(fp, "  \"schema\": \"tms\",\n");
-    if (writeVertexNormals) {
-      fprintf(fp, "  \"extensions\": [ \"octvertexnormals\" ],\n");
+    std::unique_lock<std::mutex> lock(mutex);
+    const i_zoom parentZoom = coordinate->zoom - 1;
+    finishedCondition.wait(lock, [&]() {
+      return aborted || completed[parentZoom] >= expected[parentZoom];
+    });
+
+    for (i_zoom zoom = parentZoom, shift = 1; zoom >= endZoom; --zoom, ++shift) {
+      if (leaves[zoom].count(key(coordinate->x >> shift, coordinate->y >> shift))) {
+        return true;
+      }
+      if (zoom == 0) break;
     }
-    fprintf(fp, "  \"tiles\": [ \"{z}/{x}/{y}.terrain?v={version}\" ],\n");
+    return false;
+  }
 
-    if (strcmp(profile.c_str(), "geodetic") == 0) {
-      fprintf(fp, "  \"projection\": \"EPSG:4326\",\n");
+  /// Record a finished tile, which may be a leaf
+  void add(const TileCoordinate *coordinate, bool leaf) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    if (leaf && coordinate->zoom < startZoom) {
+      leaves[coordinate->zoom].insert(key(coordinate->x, coordinate->y));
     }
-    else {
-      fprintf(fp, "  \"projection\": \"EPSG:3857\",\n");
+    if (++completed[coordinate->zoom] == expected[coordinate->zoom]) {
+      finishedCondition.notify_all();
     }
-    fprintf(fp, "  \"bounds\": [ %.2f, %.2f, %.2f, %.2f ],\n",
-      bounds.getMinX(),
-      bounds.getMinY(),
-      bounds.getMaxX(),
-      bounds.getMaxY());
-
-    fprintf(fp, "  \"available\": [\n");
-    for (size_t i = 0, icount = levels.size(); i < icount; i++) {
-      const LevelInfo &level = levels[i];
+  }
 
-      if (i > 0)
-        fprintf(fp, "   ,[ ");
-      else
-        fprintf(fp, "    [ ");
+  /// Stop waiting for zoom levels to be finished, as a thread has failed
+  void abort() {
+    std::lock_guard<std::mutex> lock(mutex);
 
-      if (level.finalX >= level.startX) {
-        fprintf(fp, "{ \"startX\": %li, \"startY\": %li, \"endX\": %li, \"endY\": %li }",
-          level.startX,
-          level.startY,
-          level.finalX,
-          level.finalY);
-      }
-      fprintf(fp, " ]\n");
-    }
-    fprintf(fp, "  ]\n");
+    aborted = true;
+    finishedCondition.notify_all();
+  }
 
-    fprintf(fp, "}\n");
-    fclose(fp);
+protected:
+  /// Identify a tile within a zoom level
+  static uint64_t key(i_tile x, i_tile y) {
+    return ((uint64_t) x << 32) | y;
   }
+
+  std::mutex mutex;
+  std::condition_variable finishedCondition;
+  bool enabled;                     ///< Is the build being pruned?
+  bool aborted;                     ///< Has a thread failed?
+  i_zoom startZoom, endZoom;        ///< The zoom levels of the build
+  std::vector<i_tile> expected;     ///< The number of tiles in each zoom level
+  std::vector<i_tile> completed;    ///< The number of tiles finished in each zoom level
+  std::vector<std::unordered_set<uint64_t>> leaves; ///< The leaf tiles of each zoom level
 };
 
+static TilePruner pruner;
+
+/// The compressed tiles shared by all threads and builds
+static CTBCompressionCache compressionCache;
+
+/// Get the compression cache to be used by the tile serializers, if any
+static CTBCompressionCache *
+tileCompressionCache() {
+  return (compressionCache.capacity() > 0) ? &compressionCache : NULL;
+}
+
+/// Create the serializer of the tiles below a directory, or an object store prefix
+static CTBFileTileSerializer *
+createFileSerializer(const string &dirname, const TerrainBuild *command) {
+  CTBFileTileSerializer *serializer;
+
+  if (tileUploader) {
+    serializer = new CTBObjectStoreTileSerializer(dirname, command->resume, *tileUploader);
+  } else {
+    serializer = new CTBFileTileSerializer(dirname, command->resume);
+  }
+  serializer->setCompressionCache(tileCompressionCache());
+  return serializer;
+}
+
 /// Create an empty root temporary elevation file (GTiff)
 static std::string 
 createEmptyRootElevationFile(std::string &fileName, const Grid &grid, const TileCoordinate& coord) {
@@ -568,61 +1101,846 @@ createEmptyRootElevationFile(std::string &fileName, const Grid &grid, const Tile
   return fileName;
 }
 
-/// Output GDAL tiles represented by a tiler to a directory
-static void
-buildGDAL(GDALSerializer &serializer, const RasterTiler &tiler, TerrainBuild *command, TerrainMetadata *metadata) {
-  GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName(command->outputFormat);
+/**
+ * Prefetch the source pixels of groups of tiles from remote datasets
+ *
+ * A warp reads its source block by block, which for a dataset read over HTTP
+ * (e.g. a cloud optimised GeoTIFF through `/vsicurl/` or `/vsis3/`) means a
+ * request per block, with latency rather than bandwidth limiting the build.
+ * Instead the first thread to reach a group of `SUPER_TILE` x `SUPER_TILE`
+ * tiles advises the dataset of the source window of the whole group (see
+ * `GDALTiler::adviseRead`), letting GDAL fetch its blocks with merged range
+ * requests issued in parallel.  The fetched blocks land in the process wide
+ * cache of the GDAL network file systems, where the threads building the
+ * neighbouring tiles find them.  Groups needing more than `PIXEL_LIMIT`
+ * source pixels, such as low zoom levels without overviews, are left to be
+ * read on demand.
+ */
+class SourcePrefetch {
+public:
+  /// The tiles along each side of a group
+  static const int SUPER_TILE = 4;
 
-  if (poDriver == NULL) {
-    throw CTBException("Could not retrieve GDAL driver");
+  /// The most source pixels prefetched for a group
+  static const double PIXEL_LIMIT;
+
+  SourcePrefetch():
+    enabled(false),
+    advised(0),
+    shared(0),
+    skipped(0)
+  {}
+
+  /// Forget the groups of a previous build, prefetching for a remote dataset
+  void reset(bool remote) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    enabled = remote;
+    groups.clear();
+    advised = shared = skipped = 0;
   }
 
-  if (poDriver->pfnCreateCopy == NULL) {
-    throw CTBException("The GDAL driver must be write enabled, specifically supporting 'CreateCopy'");
+  /// Is the dataset read over a network?
+  static bool isRemote(const char *filename) {
+    static const char *prefixes[] = {"/vsicurl", "/vsis3", "/vsigs", "/vsiaz", "/vsioss", "/vsiswift", "/vsiwebhdfs"};
+
+    for (const char *prefix : prefixes) {
+      if (strstr(filename, prefix) != NULL) return true; // also within VRT or compressed paths
+    }
+    return false;
   }
 
-  const char *extension = poDriver->GetMetadataItem(GDAL_DMD_EXTENSION);
-  i_zoom startZoom = (command->startZoom < 0) ? tiler.maxZoomLevel() : command->startZoom,
-    endZoom = (command->endZoom < 0) ? 0 : command->endZoom;
+  /// Prefetch the group of a tile unless another thread already has
+  void advise(const GDALTiler &tiler, GDALDataset *dataset, const TileCoordinate &coord) {
+    if (!enabled) return;
 
-  RasterIterator iter(tiler, startZoom, endZoom);
-  int currentIndex = incrementIterator(iter, 0);
-  setIteratorSize(iter);
+    const int shift = (coord.zoom >= 2) ? 2 : coord.zoom; // log2(SUPER_TILE)
+    const TileCoordinate group(coord.zoom - shift, coord.x >> shift, coord.y >> shift);
+    const uint64_t key = ((uint64_t) coord.zoom << 58) | ((uint64_t) group.x << 29) | group.y;
 
-  while (!iter.exhausted()) {
-    const TileCoordinate *coordinate = iter.GridIterator::operator*();
-    if (metadata) metadata->add(tiler.grid(), coordinate);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!groups.insert(key).second) {
+        ++shared;
+        return;
+      }
+    }
 
-    if (serializer.mustSerializeCoordinate(coordinate)) {
-      GDALTile *tile = *iter;
-      serializer.serializeTile(tile, poDriver, extension, command->creationOptions);
-      delete tile;
+    if (tiler.sourcePixelsForZoom(coord.zoom) * (1 << (2 * shift)) > PIXEL_LIMIT) {
+      ++skipped;
+      return;
     }
 
-    currentIndex = incrementIterator(iter, currentIndex);
-    showProgress(currentIndex);
+    const int size = tiler.grid().tileSize() << shift;
+    tiler.adviseRead(dataset, tiler.grid().tileBounds(group), size, size);
+    ++advised;
   }
-}
 
-/// Output terrain tiles represented by a tiler to a directory
-static void
-buildTerrain(TerrainSerializer &serializer, const TerrainTiler &tiler, TerrainBuild *command, TerrainMetadata *metadata) {
-  i_zoom startZoom = (command->startZoom < 0) ? tiler.maxZoomLevel() : command->startZoom,
+  /// Print what was prefetched along with the network statistics of GDAL
+  void report() const {
+    if (!enabled) return;
+
+    cout << "Source prefetch: " << advised << " tile groups prefetched, " << shared
+         << " tiles found their group already prefetched, " << skipped << " groups too large to prefetch" << endl;
+
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,7,0)
+    char *stats = VSINetworkStatsGetAsSerializedJSON(NULL);
+    CPLJSONDocument document;
+    if (stats && document.LoadMemory(stats)) {
+      const CPLJSONObject get = document.GetRoot().GetObj("methods/GET");
+      if (get.IsValid()) {
+        cout << "Source requests: " << get.GetLong("count") << " GET requests downloading "
+             << get.GetLong("downloaded_bytes") / (1024 * 1024) << " MB" << endl;
+      }
+    }
+    CPLFree(stats);
+#endif
+  }
+
+protected:
+  std::mutex mutex;
+  bool enabled;
+  std::unordered_set<uint64_t> groups; ///< The groups already prefetched
+  std::atomic<uint64_t> advised;       ///< The groups prefetched
+  std::atomic<uint64_t> shared;        ///< The tiles whose group was already prefetched
+  std::atomic<uint64_t> skipped;       ///< The groups too large to prefetch
+};
+
+const double SourcePrefetch::PIXEL_LIMIT = 4096.0 * 4096.0;
+
+static SourcePrefetch sourcePrefetch;
+
+/**
+ * Tune the GDAL network file systems for reading a remote dataset
+ *
+ * Options already set by the user are kept.  Listing the directory of the
+ * dataset on opening is avoided, the cache of fetched blocks shared by the
+ * threads is enlarged and requests are multiplexed over HTTP/2 where the
+ * server supports it.
+ */
+static void
+configureRemoteSource() {
+  static const char *defaults[][2] = {
+    {"GDAL_DISABLE_READDIR_ON_OPEN", "EMPTY_DIR"},
+    {"CPL_VSIL_CURL_CACHE_SIZE", "268435456"}, // 256 MB
+    {"GDAL_HTTP_MULTIPLEX", "YES"},
+    {"GDAL_HTTP_MERGE_CONSECUTIVE_RANGES", "YES"},
+    {"CPL_VSIL_NETWORK_STATS_ENABLED", "YES"}
+  };
+
+  for (const auto &option : defaults) {
+    if (CPLGetConfigOption(option[0], NULL) == NULL) {
+      CPLSetConfigOption(option[0], option[1]);
+    }
+  }
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(3,7,0)
+  VSINetworkStatsReset();
+#endif
+}
+
+/**
+ * Share the reading of the heights of expensive tiles between threads
+ *
+ * A tile whose warp reads many source pixels, such as a low zoom tile of a
+ * dataset without overviews, can take far longer than any other tile.  The
+ * heights of such a tile are read in strips which are queued for any idle
+ * thread to read using its own tiler and dataset, while the thread owning the
+ * tile reads them as well.  Threads which have run out of tiles keep helping
+ * until every thread has finished, so the expensive tiles at the end of a
+ * build no longer leave all but one thread waiting.
+ */
+class StripScheduler {
+public:
+  /// Read a strip of heights with the tiler and dataset of the reading thread
+  typedef std::function<void(const GDALTiler &, GDALDataset *)> Strip;
+
+  StripScheduler():
+    workers(0),
+    active(0)
+  {}
+
+  /// Prepare for a build run by a number of threads
+  void start(int threadCount) {
+    std::lock_guard<std::mutex> lock(mutex);
+
+    workers = active = threadCount;
+    jobs.clear();
+  }
+
+  /// Get the number of threads running the build
+  int workerCount() const {
+    return workers;
+  }
+
+  /// Read some strips with the help of idle threads, returning once all are read
+  void run(const vector<Strip> &strips, const GDALTiler &tiler, GDALDataset *dataset) {
+    std::shared_ptr<Job> job = std::make_shared<Job>(strips);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      jobs.push_back(job);
+    }
+    changed.notify_all();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      if (job->next < job->strips.size()) {
+        readStrip(job, lock, tiler, dataset);
+      } else if (job->remaining == 0) {
+        break;
+      } else {
+        changed.wait(lock);
+      }
+    }
+
+    if (job->error) {
+      std::rethrow_exception(job->error);
+    }
+  }
+
+  /// Record that a thread has run out of tiles, helping other threads until all have too
+  void finish(const GDALTiler *tiler) {
+    std::unique_lock<std::mutex> lock(mutex);
+
+    --active;
+    changed.notify_all();
+
+    if (tiler == NULL) {
+      return;                   // the thread cannot read heights
+    }
+
+    while (active > 0 || !jobs.empty()) {
+      if (!jobs.empty()) {
+        readStrip(jobs.front(), lock, *tiler, tiler->dataset());
+      } else {
+        changed.wait(lock);
+      }
+    }
+  }
+
+protected:
+  /// The strips of a tile
+  struct Job {
+    Job(const vector<Strip> &strips):
+      strips(strips),
+      next(0),
+      remaining(strips.size())
+    {}
+
+    vector<Strip> strips;
+    size_t next;                ///< The next strip to be read
+    size_t remaining;           ///< The number of strips not yet read
+    std::exception_ptr error;   ///< The first error reading a strip
+  };
+
+  /// Read the next strip of a job, unlocking whilst reading
+  void readStrip(std::shared_ptr<Job> job, std::unique_lock<std::mutex> &lock, const GDALTiler &tiler, GDALDataset *dataset) {
+    const Strip &strip = job->strips[job->next++];
+    if (job->next == job->strips.size()) {
+      jobs.erase(std::find(jobs.begin(), jobs.end(), job));
+    }
+
+    lock.unlock();
+    std::exception_ptr error;
+    try {
+      strip(tiler, dataset);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    lock.lock();
+
+    if (error && !job->error) {
+      job->error = error;
+    }
+    --job->remaining;
+    changed.notify_all();
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;  ///< Signals new strips, finished strips and finished threads
+  std::deque<std::shared_ptr<Job>> jobs; ///< The jobs with strips waiting to be read
+  int workers;                      ///< The number of threads running the build
+  int active;                       ///< The number of threads still creating tiles
+};
+
+static StripScheduler stripScheduler;
+
+/// The number of source pixels read by a tile above which its heights are read in strips
+static const double STRIP_SOURCE_PIXELS = 4096.0 * 4096.0;
+
+/// The fewest rows of heights in a strip
+static const ctb::i_tile STRIP_MIN_ROWS = 8;
+
+/// The directory of the height cache of a build, which is empty if it has none
+static string
+heightCacheDir(const TerrainBuild *command) {
+  return command->heightCacheDir ? command->heightCacheDir : "";
+}
+
+/// Identify what changes the cached heights of a build beyond its tiler
+static string
+heightCacheKey(const TerrainBuild *command) {
+  if (command->geoidFile == NULL) {
+    return "";
+  }
+
+  // An edited geoid grid changes the heights as an edited source does
+  VSIStatBufL stat;
+  if (VSIStatL(command->geoidFile, &stat) != 0) {
+    return command->geoidFile;
+  }
+  return concat(command->geoidFile, " ", (long long) stat.st_size, " ", (long long) stat.st_mtime);
+}
+
+/**
+ * Read the heights of expensive tiles in strips shared between threads
+ *
+ * Tiles reading more than `STRIP_SOURCE_PIXELS` source pixels are split into
+ * a strip per thread (see `StripScheduler`).  Should a strip fail, for
+ * instance on the integer overflow that the overviews of the base class work
+ * around, the whole tile is read as usual.  Tiles of memory mapped sources
+ * are read from the map instead (see `GDALMappedDatasetReader`).
+ */
+class StripDatasetReader : public GDALMappedDatasetReader {
+public:
+  StripDatasetReader(const GDALTiler &tiler):
+    GDALMappedDatasetReader(tiler)
+  {}
+
+  virtual float *
+  readRasterHeights(GDALDataset *dataset, const TileCoordinate &coord, ctb::i_tile tileSizeX, ctb::i_tile tileSizeY) override {
+    const int stripCount = std::min(stripScheduler.workerCount(), (int) (tileSizeY / STRIP_MIN_ROWS));
+    float *mappedHeights = readMappedHeights(dataset, coord, tileSizeX, tileSizeY);
+    if (mappedHeights) {
+      adjustHeights(poTiler, dataset, coord, tileSizeX, tileSizeY, mappedHeights);
+      return mappedHeights;
+    }
+
+    sourcePrefetch.advise(poTiler, dataset, coord);
+
+    if (stripCount < 2 || poTiler.sourcePixelsForZoom(coord.zoom) < STRIP_SOURCE_PIXELS) {
+      return GDALDatasetReaderWithOverviews::readRasterHeights(dataset, coord, tileSizeX, tileSizeY);
+    }
+
+    float *rasterHeights = (float *) CPLCalloc(tileSizeX * tileSizeY, sizeof(float));
+    const ctb::i_tile rowsPerStrip = (tileSizeY + stripCount - 1) / stripCount;
+    vector<StripScheduler::Strip> strips;
+
+    for (ctb::i_tile firstRow = 0; firstRow < tileSizeY; firstRow += rowsPerStrip) {
+      const ctb::i_tile rowCount = std::min(rowsPerStrip, tileSizeY - firstRow);
+
+      strips.push_back([=](const GDALTiler &tiler, GDALDataset *stripDataset) {
+        GDALDatasetReader::readRasterHeights(tiler, stripDataset, coord, tileSizeX, tileSizeY, firstRow, rowCount, rasterHeights);
+      });
+    }
+
+    try {
+      stripScheduler.run(strips, poTiler, dataset);
+    } catch (CTBException &) {
+      CPLFree(rasterHeights);
+      return GDALDatasetReaderWithOverviews::readRasterHeights(dataset, coord, tileSizeX, tileSizeY);
+    }
+
+    adjustHeights(poTiler, dataset, coord, tileSizeX, tileSizeY, rasterHeights);
+    return rasterHeights;
+  }
+};
+
+/**
+ * Order the zoom levels by the estimated cost of their tiles
+ *
+ * The levels whose tiles read the most source pixels come first, so that the
+ * longest tiles are not left until the end of the build (the longest
+ * processing time first rule).  Levels whose tiles read no more source pixels
+ * than they have heights cost the same and keep their deepest first order.
+ */
+static vector<i_zoom>
+zoomOrderByCost(const GDALTiler &tiler, i_zoom startZoom, i_zoom endZoom) {
+  const double tilePixels = (double) tiler.grid().tileSize() * tiler.grid().tileSize();
+  vector<std::pair<double, i_zoom>> levels;
+
+  for (int zoom = startZoom; zoom >= (int) endZoom; --zoom) {
+    levels.push_back(std::make_pair(std::max(tiler.sourcePixelsForZoom(zoom), tilePixels), (i_zoom) zoom));
+  }
+  std::stable_sort(levels.begin(), levels.end(), [](const std::pair<double, i_zoom> &a, const std::pair<double, i_zoom> &b) {
+    return a.first > b.first;
+  });
+
+  vector<i_zoom> order;
+  for (const auto &level : levels) {
+    order.push_back(level.second);
+  }
+  return order;
+}
+
+/// The block of tiles being built by a worker for a coordinator
+struct WorkBlock {
+  WorkBlock():
+    active(false)
+  {}
+
+  bool active;                  ///< Is a block being built?
+  TileBounds tiles;             ///< The tiles of the block
+  TerrainMetadata metadata;     ///< The metadata of the tiles built
+};
+
+static WorkBlock workBlock;
+
+/// Create an iterator over the tiles of a build, ordering the zoom levels by cost where the order is free
+template <typename T, typename Tiler>
+static T
+buildIterator(const Tiler &tiler, const TerrainBuild *command, i_zoom startZoom, i_zoom endZoom) {
+  T iter(tiler, startZoom, endZoom, command->isTopDown());
+
+  if (!command->isTopDown()) {
+    iter.setZoomOrder(zoomOrderByCost(tiler, startZoom, endZoom));
+  }
+  if (workBlock.active) {
+    iter.setTileFilter(workBlock.tiles);
+  }
+
+  // The zoom levels of a variable depth dataset only cover its fine enough sources
+  if (tiler.hasVariableDepth()) {
+    for (i_zoom zoom = endZoom; zoom <= startZoom; ++zoom) {
+      iter.setTileExtents(zoom, tiler.tileBoundsOfSources(zoom));
+    }
+  }
+  return iter;
+}
+
+/// The pixels of a raster tile, band by band in their native data type
+struct RasterPixels {
+  int width, height, bands;
+  GDALDataType type;
+  int typeSize;                 ///< The bytes of a pixel of a band
+  std::vector<unsigned char> data;
+
+  /// Get the bytes of a band
+  const unsigned char *
+  band(int i) const {
+    return data.data() + (size_t) i * width * height * typeSize;
+  }
+};
+
+/// What the pixels of a raster tile show
+enum RasterContent {
+  MIXED,                        ///< Pixels of different colours
+  SOLID,                        ///< A single colour
+  EMPTY                         ///< Nothing: every pixel is transparent or without data
+};
+
+/// Read the pixels of a tile, so that its warped dataset is only computed once
+static void
+readRasterPixels(GDALDataset *dataset, RasterPixels &pixels) {
+  pixels.width = dataset->GetRasterXSize();
+  pixels.height = dataset->GetRasterYSize();
+  pixels.bands = dataset->GetRasterCount();
+  pixels.type = dataset->GetRasterBand(1)->GetRasterDataType();
+  pixels.typeSize = GDALGetDataTypeSizeBytes(pixels.type);
+  pixels.data.resize((size_t) pixels.width * pixels.height * pixels.bands * pixels.typeSize);
+
+  if (dataset->RasterIO(GF_Read, 0, 0, pixels.width, pixels.height,
+                        (void *) pixels.data.data(), pixels.width, pixels.height, pixels.type,
+                        pixels.bands, NULL, 0, 0, 0) != CE_None) {
+    throw CTBException("Could not read GDAL tile");
+  }
+}
+
+/**
+ * Find whether the pixels of a tile are all transparent or without data, or
+ * all of one colour
+ *
+ * A band holds a single value if its bytes equal themselves shifted by one
+ * pixel, which `memcmp` compares with the vector instructions of the host.
+ * A tile is empty if its alpha band is uniformly 0 or, without an alpha band,
+ * if every band is uniformly at the no data value used by the warper (-32768,
+ * clamped to the data type, for bands without one).
+ */
+static RasterContent
+scanRasterPixels(const RasterPixels &pixels, GDALDataset *source) {
+  const size_t pixelCount = (size_t) pixels.width * pixels.height;
+  std::vector<unsigned char> noData(pixels.typeSize);
+  bool uniform = true, empty = true;
+
+  for (int i = 0; i < pixels.bands; i++) {
+    const unsigned char *band = pixels.band(i);
+    const bool uniformBand = pixelCount < 2
+      || memcmp(band, band + pixels.typeSize, (pixelCount - 1) * pixels.typeSize) == 0;
+    GDALRasterBand *poBand = source->GetRasterBand(i + 1);
+
+    if (poBand->GetColorInterpretation() == GCI_AlphaBand) {
+      const std::vector<unsigned char> transparent(pixels.typeSize, 0);
+      if (uniformBand && memcmp(band, transparent.data(), pixels.typeSize) == 0) {
+        return EMPTY;
+      }
+      empty = false;
+    } else if (empty) {
+      int bGotNoData = FALSE;
+      double noDataValue = poBand->GetNoDataValue(&bGotNoData);
+      if (!bGotNoData) noDataValue = -32768;
+
+      GDALCopyWords(&noDataValue, GDT_Float64, 0, noData.data(), pixels.type, 0, 1);
+      empty = uniformBand && memcmp(band, noData.data(), pixels.typeSize) == 0;
+    }
+
+    uniform = uniform && uniformBand;
+  }
+
+  return (empty && pixels.bands > 0) ? EMPTY : (uniform ? SOLID : MIXED);
+}
+
+/// Create an in memory dataset of the pixels read from a warped tile dataset
+static GDALDataset *
+createPixelsDataset(GDALDataset *warped, const RasterPixels &pixels) {
+  GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+  if (poDriver == NULL) {
+    throw CTBException("Could not retrieve MEM GDAL driver");
+  }
+
+  GDALDataset *poDataset = poDriver->Create("", pixels.width, pixels.height, pixels.bands, pixels.type, NULL);
+  if (poDataset == NULL) {
+    throw CTBException("Could not create the in memory tile dataset");
+  }
+
+  double adfGeoTransform[6];
+  if (warped->GetGeoTransform(adfGeoTransform) == CE_None) {
+    poDataset->SetGeoTransform(adfGeoTransform);
+  }
+  poDataset->SetProjection(warped->GetProjectionRef());
+
+  for (int i = 1; i <= pixels.bands; i++) {
+    GDALRasterBand *poWarpedBand = warped->GetRasterBand(i),
+      *poBand = poDataset->GetRasterBand(i);
+    int bGotNoData = FALSE;
+    const double noDataValue = poWarpedBand->GetNoDataValue(&bGotNoData);
+
+    if (bGotNoData) poBand->SetNoDataValue(noDataValue);
+    poBand->SetColorInterpretation(poWarpedBand->GetColorInterpretation());
+  }
+
+  if (poDataset->RasterIO(GF_Write, 0, 0, pixels.width, pixels.height,
+                          (void *) pixels.data.data(), pixels.width, pixels.height, pixels.type,
+                          pixels.bands, NULL, 0, 0, 0) != CE_None) {
+    GDALClose(poDataset);
+    throw CTBException("Could not write the pixels to the in memory tile dataset");
+  }
+  return poDataset;
+}
+
+/**
+ * The encoded single colour tiles shared by all threads of a build
+ *
+ * Tiles of one colour, such as those over the sea or transparent tiles at the
+ * edges of the coverage, encode to the same bytes wherever they are, provided
+ * the format holds no georeferencing.  Each colour is therefore encoded once
+ * per build and its bytes are written for every tile of that colour.
+ */
+class SolidTileCache {
+public:
+  /// The bytes of an encoded tile
+  typedef std::shared_ptr<const std::vector<unsigned char>> Blob;
+
+  /// The most colours held by the cache
+  static const size_t MAX_COLOURS = 1024;
+
+  SolidTileCache():
+    enabled(false),
+    hitCount(0),
+    missCount(0),
+    skipCount(0)
+  {}
+
+  /// Forget the tiles of a previous build, caching those of formats without georeferencing
+  void
+  reset(const char *format) {
+    std::lock_guard<std::mutex> lock(mutex);
+    blobs.clear();
+    enabled = EQUAL(format, "PNG") || EQUAL(format, "JPEG") || EQUAL(format, "WEBP") || EQUAL(format, "GIF");
+    hitCount = missCount = skipCount = 0;
+  }
+
+  /// Can the encoding of tiles be shared?
+  bool
+  isEnabled() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return enabled;
+  }
+
+  /// Stop sharing encoded tiles, as the tiles are not encoded to single files
+  void
+  disable() {
+    std::lock_guard<std::mutex> lock(mutex);
+    enabled = false;
+    blobs.clear();
+  }
+
+  /// Get the encoded tile of a colour, if it has been encoded
+  Blob
+  find(const std::string &colour) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = blobs.find(colour);
+    if (it == blobs.end()) {
+      ++missCount;
+      return Blob();
+    }
+    ++hitCount;
+    return it->second;
+  }
+
+  /// Store the encoded tile of a colour
+  void
+  store(const std::string &colour, const Blob &blob) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (enabled && blobs.size() < MAX_COLOURS) {
+      blobs[colour] = blob;
+    }
+  }
+
+  /// Count an empty tile that was skipped
+  void
+  skip() {
+    ++skipCount;
+  }
+
+  uint64_t hits() const { return hitCount; }
+  uint64_t misses() const { return missCount; }
+  uint64_t skipped() const { return skipCount; }
+
+protected:
+  std::mutex mutex;
+  bool enabled;                 ///< Does the output format hold no georeferencing?
+  std::map<std::string, Blob> blobs; ///< The encoded tiles by colour
+  std::atomic<uint64_t> hitCount, missCount, skipCount;
+};
+
+static SolidTileCache solidTiles;
+
+/**
+ * Fill the holes and convert the datum of the heights of a raster tile, as is
+ * done for the other formats
+ *
+ * The heights are adjusted as floats and written back in the data type of the
+ * tile.
+ */
+static void
+adjustRasterPixels(const RasterTiler &tiler, const TileCoordinate &coord, RasterPixels &pixels) {
+  const int pixelCount = pixels.width * pixels.height;
+  std::vector<float> heights(pixelCount);
+
+  GDALCopyWords(pixels.data.data(), pixels.type, pixels.typeSize, heights.data(), GDT_Float32, sizeof(float), pixelCount);
+  GDALDatasetReader::adjustHeights(tiler, tiler.dataset(), coord, pixels.width, pixels.height, heights.data());
+  GDALCopyWords(heights.data(), GDT_Float32, sizeof(float), pixels.data.data(), pixels.type, pixels.typeSize, pixelCount);
+}
+
+/**
+ * Serialize a raster tile, which is deleted
+ *
+ * The warped tile is read once and scanned: empty tiles are skipped if the
+ * build asks for it and single colour tiles reuse the encoding of the first
+ * tile of their colour.  The tile is encoded from the pixels read rather than
+ * from the warped dataset, which would warp it again.
+ */
+static void
+serializeRasterTile(GDALSerializer &serializer, const RasterTiler &tiler, GDALTile *warpedTile,
+                    GDALDriver *driver, const char *extension, TerrainBuild *command) {
+  std::unique_ptr<GDALTile> warped(warpedTile);
+  RasterPixels pixels;
+  readRasterPixels(warped->dataset, pixels);
+  if (command->adjustsHeights()) adjustRasterPixels(tiler, *warped, pixels);
+
+  const RasterContent content = scanRasterPixels(pixels, tiler.dataset());
+  if (content == EMPTY && command->skipEmpty) {
+    solidTiles.skip();
+    return;
+  }
+
+  GDALTile tile(createPixelsDataset(warped->dataset, pixels), NULL);
+  static_cast<TileCoordinate &>(tile) = *warped;
+  warped.reset();
+
+  if (content == MIXED || !solidTiles.isEnabled()) {
+    serializer.serializeTile(&tile, driver, extension, command->creationOptions);
+    return;
+  }
+
+  // The colour of the tile, as the bytes of its first pixel in each band
+  std::string colour = concat(pixels.width, "x", pixels.height, ":");
+  for (int i = 0; i < pixels.bands; i++) {
+    colour.append((const char *) pixels.band(i), pixels.typeSize);
+  }
+
+  SolidTileCache::Blob blob = solidTiles.find(colour);
+  if (!blob) {
+    auto bytes = std::make_shared<std::vector<unsigned char>>();
+    if (!tile.encode(driver, extension, command->creationOptions, *bytes)) {
+      solidTiles.disable();     // e.g. a world file is written with each tile
+      serializer.serializeTile(&tile, driver, extension, command->creationOptions);
+      return;
+    }
+    blob = bytes;
+    solidTiles.store(colour, blob);
+  }
+
+  const TileCoordinate *coordinate = &tile;
+  serializer.serializeTile(coordinate, *blob, driver, extension);
+}
+
+/// Output GDAL tiles represented by a tiler to a directory
+static void
+buildGDAL(GDALSerializer &serializer, const RasterTiler &tiler, TerrainBuild *command, TerrainMetadata *metadata) {
+  // The tiles of a pyramid are written as pixels into a GeoTIFF
+  GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName(cogPyramid ? "GTiff" : command->outputFormat);
+
+  if (poDriver == NULL) {
+    throw CTBException("Could not retrieve GDAL driver");
+  }
+
+  if (poDriver->pfnCreateCopy == NULL) {
+    throw CTBException("The GDAL driver must be write enabled, specifically supporting 'CreateCopy'");
+  }
+
+  // Only a raster of heights can be adjusted
+  if (command->adjustsHeights() && tiler.dataset()->GetRasterCount() != 1) {
+    throw CTBException("--fill-nodata and --geoid need a dataset with a single band of heights");
+  }
+
+  const char *extension = poDriver->GetMetadataItem(GDAL_DMD_EXTENSION);
+  i_zoom startZoom = (command->startZoom < 0) ? tiler.maxZoomLevel() : command->startZoom,
+    endZoom = (command->endZoom < 0) ? 0 : command->endZoom;
+
+  RasterIterator iter = buildIterator<RasterIterator>(tiler, command, startZoom, endZoom);
+  int currentIndex = incrementIterator(iter, 0);
+  setIteratorSize(iter);
+  if (metadata) metadata->setAvailable(tiler, startZoom);
+  if (command->progressive) levelProgress.init(iter, tiler, command, startZoom, endZoom, checkpoint);
+  if (checkpoint.isEnabled()) checkpoint.init(iter, startZoom, endZoom);
+
+  while (!iter.exhausted()) {
+    const TileCoordinate *coordinate = iter.GridIterator::operator*();
+    const bool withinDepth = tiler.withinDepth(*coordinate);
+    if (metadata && withinDepth) metadata->add(tiler.grid(), coordinate);
+
+    if (checkpoint.isDone(currentIndex)) {
+      // the tile was finished by a previous run
+    } else {
+      if (withinDepth && serializer.mustSerializeCoordinate(coordinate)) {
+        sourcePrefetch.advise(tiler, tiler.dataset(), *coordinate);
+        serializeRasterTile(serializer, tiler, *iter, poDriver, extension, command);
+      }
+      if (command->progressive) levelProgress.add(coordinate);
+      if (checkpoint.isEnabled()) checkpoint.add(currentIndex, coordinate);
+    }
+
+    currentIndex = incrementIterator(iter, currentIndex);
+    showProgress(currentIndex);
+  }
+}
+
+/// Get the GDAL driver of a heightmap image format, which declares its media type
+static GDALDriver *
+heightmapImageDriver(const HeightmapImage &image) {
+  GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName(image.driverName());
+
+  if (poDriver == NULL) {
+    throw CTBException("Could not retrieve GDAL driver");
+  }
+  return poDriver;
+}
+
+/**
+ * Output heightmap images represented by a tiler to a directory
+ *
+ * The heights of each tile are read at the grid's tile size, covering the
+ * tile's area without the overlap of terrain tiles, and encoded straight
+ * into an image.
+ */
+static void
+buildHeightmapImage(GDALSerializer &serializer, const RasterTiler &tiler, const HeightmapImage &image,
+                    TerrainBuild *command, TerrainMetadata *metadata) {
+  GDALDriver *poDriver = heightmapImageDriver(image);
+  const i_tile tileSize = tiler.grid().tileSize();
+  const float noData = (float) GDALDatasetReader::noDataValue(tiler.dataset());
+  i_zoom startZoom = (command->startZoom < 0) ? tiler.maxZoomLevel() : command->startZoom,
     endZoom = (command->endZoom < 0) ? 0 : command->endZoom;
 
-  TerrainIterator iter(tiler, startZoom, endZoom);
+  RasterIterator iter = buildIterator<RasterIterator>(tiler, command, startZoom, endZoom);
   int currentIndex = incrementIterator(iter, 0);
   setIteratorSize(iter);
-  GDALDatasetReaderWithOverviews reader(tiler);
+  if (metadata) metadata->setAvailable(tiler, startZoom);
+  if (command->progressive) levelProgress.init(iter, tiler, command, startZoom, endZoom, checkpoint);
+  if (checkpoint.isEnabled()) checkpoint.init(iter, startZoom, endZoom);
+  StripDatasetReader stripReader(tiler);
+  GDALCachedDatasetReader reader(stripReader, tiler, heightCacheDir(command), heightCacheKey(command));
 
   while (!iter.exhausted()) {
     const TileCoordinate *coordinate = iter.GridIterator::operator*();
-    if (metadata) metadata->add(tiler.grid(), coordinate);
+    const bool withinDepth = tiler.withinDepth(*coordinate);
+    if (metadata && withinDepth) metadata->add(tiler.grid(), coordinate);
+
+    if (checkpoint.isDone(currentIndex)) {
+      // the tile was finished by a previous run
+    } else {
+      if (withinDepth && serializer.mustSerializeCoordinate(coordinate)) {
+        float *rasterHeights = reader.readRasterHeights(tiler.dataset(), *coordinate, tileSize, tileSize);
+        vector<unsigned char> bytes;
+
+        try {
+          image.encode(rasterHeights, tileSize, tileSize, noData, command->creationOptions, bytes);
+        } catch (CTBException &) {
+          CPLFree(rasterHeights);
+          throw;
+        }
+        CPLFree(rasterHeights);
+        serializer.serializeTile(coordinate, bytes, poDriver, image.extension());
+      }
+      if (command->progressive) levelProgress.add(coordinate);
+      if (checkpoint.isEnabled()) checkpoint.add(currentIndex, coordinate);
+    }
 
-    if (serializer.mustSerializeCoordinate(coordinate)) {
-      TerrainTile *tile = iter.operator*(&reader);
-      serializer.serializeTile(tile);
-      delete tile;
+    currentIndex = incrementIterator(iter, currentIndex);
+    showProgress(currentIndex);
+  }
+}
+
+/// Output terrain tiles represented by a tiler to a directory
+static void
+buildTerrain(TerrainSerializer &serializer, const TerrainTiler &tiler, TerrainBuild *command, TerrainMetadata *metadata) {
+  i_zoom startZoom = (command->startZoom < 0) ? tiler.maxZoomLevel() : command->startZoom,
+    endZoom = (command->endZoom < 0) ? 0 : command->endZoom;
+
+  TerrainIterator iter = buildIterator<TerrainIterator>(tiler, command, startZoom, endZoom);
+  int currentIndex = incrementIterator(iter, 0);
+  setIteratorSize(iter);
+  if (metadata) metadata->setAvailable(tiler, startZoom);
+  if (command->progressive) levelProgress.init(iter, tiler, command, startZoom, endZoom, checkpoint);
+  if (checkpoint.isEnabled()) checkpoint.init(iter, startZoom, endZoom);
+  if (command->tilerOptions.pruneFlatTiles) pruner.init(iter, startZoom, endZoom);
+  StripDatasetReader stripReader(tiler);
+  GDALCachedDatasetReader reader(stripReader, tiler, heightCacheDir(command), heightCacheKey(command));
+
+  while (!iter.exhausted()) {
+    const TileCoordinate *coordinate = iter.GridIterator::operator*();
+    const bool withinDepth = tiler.withinDepth(*coordinate);
+    if (metadata && withinDepth) metadata->add(tiler.grid(), coordinate);
+
+    if (checkpoint.isDone(currentIndex)) {
+      // the tile was finished by a previous run
+    } else {
+      bool leaf = false;
+
+      if (!withinDepth) {
+        // the sources are too coarse for the tile
+      } else if (pruner.isPruned(coordinate)) {
+        // an ancestor of the tile is a leaf
+      } else if (serializer.mustSerializeCoordinate(coordinate)) {
+        TerrainTile *tile = iter.operator*(&reader);
+        leaf = !tile->hasChildren();
+        serializer.serializeTile(tile);
+        delete tile;
+      }
+      if (pruner.isEnabled()) pruner.add(coordinate, leaf);
+      if (command->progressive) levelProgress.add(coordinate);
+      if (checkpoint.isEnabled()) checkpoint.add(currentIndex, coordinate);
     }
 
     currentIndex = incrementIterator(iter, currentIndex);
@@ -658,24 +1976,230 @@ buildMesh(MeshSerializer &serializer, const MeshTiler &tiler, TerrainBuild *comm
   return;
   #endif
 
-  MeshIterator iter(tiler, startZoom, endZoom);
+  MeshIterator iter = buildIterator<MeshIterator>(tiler, command, startZoom, endZoom);
+  int currentIndex = incrementIterator(iter, 0);
+  setIteratorSize(iter);
+  if (metadata) metadata->setAvailable(tiler, startZoom);
+  if (command->progressive) levelProgress.init(iter, tiler, command, startZoom, endZoom, checkpoint);
+  if (checkpoint.isEnabled()) checkpoint.init(iter, startZoom, endZoom);
+  StripDatasetReader stripReader(tiler);
+  GDALCachedDatasetReader reader(stripReader, tiler, heightCacheDir(command), heightCacheKey(command));
+
+  while (!iter.exhausted()) {
+    const TileCoordinate *coordinate = iter.GridIterator::operator*();
+    const bool withinDepth = tiler.withinDepth(*coordinate);
+    if (metadata && withinDepth) metadata->add(tiler.grid(), coordinate);
+
+    if (checkpoint.isDone(currentIndex)) {
+      // the tile was finished by a previous run
+    } else {
+      if (withinDepth && serializer.mustSerializeCoordinate(coordinate)) {
+        MeshTile *tile = iter.operator*(&reader);
+        serializer.serializeTile(tile, writeVertexNormals);
+        delete tile;
+      }
+      if (command->progressive) levelProgress.add(coordinate);
+      if (checkpoint.isEnabled()) checkpoint.add(currentIndex, coordinate);
+    }
+
+    currentIndex = incrementIterator(iter, currentIndex);
+    showProgress(currentIndex);
+  }
+}
+
+/// Create a single band raster tile from the heights of a terrain tile
+static GDALTile *
+createHeightsTile(const TerrainTiler &tiler, const TileCoordinate &coord, float *rasterHeights, const char *gridWKT) {
+  GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName("MEM");
+  if (poDriver == NULL) {
+    throw CTBException("Could not retrieve MEM GDAL driver");
+  }
+
+  GDALDataset *poDataset = poDriver->Create("", TILE_SIZE, TILE_SIZE, 1, GDT_Float32, NULL);
+  if (poDataset == NULL) {
+    throw CTBException("Could not create the in memory heights dataset");
+  }
+
+  // The heights are georeferenced over the overlapping bounds they were read from
+  double resolution;
+  const CRSBounds tileBounds = tiler.rasterTileBounds(coord, resolution);
+  double adfGeoTransform[6] = { tileBounds.getMinX(), resolution, 0, tileBounds.getMaxY(), 0, -resolution };
+
+  poDataset->SetGeoTransform(adfGeoTransform);
+  poDataset->SetProjection(gridWKT);
+
+  if (poDataset->GetRasterBand(1)->RasterIO(GF_Write, 0, 0, TILE_SIZE, TILE_SIZE,
+                                            rasterHeights, TILE_SIZE, TILE_SIZE,
+                                            GDT_Float32, 0, 0) != CE_None) {
+    GDALClose(poDataset);
+    throw CTBException("Could not write the heights to the in memory dataset");
+  }
+
+  GDALTile *tile = new GDALTile(poDataset, NULL);
+  static_cast<TileCoordinate &>(*tile) = coord;
+
+  return tile;
+}
+
+/**
+ * Output the tiles of several formats, reading the heights of each tile once
+ *
+ * The heights read for a tile are used to create the `Terrain` and `Mesh`
+ * tiles and, for any GDAL formats, a single band raster of the heights.
+ * Heightmap images cover the tile without the overlap of terrain tiles, as
+ * when they are built on their own, so their heights are read once from
+ * `imageTiler`.  Each format is written to its own subdirectory of the output
+ * directory.
+ */
+static void
+buildMulti(const MeshTiler &tiler, const RasterTiler &imageTiler, TerrainBuild *command, TerrainMetadata *metadata) {
+  i_zoom startZoom = (command->startZoom < 0) ? tiler.maxZoomLevel() : command->startZoom,
+    endZoom = (command->endZoom < 0) ? 0 : command->endZoom;
+
+  // A serializer for each format
+  vector<unique_ptr<CTBFileTileSerializer>> serializers;
+  vector<GDALDriver *> drivers;
+  vector<bool> isImage;         // is the format a heightmap image?
+  vector<HeightmapImage> images;
+  CTBFileTileSerializer *terrainSerializer = NULL, *meshSerializer = NULL;
+
+  for (const string &format : command->getOutputFormats()) {
+    serializers.push_back(unique_ptr<CTBFileTileSerializer>(createFileSerializer(command->getFormatDir(format), command)));
+
+    GDALDriver *poDriver = NULL;
+    HeightmapImage image;
+    isImage.push_back(HeightmapImage::fromName(format, image));
+    images.push_back(image);
+
+    if (format == "Terrain") {
+      terrainSerializer = serializers.back().get();
+    } else if (format == "Mesh") {
+      meshSerializer = serializers.back().get();
+    } else if (isImage.back()) {
+      poDriver = heightmapImageDriver(image);
+    } else {
+      poDriver = GetGDALDriverManager()->GetDriverByName(format.c_str());
+
+      if (poDriver == NULL) {
+        throw CTBException("Could not retrieve GDAL driver");
+      }
+      if (poDriver->pfnCreateCopy == NULL) {
+        throw CTBException("The GDAL driver must be write enabled, specifically supporting 'CreateCopy'");
+      }
+    }
+    drivers.push_back(poDriver);
+  }
+
+  // The raster heights can only be shared by meshes of the terrain tile size
+  const bool shareMeshHeights = tiler.grid().tileSize() == TILE_SIZE;
+  const float noData = (float) GDALDatasetReader::noDataValue(tiler.dataset());
+
+  // The grid SRS for the raster tiles
+  char *pszGridWKT = NULL;
+  if (tiler.grid().getSRS().exportToWkt(&pszGridWKT) != OGRERR_NONE) {
+    CPLFree(pszGridWKT);
+    throw CTBException("Could not create grid WKT string");
+  }
+  const string gridWKT = pszGridWKT;
+  CPLFree(pszGridWKT);
+
+  MeshIterator iter = buildIterator<MeshIterator>(tiler, command, startZoom, endZoom);
   int currentIndex = incrementIterator(iter, 0);
   setIteratorSize(iter);
-  GDALDatasetReaderWithOverviews reader(tiler);
+  if (metadata) metadata->setAvailable(tiler, startZoom);
+  if (command->progressive) levelProgress.init(iter, tiler, command, startZoom, endZoom, checkpoint);
+  if (checkpoint.isEnabled()) checkpoint.init(iter, startZoom, endZoom);
+  StripDatasetReader stripReader(tiler);
+  GDALCachedDatasetReader reader(stripReader, tiler, heightCacheDir(command), heightCacheKey(command));
+
+  // The images are read at the grid's tile size over the grid tile bounds
+  const i_tile imageSize = imageTiler.grid().tileSize();
+  unique_ptr<StripDatasetReader> imageStripReader;
+  unique_ptr<GDALCachedDatasetReader> imageReader;
+  if (find(isImage.begin(), isImage.end(), true) != isImage.end()) {
+    imageStripReader.reset(new StripDatasetReader(imageTiler));
+    imageReader.reset(new GDALCachedDatasetReader(*imageStripReader, imageTiler, heightCacheDir(command), heightCacheKey(command)));
+  }
+
+  for (auto &serializer : serializers) {
+    serializer->startSerialization();
+  }
 
   while (!iter.exhausted()) {
     const TileCoordinate *coordinate = iter.GridIterator::operator*();
-    if (metadata) metadata->add(tiler.grid(), coordinate);
+    const bool withinDepth = tiler.withinDepth(*coordinate);
+    if (metadata && withinDepth) metadata->add(tiler.grid(), coordinate);
+
+    if (checkpoint.isDone(currentIndex)) {
+      // the tile was finished by a previous run
+    } else {
+      vector<bool> required;
+      bool heightsRequired = false, rasterRequired = false, imageRequired = false;
+
+      for (size_t i = 0; i < serializers.size(); ++i) {
+        required.push_back(withinDepth && serializers[i]->mustSerializeCoordinate(coordinate));
+        heightsRequired = heightsRequired || (required[i] && !isImage[i]);
+        rasterRequired = rasterRequired || (required[i] && drivers[i] && !isImage[i]);
+        imageRequired = imageRequired || (required[i] && isImage[i]);
+      }
 
-    if (serializer.mustSerializeCoordinate(coordinate)) {
-      MeshTile *tile = iter.operator*(&reader);
-      serializer.serializeTile(tile, writeVertexNormals);
-      delete tile;
+      if (heightsRequired || imageRequired) {
+        float *rasterHeights = NULL, *imageHeights = NULL;
+        GDALTile *rasterTile = NULL;
+
+        try {
+          if (heightsRequired) {
+            rasterHeights = reader.readRasterHeights(tiler.dataset(), *coordinate, TILE_SIZE, TILE_SIZE);
+          }
+          if (imageRequired) {
+            imageHeights = imageReader->readRasterHeights(imageTiler.dataset(), *coordinate, imageSize, imageSize);
+          }
+          if (rasterRequired) {
+            rasterTile = createHeightsTile(tiler, *coordinate, rasterHeights, gridWKT.c_str());
+          }
+
+          for (size_t i = 0; i < serializers.size(); ++i) {
+            if (!required[i]) continue;
+
+            if (serializers[i].get() == terrainSerializer) {
+              unique_ptr<TerrainTile> tile(tiler.createTile(*coordinate, rasterHeights));
+              terrainSerializer->serializeTile(tile.get());
+            } else if (serializers[i].get() == meshSerializer) {
+              unique_ptr<MeshTile> tile(shareMeshHeights
+                ? tiler.createMesh(*coordinate, rasterHeights)
+                : tiler.createMesh(tiler.dataset(), *coordinate, &reader));
+              meshSerializer->serializeTile(tile.get(), command->vertexNormals);
+            } else if (isImage[i]) {
+              vector<unsigned char> bytes;
+              images[i].encode(imageHeights, imageSize, imageSize, noData, command->creationOptions, bytes);
+              serializers[i]->serializeTile(coordinate, bytes, drivers[i], images[i].extension());
+            } else {
+              const char *extension = drivers[i]->GetMetadataItem(GDAL_DMD_EXTENSION);
+              serializers[i]->serializeTile(rasterTile, drivers[i], extension, command->creationOptions);
+            }
+          }
+        } catch (CTBException &) {
+          delete rasterTile;
+          CPLFree(rasterHeights);
+          CPLFree(imageHeights);
+          throw;
+        }
+
+        delete rasterTile;
+        CPLFree(rasterHeights);
+        CPLFree(imageHeights);
+      }
+      if (command->progressive) levelProgress.add(coordinate);
+      if (checkpoint.isEnabled()) checkpoint.add(currentIndex, coordinate);
     }
 
     currentIndex = incrementIterator(iter, currentIndex);
     showProgress(currentIndex);
   }
+
+  for (auto &serializer : serializers) {
+    serializer->endSerialization();
+  }
 }
 
 static void
@@ -686,90 +2210,515 @@ buildMetadata(const RasterTiler &tiler, TerrainBuild *command, TerrainMetadata *
 
   const std::string filename = concat(dirname, "layer.json"); 
 
-  RasterIterator iter(tiler, startZoom, endZoom);
+  RasterIterator iter = buildIterator<RasterIterator>(tiler, command, startZoom, endZoom);
   int currentIndex = incrementIterator(iter, 0);
   setIteratorSize(iter);
+  if (metadata) metadata->setAvailable(tiler, startZoom);
 
   while (!iter.exhausted()) {
     const TileCoordinate *coordinate = iter.GridIterator::operator*();
-    if (metadata) metadata->add(tiler.grid(), coordinate);
+    const bool withinDepth = tiler.withinDepth(*coordinate);
+    if (metadata && withinDepth) metadata->add(tiler.grid(), coordinate);
 
     currentIndex = incrementIterator(iter, currentIndex);
     showProgress(currentIndex, filename);
   }
 }
 
+/**
+ * The datasets and tilers opened by a tiling thread
+ *
+ * When running the builds listed in a job file each thread keeps its datasets
+ * and tilers open for the following builds from the same source.  This avoids
+ * reopening the datasets, repeating the spatial reference checks of the tilers
+ * and discarding the GDAL block cache of each dataset between builds.
+ */
+class WorkerCache {
+public:
+  WorkerCache() {}
+
+  ~WorkerCache() {
+    for (auto &tiler : tilers) {
+      delete tiler.second;
+    }
+    for (auto &dataset : datasets) {
+      GDALClose(dataset.second);
+    }
+  }
+
+  /// Open a dataset, or return it if it is already open
+  GDALDataset *
+  open(const char *filename) {
+    auto found = datasets.find(filename);
+    if (found != datasets.end()) {
+      return found->second;
+    }
+
+    GDALDataset *poDataset = (GDALDataset *) GDALOpen(filename, GA_ReadOnly);
+    if (poDataset != NULL) {
+      datasets[filename] = poDataset;
+    }
+    return poDataset;
+  }
+
+  /// Get the tiler identified by `key`, creating it if necessary
+  template<typename T> const T &
+  tiler(const string &key, function<T *()> create) {
+    auto found = tilers.find(key);
+    if (found == tilers.end()) {
+      found = tilers.insert(make_pair(key, (GDALTiler *) create())).first;
+    }
+    return *static_cast<T *>(found->second);
+  }
+
+private:
+  WorkerCache(const WorkerCache &);
+  WorkerCache &operator=(const WorkerCache &);
+
+  map<string, GDALDataset *> datasets; ///< The open datasets by filename
+  map<string, GDALTiler *> tilers;     ///< The tilers by `tilerKey()`
+};
+
+/// Identify a tiler by its type, source and the options used to create it
+static string
+tilerKey(const char *type, const char *inputFilename, const Grid &grid, const TerrainBuild *command) {
+  const TilerOptions &options = command->tilerOptions;
+  stringstream stream;
+
+  stream << type << " " << command->profile << " " << grid.tileSize()
+         << " " << options.resampleAlg << " " << options.errorThreshold
+         << " " << options.warpMemoryLimit << " " << options.pruneFlatTiles
+         << " " << options.variableDepth << " " << options.fillNoDataDistance
+         << " " << options.optimizeMeshes
+         << " " << options.geoid.get()
+         << " " << command->meshQualityFactor
+         << " " << inputFilename;
+
+  return stream.str();
+}
+
 /**
  * Perform a tile building operation
  *
- * This function is designed to be run in a separate thread.
+ * This function is designed to be run in a separate thread.  The datasets and
+ * tilers are taken from `cache` when one is given, otherwise they are closed
+ * once the tiles have been built.
  */
 static int
-runTiler(const char *inputFilename, TerrainBuild *command, Grid *grid, TerrainMetadata *metadata, MBTiler *mbtiler) {
-  GDALDataset  *poDataset = (GDALDataset *) GDALOpen(inputFilename, GA_ReadOnly);
+runTiler(const char *inputFilename, TerrainBuild *command, Grid *grid, TerrainMetadata *metadata, MBTiler *mbtiler, WorkerCache *cache = NULL, int worker = -1) {
+  // Pin the thread before it allocates anything
+  numaPlacement.pin(worker);
+
+  WorkerCache threadCache;
+  if (cache == NULL) {
+    cache = &threadCache;
+  }
+
+  GDALDataset  *poDataset = cache->open(inputFilename);
   if (poDataset == NULL) {
     cerr << "Error: could not open GDAL dataset" << endl;
+    stripScheduler.finish(NULL);
     return 1;
   }
 
   // Metadata of only this thread, it will be joined to global later
   TerrainMetadata *threadMetadata = metadata ? new TerrainMetadata() : NULL;
 
+  // The tiler this thread lends to others reading heights in strips
+  const GDALTiler *helperTiler = NULL;
+  HeightmapImage image;         // the image format of heightmap image builds
+  int retval = 0;
+
   try {
 
     if (command->metadata) {
-      const RasterTiler tiler(poDataset, *grid, command->tilerOptions);
+      const RasterTiler &tiler = cache->tiler<RasterTiler>(tilerKey("raster", inputFilename, *grid, command), [&]() {
+        return new RasterTiler(poDataset, *grid, command->tilerOptions);
+      });
       buildMetadata(tiler, command, threadMetadata);
+    } else if (command->isMultiFormat()) {
+      const MeshTiler &tiler = cache->tiler<MeshTiler>(tilerKey("mesh", inputFilename, *grid, command), [&]() {
+        return new MeshTiler(poDataset, *grid, command->tilerOptions, command->meshQualityFactor);
+      });
+      const RasterTiler &imageTiler = cache->tiler<RasterTiler>(tilerKey("raster", inputFilename, *grid, command), [&]() {
+        return new RasterTiler(poDataset, *grid, command->tilerOptions);
+      });
+      helperTiler = &tiler;
+      buildMulti(tiler, imageTiler, command, threadMetadata);
     } else if (strcmp(command->outputFormat, "Terrain") == 0) {
-      CTBFileTileSerializer serializer(string(command->outputDir) + osDirSep, command->resume);
-      const TerrainTiler tiler(poDataset, *grid);
-      serializer.startSerialization();
-      buildTerrain(serializer, tiler, command, threadMetadata);
-      serializer.endSerialization();
+      unique_ptr<CTBFileTileSerializer> serializer(createFileSerializer(command->getFormatDir(command->outputFormat), command));
+      const TerrainTiler &tiler = cache->tiler<TerrainTiler>(tilerKey("terrain", inputFilename, *grid, command), [&]() {
+        TilerOptions options;   // terrain tiles use the default warp options
+        options.pruneFlatTiles = command->tilerOptions.pruneFlatTiles;
+        options.variableDepth = command->tilerOptions.variableDepth;
+        options.fillNoDataDistance = command->tilerOptions.fillNoDataDistance;
+        options.geoid = command->tilerOptions.geoid;
+        return new TerrainTiler(poDataset, *grid, options);
+      });
+      helperTiler = &tiler;
+      serializer->startSerialization();
+      buildTerrain(*serializer, tiler, command, threadMetadata);
+      serializer->endSerialization();
     } else if (strcmp(command->outputFormat, "Mesh") == 0) {
-      CTBFileTileSerializer serializer(string(command->outputDir) + osDirSep, command->resume);
-      const MeshTiler tiler(poDataset, *grid, command->tilerOptions, command->meshQualityFactor);
-      serializer.startSerialization();
-      buildMesh(serializer, tiler, command, threadMetadata, command->vertexNormals);
-      serializer.endSerialization();
+      unique_ptr<CTBFileTileSerializer> serializer(createFileSerializer(command->getFormatDir(command->outputFormat), command));
+      const MeshTiler &tiler = cache->tiler<MeshTiler>(tilerKey("mesh", inputFilename, *grid, command), [&]() {
+        return new MeshTiler(poDataset, *grid, command->tilerOptions, command->meshQualityFactor);
+      });
+      helperTiler = &tiler;
+      serializer->startSerialization();
+      buildMesh(*serializer, tiler, command, threadMetadata, command->vertexNormals);
+      serializer->endSerialization();
     } else if (strcmp(command->outputFormat, "MBTilesMesh") == 0) {
       CTBMBTilesTileSerializer serializer(mbtiler, command->resume);
-      const MeshTiler tiler(poDataset, *grid, command->tilerOptions, command->meshQualityFactor);
+      serializer.setCompressionCache(tileCompressionCache());
+      const MeshTiler &tiler = cache->tiler<MeshTiler>(tilerKey("mesh", inputFilename, *grid, command), [&]() {
+        return new MeshTiler(poDataset, *grid, command->tilerOptions, command->meshQualityFactor);
+      });
+      helperTiler = &tiler;
       serializer.startSerialization();
       buildMesh(serializer, tiler, command, threadMetadata, command->vertexNormals);
       serializer.endSerialization();
+    } else if (HeightmapImage::fromName(command->outputFormat, image)) {
+      unique_ptr<CTBFileTileSerializer> serializer(createFileSerializer(command->getFormatDir(command->outputFormat), command));
+      const RasterTiler &tiler = cache->tiler<RasterTiler>(tilerKey("raster", inputFilename, *grid, command), [&]() {
+        return new RasterTiler(poDataset, *grid, command->tilerOptions);
+      });
+      helperTiler = &tiler;
+      serializer->startSerialization();
+      buildHeightmapImage(*serializer, tiler, image, command, threadMetadata);
+      serializer->endSerialization();
+    } else if (strcmp(command->outputFormat, "COGPyramid") == 0) {
+      CTBCOGPyramidTileSerializer serializer(*cogPyramid);
+      const RasterTiler &tiler = cache->tiler<RasterTiler>(tilerKey("raster", inputFilename, *grid, command), [&]() {
+        return new RasterTiler(poDataset, *grid, command->tilerOptions);
+      });
+      serializer.startSerialization();
+      buildGDAL(serializer, tiler, command, threadMetadata);
+      serializer.endSerialization();
+    } else {                    // it's a GDAL format
+      unique_ptr<CTBFileTileSerializer> serializer(createFileSerializer(command->getFormatDir(command->outputFormat), command));
+      const RasterTiler &tiler = cache->tiler<RasterTiler>(tilerKey("raster", inputFilename, *grid, command), [&]() {
+        return new RasterTiler(poDataset, *grid, command->tilerOptions);
+      });
+      serializer->startSerialization();
+      buildGDAL(*serializer, tiler, command, threadMetadata);
+      serializer->endSerialization();
+    }
+
+  } catch (CTBException &e) {
+    cerr << "Error: " << e.what() << endl;
+    pruner.abort();             // don't leave other threads waiting on this one
+    retval = 1;                 // the build failed, so its checkpoint is kept
+  }
+
+  // Help the remaining threads with their expensive tiles
+  stripScheduler.finish(helperTiler);
+
+  // Pass metadata to global instance.
+  if (threadMetadata) {
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    metadata->add(*threadMetadata);
+    delete threadMetadata;
+  }
+  return retval;
+}
+
+/// The number of tiles built from each zoom level by `--estimate`
+static const int ESTIMATE_SAMPLES = 32;
+
+/// The cost of the tiles of a zoom level, measured from a sample of its tiles
+struct LevelEstimate {
+  i_zoom zoom;
+  double tiles;                 ///< The estimated number of tiles to be built
+  int sampled;                  ///< The number of tiles built from the sample
+  double seconds;               ///< The mean seconds taken by a tile
+  double secondsError;          ///< The standard error of `seconds`
+  double bytes;                 ///< The mean output bytes of a tile
+};
+
+/// Get the peak resident memory of the process in bytes, or `0` if unknown
+static double
+peakMemory() {
+#ifdef _WIN32
+  return 0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return (double) usage.ru_maxrss; // in bytes
+#else
+  return usage.ru_maxrss * 1024.0; // in kilobytes
+#endif
+#endif
+}
+
+/// Get the size of bytes once gzipped
+static size_t
+gzippedSize(const CTBMemoryOutputStream &ostream) {
+  CTBZOutputStream gzipStream;
+  gzipStream.write(ostream.data(), (uint32_t) ostream.size());
+  gzipStream.finish();
+  return gzipStream.size();
+}
+
+/// Describe a duration in the most readable unit
+static string
+formatDuration(double seconds) {
+  stringstream stream;
+  stream.precision(seconds < 60 ? 2 : 3);
+
+  if (seconds < 60) {
+    stream << seconds << " seconds";
+  } else if (seconds < 3600) {
+    stream << seconds / 60 << " minutes";
+  } else if (seconds < 2 * 86400) {
+    stream << seconds / 3600 << " hours";
+  } else {
+    stream << seconds / 86400 << " days";
+  }
+  return stream.str();
+}
+
+/**
+ * Estimate the cost of a build without running it
+ *
+ * A stratified random sample of the tiles of each zoom level is built and
+ * encoded: each zoom level is split into equal runs of tiles and a tile is
+ * chosen at random from each run.  The mean time and output size of the
+ * sampled tiles are extrapolated to the number of tiles in the zoom level,
+ * leaving out the fraction of tiles skipped by `--variable-depth`.  The growth
+ * of the peak memory of the process while sampling gives the memory used by
+ * a tiling thread, from which a thread count and memory budget are suggested.
+ */
+static int
+runEstimate(TerrainBuild &command, const Grid &grid) {
+  if (command.isMultiFormat()) {
+    cerr << "Error: --estimate only supports a single output format" << endl;
+    return 1;
+  }
+
+  GDALDataset *poDataset = (GDALDataset *) GDALOpen(command.getInputFilename(), GA_ReadOnly);
+  if (poDataset == NULL) {
+    cerr << "Error: could not open GDAL dataset" << endl;
+    return 1;
+  }
+
+  const string format(command.outputFormat);
+  HeightmapImage image;
+  unique_ptr<GDALTiler> tiler;
+  unique_ptr<GDALMappedDatasetReader> reader;
+  function<size_t(const TileCoordinate &)> buildTile; // build a tile, returning its output bytes
+  vector<LevelEstimate> levels;
+  double memoryBefore = 0, memoryAfter = 0;
+  int retval = 0;
+
+  try {
+    // Build the tiles as `runTiler` would
+    if (format == "Terrain") {
+      TilerOptions options;     // terrain tiles use the default warp options
+      options.variableDepth = command.tilerOptions.variableDepth;
+      options.fillNoDataDistance = command.tilerOptions.fillNoDataDistance;
+      options.geoid = command.tilerOptions.geoid;
+      TerrainTiler *terrainTiler = new TerrainTiler(poDataset, grid, options);
+      tiler.reset(terrainTiler);
+      reader.reset(new GDALMappedDatasetReader(*tiler));
+
+      buildTile = [&, terrainTiler](const TileCoordinate &coord) {
+        unique_ptr<TerrainTile> tile(terrainTiler->createTile(poDataset, coord, reader.get()));
+        CTBMemoryOutputStream ostream;
+        tile->writeFile(ostream);
+        return gzippedSize(ostream);
+      };
+    } else if (format == "Mesh" || format == "MBTilesMesh") {
+      MeshTiler *meshTiler = new MeshTiler(poDataset, grid, command.tilerOptions, command.meshQualityFactor);
+      tiler.reset(meshTiler);
+      reader.reset(new GDALMappedDatasetReader(*tiler));
+
+      buildTile = [&, meshTiler](const TileCoordinate &coord) {
+        unique_ptr<MeshTile> tile(meshTiler->createMesh(poDataset, coord, reader.get()));
+        CTBMemoryOutputStream ostream;
+        tile->writeFile(ostream, command.vertexNormals);
+        return gzippedSize(ostream);
+      };
+    } else if (HeightmapImage::fromName(format, image)) {
+      RasterTiler *rasterTiler = new RasterTiler(poDataset, grid, command.tilerOptions);
+      tiler.reset(rasterTiler);
+      reader.reset(new GDALMappedDatasetReader(*tiler));
+      const float noData = (float) GDALDatasetReader::noDataValue(poDataset);
+
+      buildTile = [&, noData](const TileCoordinate &coord) {
+        const i_tile tileSize = grid.tileSize();
+        float *rasterHeights = reader->readRasterHeights(poDataset, coord, tileSize, tileSize);
+        vector<unsigned char> bytes;
+        image.encode(rasterHeights, tileSize, tileSize, noData, command.creationOptions, bytes);
+        CPLFree(rasterHeights);
+        return bytes.size();
+      };
     } else {                    // it's a GDAL format
-      CTBFileTileSerializer serializer(string(command->outputDir) + osDirSep, command->resume);
-      const RasterTiler tiler(poDataset, *grid, command->tilerOptions);
-      serializer.startSerialization();
-      buildGDAL(serializer, tiler, command, threadMetadata);
-      serializer.endSerialization();
+      GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName(command.outputFormat);
+      if (poDriver == NULL) {
+        throw CTBException("Could not retrieve GDAL driver");
+      }
+      RasterTiler *rasterTiler = new RasterTiler(poDataset, grid, command.tilerOptions);
+      tiler.reset(rasterTiler);
+
+      buildTile = [&, rasterTiler, poDriver](const TileCoordinate &coord) {
+        unique_ptr<GDALTile> tile(rasterTiler->createTile(poDataset, coord));
+        const string dirname = "/vsimem/ctb-estimate";
+        const string filename = concat(dirname, "/tile");
+
+        GDALDataset *poDstDS = poDriver->CreateCopy(filename.c_str(), tile->dataset, FALSE, command.creationOptions, NULL, NULL);
+        if (poDstDS == NULL) {
+          throw CTBException("Could not create GDAL tile");
+        }
+        GDALClose(poDstDS);
+
+        // Count every file written for the tile, such as world files
+        size_t size = 0;
+        char **papszFiles = VSIReadDir(dirname.c_str());
+        for (int i = 0; papszFiles != NULL && papszFiles[i] != NULL; i++) {
+          const string path = concat(dirname, "/", papszFiles[i]);
+          VSIStatBufL stat;
+          if (VSIStatL(path.c_str(), &stat) == 0) {
+            size += stat.st_size;
+          }
+          VSIUnlink(path.c_str());
+        }
+        CSLDestroy(papszFiles);
+        return size;
+      };
+    }
+
+    const i_zoom startZoom = (command.startZoom < 0) ? tiler->maxZoomLevel() : command.startZoom,
+      endZoom = (command.endZoom < 0) ? 0 : command.endZoom;
+    std::mt19937 random(1);     // the same sample on every run
+
+    memoryBefore = peakMemory();
+
+    for (int zoom = startZoom; zoom >= (int) endZoom; --zoom) {
+      const TileBounds bounds = tiler->tileBoundsForZoom(zoom);
+      const double columns = (double) bounds.getWidth() + 1,
+        count = columns * ((double) bounds.getHeight() + 1);
+      const int samples = (int) std::min(count, (double) ESTIMATE_SAMPLES);
+      const double stratum = count / samples;
+      double sum = 0, sumSquares = 0, bytes = 0;
+      int built = 0;
+
+      for (int i = 0; i < samples; i++) {
+        std::uniform_real_distribution<double> offset(0, stratum);
+        const double index = std::min(std::floor(i * stratum + offset(random)), count - 1);
+        const TileCoordinate coord(zoom,
+                                   bounds.getMinX() + (i_tile) std::fmod(index, columns),
+                                   bounds.getMinY() + (i_tile) std::floor(index / columns));
+
+        if (!tiler->withinDepth(coord)) {
+          continue;             // the tile would be skipped
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        bytes += buildTile(coord);
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        sum += seconds;
+        sumSquares += seconds * seconds;
+        ++built;
+      }
+
+      LevelEstimate level;
+      level.zoom = zoom;
+      level.sampled = built;
+      level.tiles = count * built / samples;
+      level.seconds = built ? sum / built : 0;
+      level.bytes = built ? bytes / built : 0;
+      level.secondsError = 0;
+
+      if (built > 1 && level.tiles > built) {
+        // The standard error of the mean with the finite population correction
+        const double variance = std::max(0.0, (sumSquares - sum * sum / built) / (built - 1));
+        level.secondsError = std::sqrt(variance / built * (level.tiles - built) / (level.tiles - 1));
+      }
+      levels.push_back(level);
     }
 
+    memoryAfter = peakMemory();
+
   } catch (CTBException &e) {
     cerr << "Error: " << e.what() << endl;
+    retval = 1;
   }
 
+  reader.reset();
+  tiler.reset();
   GDALClose(poDataset);
+  VSIRmdir("/vsimem/ctb-estimate");
 
-  // Pass metadata to global instance.
-  if (threadMetadata) {
-    static std::mutex mutex;
-    std::lock_guard<std::mutex> lock(mutex);
+  if (retval) {
+    return retval;
+  }
 
-    metadata->add(*threadMetadata);
-    delete threadMetadata;
+  // Print the estimate of each zoom level and the totals
+  char line[256];
+  double totalTiles = 0, totalSeconds = 0, totalBytes = 0;
+
+  cout << "Estimated build of " << command.getInputFilename() << " as " << format << " tiles, from "
+       << ESTIMATE_SAMPLES << " sampled tiles per zoom level:" << endl << endl;
+  snprintf(line, sizeof(line), "%6s %16s %8s %12s %8s %12s %14s %12s",
+           "zoom", "tiles", "sampled", "ms/tile", "+/-%", "KB/tile", "CPU seconds", "output MB");
+  cout << line << endl;
+
+  for (const LevelEstimate &level : levels) {
+    const double seconds = level.tiles * level.seconds,
+      bytes = level.tiles * level.bytes;
+
+    snprintf(line, sizeof(line), "%6u %16.0f %8d %12.2f %8.1f %12.1f %14.1f %12.1f",
+             (unsigned int) level.zoom, level.tiles, level.sampled, level.seconds * 1000,
+             level.seconds > 0 ? 100 * level.secondsError / level.seconds : 0.0,
+             level.bytes / 1024, seconds, bytes / (1024 * 1024));
+    cout << line << endl;
+
+    totalTiles += level.tiles;
+    totalSeconds += seconds;
+    totalBytes += bytes;
+  }
+  snprintf(line, sizeof(line), "%6s %16.0f %8s %12s %8s %12s %14.1f %12.1f",
+           "total", totalTiles, "", "", "", "", totalSeconds, totalBytes / (1024 * 1024));
+  cout << line << endl << endl;
+
+  // Suggest as many threads as there are processors and memory for
+  const double cacheMemory = (double) GDALGetCacheMax64(),
+    threadMemory = std::max(0.0, memoryAfter - memoryBefore - (double) GDALGetCacheUsed64()),
+    physicalMemory = (double) CPLGetUsablePhysicalRAM();
+  int threads = std::max(1, (int) std::min((double) CPLGetNumCPUs(), totalTiles));
+
+  if (threadMemory > 0 && physicalMemory > cacheMemory + memoryBefore) {
+    threads = std::max(1, std::min(threads, (int) ((physicalMemory - cacheMemory - memoryBefore) / threadMemory)));
   }
+  const double budget = memoryBefore + cacheMemory + threads * threadMemory;
+
+  cout << "Total CPU time: " << formatDuration(totalSeconds) << endl;
+  if (memoryAfter > 0) {
+    cout << "Memory per thread: " << (int) (threadMemory / (1024 * 1024)) << " MB, plus "
+         << (int) (cacheMemory / (1024 * 1024)) << " MB of GDAL block cache" << endl;
+  }
+  cout << "Recommended: " << threads << " threads taking about " << formatDuration(totalSeconds / threads);
+  if (memoryAfter > 0) {
+    cout << " with a memory budget of " << (int) std::ceil(budget / (1024 * 1024)) << " MB";
+  }
+  cout << endl;
+
   return 0;
 }
 
-int
-main(int argc, char *argv[]) {
-  // Specify the command line interface
-  TerrainBuild command = TerrainBuild(argv[0], version.cstr);
+/// Specify the command line interface
+static void
+defineOptions(TerrainBuild &command) {
   command.setUsage("[options] GDAL_DATASOURCE");
   command.option("-o", "--output-dir <dir>", "specify the output directory for the tiles (defaults to working directory)", TerrainBuild::setOutputDir);
-  command.option("-f", "--output-format <format>", "specify the output format for the tiles. This is either `Terrain` (the default), `Mesh` (Chunked LOD mesh), `MBTilesMesh`, or any format listed by `gdalinfo --formats`", TerrainBuild::setOutputFormat);
+  command.option("-f", "--output-format <format>", "specify the output format for the tiles. This is either `Terrain` (the default), `Mesh` (Chunked LOD mesh), `MBTilesMesh`, `COGPyramid` (a single GeoTIFF with an overview per zoom level), `TerrainRGB` or `Terrarium` (heightmap PNG images, or WebP with `TerrainRGBWebP` and `TerrariumWebP`), or any format listed by `gdalinfo --formats`. A comma separated list of formats creates each in its own subdirectory from a single read of the heights", TerrainBuild::setOutputFormat);
   command.option("-p", "--profile <profile>", "specify the TMS profile for the tiles. This is either `geodetic` (the default) or `mercator`", TerrainBuild::setProfile);
   command.option("-c", "--thread-count <count>", "specify the number of threads to use for tile generation. On multicore machines this defaults to the number of CPUs", TerrainBuild::setThreadCount);
   command.option("-t", "--tile-size <size>", "specify the size of the tiles in pixels. This defaults to 65 for terrain tiles and 256 for other GDAL formats", TerrainBuild::setTileSize);
@@ -784,25 +2733,149 @@ main(int argc, char *argv[]) {
   command.option("-l", "--layer", "only output the layer.json metadata file", TerrainBuild::setMetadata);
   command.option("-C", "--cesium-friendly", "Force the creation of missing root tiles to be CesiumJS-friendly", TerrainBuild::setCesiumFriendly);
   command.option("-N", "--vertex-normals", "Write 'Oct-Encoded Per-Vertex Normals' for Terrain Lighting, only for `Mesh` format", TerrainBuild::setVertexNormals);
+  command.option("-M", "--mesh-optimize", "remove the degenerate triangles joining the triangle strips of meshes, making `Mesh` tiles smaller", TerrainBuild::setMeshOptimize);
+  command.option("-P", "--progressive", "Build the lowest zoom levels first, updating the layer.json metadata file as each zoom level is completed", TerrainBuild::setProgressive);
+  command.option("-D", "--variable-depth", "limit the depth of each region of a VRT dataset to the resolution of its source, rather than tiling the whole dataset to the finest resolution", TerrainBuild::setVariableDepth);
+  command.option("-F", "--fill-nodata <distance>", "fill the heights without data of the tiles of every format up to <distance> pixels from heights with data by interpolating from the heights around them, rather than leaving pits in the terrain", TerrainBuild::setFillNoData);
+  command.option("-G", "--geoid <file>", "convert the orthometric heights of the tiles of every format to ellipsoidal heights by adding the undulations of a geoid grid in geographic coordinates, such as a GTX or GeoTIFF file", TerrainBuild::setGeoidFile);
+  command.option("-S", "--skip-empty", "do not write GDAL raster tiles whose pixels are all transparent or without data", TerrainBuild::setSkipEmpty);
+  command.option("-H", "--height-cache <dir>", "keep the heights read for `Terrain`, `Mesh` and heightmap image tiles in <dir>, and read them from there rather than from the source when the source, profile and height options are unchanged, such as when rebuilding with another mesh quality factor or output format", TerrainBuild::setHeightCacheDir);
+  command.option("-u", "--prune", "build the lowest zoom levels first and skip the descendants of tiles that are within the geometric error of the next zoom level, clearing their child flags. Only valid for the `Terrain` format, and not with --checkpoint, --continue or --resume", TerrainBuild::setPrune);
+  command.option("-Z", "--compression-cache <MB>", "the memory in megabytes used to reuse the compression of identical terrain tiles (defaults to 64, 0 disables it)", TerrainBuild::setCompressionCacheSize);
+  command.option("-E", "--estimate", "build a sample of the tiles of each zoom level and print an estimate of the time, output size and memory of the build instead of running it", TerrainBuild::setEstimate);
+  command.option("-k", "--checkpoint <seconds>", "save the state of the build to a checkpoint file in the output directory every <seconds> seconds", TerrainBuild::setCheckpointInterval);
+  command.option("-K", "--continue", "continue an interrupted build from the checkpoint file in the output directory. This implies --resume", TerrainBuild::setContinue);
+  command.option("-U", "--upload-connections <count>", "the number of concurrent uploads when the output directory is an object store path such as `/vsis3/bucket/tiles` (defaults to 8)", TerrainBuild::setUploadConnections);
+  command.option("-a", "--numa", "pin the threads to the NUMA nodes of the host, allocating their memory on their node and giving each node runs of neighbouring tiles. Only has an effect on Linux", TerrainBuild::setNuma);
+  command.option("-d", "--coordinator <port>", "hand out the build in blocks of tiles to `ctb-tile --worker` processes given the same options, listening on <port>, then write the merged layer.json", TerrainBuild::setCoordinatorPort);
+  command.option("-w", "--worker <host:port>", "build the blocks of tiles handed out by the coordinator at <host:port>", TerrainBuild::setWorkerAddress);
+  command.option("-j", "--jobs <file>", "run the builds listed in a JSON job file, reusing open datasets between builds. The other options apply to every build", TerrainBuild::setJobFile);
   command.option("-q", "--quiet", "only output errors", TerrainBuild::setQuiet);
   command.option("-v", "--verbose", "be more noisy", TerrainBuild::setVerbose);
+}
 
-  // Parse and check the arguments
-  command.parse(argc, argv);
-  command.check();
+/// Check that a build can be split into blocks of a single zoom level
+static bool
+checkDistributable(const TerrainBuild &command) {
+  if (command.progressive || command.tilerOptions.pruneFlatTiles || command.cesiumFriendly
+      || command.metadata || command.checkpointInterval > 0 || command.continueBuild
+      || strcmp(command.outputFormat, "MBTilesMesh") == 0 || strcmp(command.outputFormat, "COGPyramid") == 0) {
+    cerr << "Error: --progressive, --prune, --cesium-friendly, --layer, --checkpoint, --continue and the MBTilesMesh and COGPyramid formats "
+         << "cannot be used with --coordinator or --worker" << endl;
+    return false;
+  }
+  return true;
+}
 
-  GDALAllRegister();
+/**
+ * Coordinate a build run by workers
+ *
+ * The blocks of the build are handed out to `ctb-tile --worker` processes,
+ * given the same options, until all have been built.  The merged metadata of
+ * the blocks is then written to the layer.json file.
+ */
+static int
+runCoordinator(TerrainBuild &command, const Grid &grid) {
+#ifdef _WIN32
+  cerr << "Error: --coordinator is not supported on Windows" << endl;
+  return 1;
+#else
+  if (!checkDistributable(command)) {
+    return 1;
+  }
+
+  GDALDataset *poDataset = (GDALDataset *) GDALOpen(command.getInputFilename(), GA_ReadOnly);
+  if (poDataset == NULL) {
+    cerr << "Error: could not open GDAL dataset" << endl;
+    return 1;
+  }
+
+  int result = 0;
+  try {
+    const RasterTiler tiler(poDataset, grid, command.tilerOptions);
+    const i_zoom startZoom = (command.startZoom < 0) ? tiler.maxZoomLevel() : command.startZoom,
+      endZoom = (command.endZoom < 0) ? 0 : command.endZoom;
+    BuildCoordinator coordinator(tiler, zoomOrderByCost(tiler, startZoom, endZoom));
+
+    // Serve the workers until all blocks are built
+    if (command.verbosity > 0) {
+      cout << "Coordinating the build on port " << command.coordinatorPort << endl;
+    }
+    coordinator.serve(command.coordinatorPort, progressFunc);
+
+    if (command.verbosity > 0) {
+      coordinator.report(cout);
+    }
+
+    // Write the metadata of the whole build
+    coordinator.metadata.setAvailable(tiler, startZoom);
+    if (command.isObjectStore()) {
+      tileUploader.reset(new CTBObjectStoreUploader(1));
+    }
+    writeLayerFile(coordinator.metadata, &command);
+  } catch (CTBException &e) {
+    cerr << "Error: " << e.what() << endl;
+    result = 1;
+  }
+
+  GDALClose(poDataset);
+  return result;
+#endif
+}
+
+/// Load a geoid grid, reusing the grid of a previous build from the same file
+static shared_ptr<const GeoidGrid>
+loadGeoid(const char *filename) {
+  static string loadedFile;
+  static shared_ptr<const GeoidGrid> loaded;
+
+  if (!loaded || loadedFile != filename) {
+    loaded = std::make_shared<const GeoidGrid>(filename);
+    loadedFile = filename;
+  }
+  return loaded;
+}
+
+/**
+ * Build the tiles described by a command
+ *
+ * The threads take their datasets and tilers from `caches`, when given, so
+ * that they can be reused by subsequent builds.
+ */
+static int
+runBuild(TerrainBuild &command, vector<unique_ptr<WorkerCache>> *caches) {
+  // Forget the state of any previous build
+  resetIteratorIndex(0);
+  iteratorSize = 0;
+  levelProgress.reset();
+  checkpoint.reset();
+  pruner.reset();
+  compressionCache.setCapacity((size_t) std::max(command.compressionCacheSize, 0) * 1024 * 1024);
+  compressionCache.resetStatistics();
+  solidTiles.reset(command.outputFormat);
+
+  // Prefetch the source of remote datasets
+  const bool remoteSource = SourcePrefetch::isRemote(command.getInputFilename());
+  if (remoteSource) configureRemoteSource();
+  sourcePrefetch.reset(remoteSource);
 
   // Set the output type
   if (command.verbosity > 1) {
     progressFunc = verboseProgress; // noisy
   } else if (command.verbosity < 1) {
     progressFunc = GDALDummyProgress; // quiet
+  } else {
+    progressFunc = termProgress;
   }
 
-  // Check whether or not the output directory exists
+  // Check whether or not the output directory exists (object stores have no directories)
   VSIStatBufL stat;
-  if (VSIStatExL(command.outputDir, &stat, VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG)) {
+  if (command.isObjectStore()) {
+    if (command.checkpointInterval > 0 || command.continueBuild) {
+      cerr << "Error: --checkpoint and --continue need a local output directory" << endl;
+      return 1;
+    }
+  } else if (VSIStatExL(command.outputDir, &stat, VSI_STAT_EXISTS_FLAG | VSI_STAT_NATURE_FLAG)) {
     cerr << "Error: The output directory does not exist: " << command.outputDir << endl;
     return 1;
   } else if (!VSI_ISDIR(stat.st_mode)) {
@@ -810,19 +2883,28 @@ main(int argc, char *argv[]) {
     return 1;
   }
 
-  // Open the MBTiles file if required
-  MBTiler *mbtiler = NULL;
-  if (strcmp(command.outputFormat, "MBTilesMesh") == 0 && !command.metadata) {
-	  string outputFile = command.outputDir;
-	  outputFile += ".sqlite3";
-    if (!command.resume) {
-      VSIUnlink(outputFile.c_str());
-    }
-    mbtiler = new MBTiler(outputFile.c_str());
-    mbtiler->setMetadata("name", "cesium terrain");
-    mbtiler->setMetadata("format", "application/vnd.quantized-mesh");
-    if (command.resume) {
-      cout << mbtiler->numTiles() << " tiles already written" << endl;
+  // Pruning relies on the child flags of heightmap terrain tiles, as clients
+  // still request the children of quantized-mesh tiles
+  if (command.tilerOptions.pruneFlatTiles && !command.metadata && (command.isMultiFormat() || strcmp(command.outputFormat, "Terrain"))) {
+    cerr << "Error: --prune is only valid for the Terrain format" << endl;
+    return 1;
+  }
+
+  // The leaves found by a previous run aren't recorded, and tiles that already
+  // exist aren't tested as leaves, so a continued or resumed build would build
+  // the tiles below them
+  if (command.tilerOptions.pruneFlatTiles && !command.metadata && (command.checkpointInterval > 0 || command.continueBuild || command.resume)) {
+    cerr << "Error: --prune cannot be used with --checkpoint, --continue or --resume" << endl;
+    return 1;
+  }
+
+  // Load the geoid grid converting the heights
+  if (command.geoidFile && !command.tilerOptions.geoid) {
+    try {
+      command.tilerOptions.geoid = loadGeoid(command.geoidFile);
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      return 1;
     }
   }
 
@@ -839,20 +2921,166 @@ main(int argc, char *argv[]) {
     return 1;
   }
 
+  // Only estimate the cost of the build?
+  if (command.estimate) {
+    return runEstimate(command, grid);
+  }
+
+  // Hand the build out to workers?
+  if (command.coordinatorPort > 0) {
+    return runCoordinator(command, grid);
+  }
+
+  // Create a subdirectory for each format of a multi-format build
+  if (command.isMultiFormat()) {
+    for (const string &format : command.getOutputFormats()) {
+      if (format == "MBTilesMesh" || format == "COGPyramid") {
+        cerr << "Error: " << format << " cannot be combined with other output formats" << endl;
+        return 1;
+      }
+
+      // The GDAL formats are written from a single Float32 band of the heights
+      HeightmapImage image;
+      if (format != "Terrain" && format != "Mesh" && !HeightmapImage::fromName(format, image)) {
+        GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName(format.c_str());
+        const char *dataTypes = poDriver ? poDriver->GetMetadataItem(GDAL_DMD_CREATIONDATATYPES) : NULL;
+        char **types = dataTypes ? CSLTokenizeString(dataTypes) : NULL;
+        const bool writesHeights = dataTypes == NULL || CSLFindString(types, "Float32") >= 0;
+        CSLDestroy(types);
+
+        if (poDriver == NULL) {
+          cerr << "Error: Could not retrieve the GDAL driver of " << format << endl;
+          return 1;
+        } else if (!writesHeights) {
+          cerr << "Error: The GDAL driver of " << format << " cannot write the Float32 heights of a multi-format build" << endl;
+          return 1;
+        }
+      }
+
+      const string dirname = command.getFormatDir(format);
+      if (!command.isObjectStore() && VSIStatExL(dirname.c_str(), &stat, VSI_STAT_EXISTS_FLAG) && VSIMkdir(dirname.c_str(), 0755)) {
+        cerr << "Error: Could not create the output directory: " << dirname << endl;
+        return 1;
+      }
+    }
+  }
+
+  // Track the finished tiles in a checkpoint file?
+  if ((command.checkpointInterval > 0 || command.continueBuild) && !command.metadata) {
+    checkpoint.enable(string(command.outputDir) + osDirSep + "ctb-tile.checkpoint", command.getInputFilename(), command.outputFormat);
+
+    if (command.continueBuild) {
+      try {
+        checkpoint.load();
+      } catch (CTBException &e) {
+        cerr << "Error: " << e.what() << endl;
+        return 1;
+      }
+
+      // Tiles being built when the checkpoint was taken may already exist
+      command.resume = true;
+      resetIteratorIndex(checkpoint.position());
+    }
+  }
+
+  // Upload the tiles to an object store?
+  tileUploader.reset();
+  if (command.isObjectStore()) {
+    tileUploader.reset(new CTBObjectStoreUploader(std::max(command.uploadConnections, 1)));
+  }
+
+  // Create the pyramid GeoTIFF if required, building it locally for an object store
+  cogPyramid.reset();
+  string pyramidFile;
+  if (strcmp(command.outputFormat, "COGPyramid") == 0 && !command.metadata) {
+    if (command.checkpointInterval > 0 || command.continueBuild || command.resume) {
+      cerr << "Error: --checkpoint, --continue and --resume cannot be used with the COGPyramid format" << endl;
+      return 1;
+    }
+
+    pyramidFile = string(command.isObjectStore() ? CPLGetFilename(command.outputDir) : command.outputDir) + ".tif";
+    GDALDataset *poDataset = (GDALDataset *) GDALOpen(command.getInputFilename(), GA_ReadOnly);
+    if (poDataset == NULL) {
+      cerr << "Error: could not open GDAL dataset" << endl;
+      return 1;
+    }
+
+    try {
+      const RasterTiler tiler(poDataset, grid, command.tilerOptions);
+      const i_zoom startZoom = (command.startZoom < 0) ? tiler.maxZoomLevel() : command.startZoom,
+        endZoom = (command.endZoom < 0) ? 0 : command.endZoom,
+        coarsestZoom = COGPyramid::coarsestZoom(tiler, endZoom, startZoom);
+
+      // Coarser overviews would only pad the image with empty blocks
+      if (coarsestZoom != endZoom && command.verbosity > 0) {
+        cout << "The pyramid ends at zoom level " << coarsestZoom << ", where the dataset spans at most 2x2 tiles" << endl;
+      }
+      command.endZoom = coarsestZoom;
+      cogPyramid.reset(new COGPyramid(pyramidFile, tiler, coarsestZoom, startZoom, command.creationOptions));
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      GDALClose(poDataset);
+      return 1;
+    }
+    GDALClose(poDataset);
+  }
+
+  // Open the MBTiles file if required, building it locally for an object store
+  MBTiler *mbtiler = NULL;
+  string mbtilesFile;
+  if (strcmp(command.outputFormat, "MBTilesMesh") == 0 && !command.metadata) {
+	  string outputFile = command.isObjectStore() ? CPLGetFilename(command.outputDir) : command.outputDir;
+	  outputFile += ".sqlite3";
+    mbtilesFile = outputFile;
+    if (!command.resume) {
+      VSIUnlink(outputFile.c_str());
+    }
+    mbtiler = new MBTiler(outputFile.c_str());
+    mbtiler->setMetadata("name", "cesium terrain");
+    mbtiler->setMetadata("format", "application/vnd.quantized-mesh");
+    if (command.resume) {
+      cout << mbtiler->numTiles() << " tiles already written" << endl;
+    }
+  }
+
   // Run the tilers in separate threads
   vector<future<int>> tasks;
   int threadCount = (command.threadCount > 0) ? command.threadCount : CPLGetNumCPUs();
 
   // Calculate metadata?
-  const string dirname = string(command.outputDir) + osDirSep;
-  const std::string filename = concat(dirname, "layer.json");
-  TerrainMetadata *metadata = command.metadata ? new TerrainMetadata() : NULL;
+  TerrainMetadata *metadata = (command.metadata || command.progressive || workBlock.active) ? new TerrainMetadata() : NULL;
+
+  // Place the threads on the NUMA nodes?
+  numaPlacement.disable();
+  chunkedIteration = false;
+  vector<NumaPlacement::Traffic> numaTraffic;
+  if (command.numa) {
+    if (numaPlacement.enable(threadCount)) {
+      chunkedIteration = !command.isTopDown();
+      numaTraffic = numaPlacement.traffic();
+      if (command.verbosity > 0) {
+        cout << "Placing " << threadCount << " threads on " << numaPlacement.nodeCount() << " NUMA nodes" << endl;
+      }
+    } else if (command.verbosity > 0) {
+      cerr << "Warning: --numa has no effect as the host has a single NUMA node" << endl;
+    }
+  }
 
   // Instantiate the threads using futures from a packaged_task
+  stripScheduler.start(threadCount);
+  while (caches && (int) caches->size() < threadCount) {
+    caches->push_back(unique_ptr<WorkerCache>(new WorkerCache()));
+  }
   for (int i = 0; i < threadCount ; ++i) {
-    packaged_task<int(const char *, TerrainBuild *, Grid *, TerrainMetadata *, MBTiler *)> task(runTiler); // wrap the function
+    packaged_task<int(const char *, TerrainBuild *, Grid *, TerrainMetadata *, MBTiler *, WorkerCache *, int)> task(runTiler); // wrap the function
     tasks.push_back(task.get_future()); // get a future
-    thread(move(task), command.getInputFilename(), &command, &grid, metadata, mbtiler).detach(); // launch on a thread
+    thread(move(task), command.getInputFilename(), &command, &grid, metadata, mbtiler, caches ? (*caches)[i].get() : NULL, i).detach(); // launch on a thread
+  }
+
+  // Save the checkpoint periodically
+  thread checkpointThread;
+  if (checkpoint.isEnabled() && command.checkpointInterval > 0) {
+    checkpointThread = thread(&BuildCheckpoint::run, &checkpoint, command.checkpointInterval);
   }
 
   // Synchronise the completion of the threads
@@ -860,46 +3088,105 @@ main(int argc, char *argv[]) {
     task.wait();
   }
 
+  bool checkpointed = checkpoint.isEnabled();
+  if (checkpointed) {
+    checkpoint.stop();
+    if (checkpointThread.joinable()) {
+      checkpointThread.join();
+    }
+  }
+
   // Get the value from the futures
   for (auto &task : tasks) {
     int retval = task.get();
 
-    // return on the first encountered problem
+    // return on the first encountered problem, keeping the finished tiles
     if (retval) {
+      cogPyramid.reset();       // a partial pyramid is of no use
+      if (checkpointed) {
+        try {
+          checkpoint.save();
+        } catch (CTBException &e) {
+          cerr << "Error: " << e.what() << endl;
+        }
+      }
       delete metadata;
       return retval;
     }
   }
 
+  // Lay out the pyramid for reading with range requests
+  if (cogPyramid) {
+    try {
+      cogPyramid->finish();
+      cogPyramid.reset();
+      if (tileUploader) {
+        tileUploader->uploadFile(pyramidFile, string(command.outputDir) + ".tif", "image/tiff; application=geotiff; profile=cloud-optimized");
+        VSIUnlink(pyramidFile.c_str());
+      }
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      cogPyramid.reset();
+      delete metadata;
+      return 1;
+    }
+  }
+
+  // Account for the tiles finished by previous runs
+  if (checkpointed) {
+    if (metadata) {
+      TerrainMetadata previous = checkpoint.metadata(grid);
+      metadata->add(previous);
+    }
+    checkpoint.remove();
+  }
+
   // CesiumJS friendly?
   if (command.cesiumFriendly && (strcmp(command.profile, "geodetic") == 0) && command.endZoom <= 0) {
 
     // Create missing root tiles if it is necessary
     if (!command.metadata) {
-      std::string dirName0 = string(command.outputDir) + osDirSep + "0" + osDirSep + "0";
-      std::string dirName1 = string(command.outputDir) + osDirSep + "0" + osDirSep + "1";
-      std::string tileName0 = dirName0 + osDirSep + "0.terrain";
-      std::string tileName1 = dirName1 + osDirSep + "0.terrain";
+      const vector<string> formats = command.getOutputFormats();
+      const string terrainFormat = (find(formats.begin(), formats.end(), "Terrain") != formats.end()) ? "Terrain" : "Mesh";
+      const string terrainDir = command.getFormatDir(terrainFormat);
+      std::string dirName0 = terrainDir + "0" + command.getDirSeparator() + "0";
+      std::string dirName1 = terrainDir + "0" + command.getDirSeparator() + "1";
+      std::string tileName0 = dirName0 + command.getDirSeparator() + "0.terrain";
+      std::string tileName1 = dirName1 + command.getDirSeparator() + "0.terrain";
 
       i_zoom missingZoom = 65535;
       ctb::TileCoordinate missingTileCoord(missingZoom, 0, 0);
       std::string missingTileName;
 
+      // A root tile still being uploaded would read as missing
+      if (tileUploader) {
+        try {
+          tileUploader->flush();
+        } catch (CTBException &e) {
+          cerr << "Error: " << e.what() << endl;
+          delete metadata;
+          return 1;
+        }
+      }
+
       if (fileExists(tileName0) && !fileExists(tileName1)) {
-        VSIMkdir(dirName1.c_str(), 0755);
+        if (!command.isObjectStore()) VSIMkdir(dirName1.c_str(), 0755);
         missingTileCoord = ctb::TileCoordinate(0, 1, 0);
         missingTileName = tileName1;
       }
       else
       if (!fileExists(tileName0) && fileExists(tileName1)) {
-        VSIMkdir(dirName0.c_str(), 0755);
+        if (!command.isObjectStore()) VSIMkdir(dirName0.c_str(), 0755);
         missingTileCoord = ctb::TileCoordinate(0, 0, 0);
         missingTileName = tileName0;
       }
       if (missingTileCoord.zoom != missingZoom) {
-        globalIteratorIndex = 0; // reset global iterator index
+        resetIteratorIndex(0);  // reset global iterator index
         command.startZoom = 0;
         command.endZoom = 0;
+        if (command.isObjectStore()) {
+          missingTileName = concat("/vsimem/ctb-root-", missingTileCoord.x); // the source can't be written to the store
+        }
         missingTileName = createEmptyRootElevationFile(missingTileName, grid, missingTileCoord);
         runTiler(missingTileName.c_str(), &command, &grid, NULL, mbtiler);
         VSIUnlink(missingTileName.c_str());
@@ -916,16 +3203,255 @@ main(int argc, char *argv[]) {
     }
   }
 
-  // Write Json metadata file?
-  if (metadata) {
-    std::string datasetName(command.getInputFilename());
-    datasetName = datasetName.substr(datasetName.find_last_of("/\\") + 1);
-    const size_t rfindpos = datasetName.rfind('.');
-    if (std::string::npos != rfindpos) datasetName = datasetName.erase(rfindpos);
+  // Wait for the tiles to reach the object store
+  if (tileUploader) {
+    try {
+      if (mbtiler) {
+        delete mbtiler;         // close the archive before uploading it
+        mbtiler = NULL;
+        tileUploader->uploadFile(mbtilesFile, string(command.outputDir) + ".sqlite3", "application/vnd.sqlite3");
+        VSIUnlink(mbtilesFile.c_str());
+      }
+      tileUploader->finish();
+    } catch (CTBException &e) {
+      cerr << "Error: " << e.what() << endl;
+      delete metadata;
+      return 1;
+    }
+
+    if (command.verbosity > 0) {
+      cout << "Uploaded " << tileUploader->uploaded() << " objects (" << tileUploader->bytes() / (1024 * 1024)
+           << " MB) with " << tileUploader->retries() << " retried requests" << endl;
+    }
+  }
+
+  // Report the requests made for a remote source
+  if (command.verbosity > 0) {
+    sourcePrefetch.report();
+  }
+
+  // Report the memory traffic between the NUMA nodes
+  if (command.verbosity > 0 && !numaTraffic.empty()) {
+    numaPlacement.reportTraffic(numaTraffic);
+  }
+
+  // Report how many tiles reused the compression of an identical tile
+  const uint64_t compressed = compressionCache.hits() + compressionCache.misses();
+  if (command.verbosity > 0 && compressed > 0) {
+    cout << "Compression cache: " << compressionCache.hits() << " of " << compressed
+         << " tiles reused a compressed tile (" << (int) (100.0 * compressionCache.hits() / compressed + 0.5) << "%)" << endl;
+  }
+
+  // Report the raster tiles which were skipped or reused an encoded tile
+  if (command.verbosity > 0 && (solidTiles.skipped() > 0 || solidTiles.hits() > 0)) {
+    cout << "Raster tiles: " << solidTiles.skipped() << " empty tiles skipped, " << solidTiles.hits()
+         << " single colour tiles reused an encoded tile" << endl;
+  }
 
-    metadata->writeJsonFile(filename, datasetName, std::string(command.outputFormat), std::string(command.profile), command.vertexNormals);
+  // Write Json metadata file, or return it to the coordinator?
+  if (metadata) {
+    if (workBlock.active) {
+      workBlock.metadata = *metadata;
+    } else {
+      writeLayerFile(*metadata, &command);
+    }
     delete metadata;
   }
 
   return 0;
 }
+
+/**
+ * Build the blocks handed out by a coordinator
+ *
+ * Each block is built as a build of its zoom level restricted to the tiles of
+ * the block, reusing the open datasets and tilers of the previous blocks.  A
+ * heartbeat renews the lease of the block whilst it is being built.  Only
+ * blocks which were built, and whose lease was held throughout, are reported
+ * as complete: a failed block is handed back and ends the worker, and the
+ * building of a block whose lease was lost is stopped, leaving the block to
+ * the worker it was handed out to again.
+ */
+static int
+runWorker(TerrainBuild &command) {
+#ifdef _WIN32
+  cerr << "Error: --worker is not supported on Windows" << endl;
+  return 1;
+#else
+  if (!checkDistributable(command)) {
+    return 1;
+  }
+
+  BuildWorker worker(command.workerAddress);
+  vector<unique_ptr<WorkerCache>> caches;
+
+  try {
+    BuildWorker::Block block;
+    while (worker.lease(block)) {
+      workBlock.active = true;
+      workBlock.tiles = block.tiles;
+      workBlock.metadata = TerrainMetadata();
+      command.startZoom = command.endZoom = block.zoom;
+
+      // Renew the lease whilst building the block, stopping if it is lost
+      worker.beginHeartbeat(block, stopIteration);
+
+      const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      const int result = runBuild(command, &caches);
+      const double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+      const bool held = worker.endHeartbeat();
+
+      if (result) {
+        workBlock.active = false;
+        worker.fail(block);
+        return result;
+      }
+
+      // Another worker now holds the block, and reports it when it is built
+      if (!held) {
+        cerr << "Warning: the lease of block " << block.id << " was lost, so it is left to another worker" << endl;
+        continue;
+      }
+
+      // Report the block with the extent of the tiles built in it
+      worker.complete(block, iteratorSize, seconds, workBlock.metadata);
+    }
+  } catch (CTBException &e) {
+    cerr << "Error: " << e.what() << endl;
+    workBlock.active = false;
+    return 1;
+  }
+
+  workBlock.active = false;
+  return 0;
+#endif
+}
+
+/**
+ * Run the builds listed in a job file
+ *
+ * The job file is a JSON document with a `jobs` array.  Each job is an object
+ * whose `input` member names the source dataset and whose other members are
+ * the long names of the command line options, for example:
+ *
+ *     {"jobs": [{"input": "dem.vrt", "output-dir": "tiles", "start-zoom": 12}]}
+ *
+ * Options given on the command line apply to every job.  The builds are run
+ * in turn by the same number of threads, each keeping its datasets and tilers
+ * open between builds.
+ */
+static int
+runJobs(int argc, char *argv[], const char *jobFile) {
+#if GDAL_VERSION_NUM >= GDAL_COMPUTE_VERSION(2,3,0)
+  CPLJSONDocument document;
+  if (!document.Load(jobFile)) {
+    cerr << "Error: could not read the job file: " << jobFile << endl;
+    return 1;
+  }
+
+  CPLJSONArray jobs = document.GetRoot().GetArray("jobs");
+  if (!jobs.IsValid()) {
+    cerr << "Error: the job file must contain a `jobs` array" << endl;
+    return 1;
+  }
+
+  // The command line options other than the job file apply to every job
+  vector<string> defaultArgs;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "-j") == 0 || strcmp(argv[i], "--jobs") == 0) {
+      ++i;                      // skip the filename
+    } else {
+      defaultArgs.push_back(argv[i]);
+    }
+  }
+
+  vector<unique_ptr<WorkerCache>> caches;
+  for (int i = 0; i < jobs.Size(); ++i) {
+    const CPLJSONObject job = jobs[i];
+    vector<string> args(1, argv[0]);
+    string input;
+
+    args.insert(args.end(), defaultArgs.begin(), defaultArgs.end());
+
+    // Convert the job members to command line arguments
+    for (const CPLJSONObject &member : job.GetChildren()) {
+      const string option = "--" + member.GetName();
+
+      switch (member.GetType()) {
+      case CPLJSONObject::Type::Boolean:
+        if (member.ToBool()) args.push_back(option);
+        break;
+      case CPLJSONObject::Type::Array: {
+        const CPLJSONArray values = member.ToArray();
+        for (int j = 0; j < values.Size(); ++j) {
+          args.push_back(option);
+          args.push_back(values[j].ToString());
+        }
+        break;
+      }
+      default:
+        if (member.GetName() == "input") {
+          input = member.ToString();
+        } else {
+          args.push_back(option);
+          args.push_back(member.ToString());
+        }
+      }
+    }
+
+    if (input.empty()) {
+      cerr << "Error: job " << (i + 1) << " does not specify an `input` dataset" << endl;
+      return 1;
+    }
+    args.push_back(input);
+
+    vector<char *> jobArgv;
+    for (string &arg : args) {
+      jobArgv.push_back(&arg[0]);
+    }
+    jobArgv.push_back(NULL);
+
+    TerrainBuild command = TerrainBuild(argv[0], version.cstr);
+    defineOptions(command);
+    command.parse((int) args.size(), jobArgv.data());
+    command.check();
+
+    if (command.verbosity > 0) {
+      cout << "Job " << (i + 1) << " of " << jobs.Size() << ": " << input << endl;
+    }
+
+    int retval = runBuild(command, &caches);
+    if (retval) {
+      return retval;
+    }
+  }
+
+  return 0;
+#else
+  cerr << "Error: job files require GDAL 2.3 or later" << endl;
+  return 1;
+#endif
+}
+
+int
+main(int argc, char *argv[]) {
+  TerrainBuild command = TerrainBuild(argv[0], version.cstr);
+  defineOptions(command);
+
+  // Parse and check the arguments
+  command.parse(argc, argv);
+  command.check();
+
+  GDALAllRegister();
+
+  if (command.jobFile) {
+    return runJobs(argc, argv, command.jobFile);
+  }
+
+  if (command.workerAddress) {
+    return runWorker(command);
+  }
+
+  return runBuild(command, NULL);
+}